@@ -5,6 +5,14 @@
 // 1600 FPS by removing metrics collection
 // 6500 FPS by using int_list (same data structre as quad_tree_c)
 
+enum class SpatialBackend
+{
+    QuadTree,
+    UniformGrid,
+    CQuadTree,
+    BruteForce
+};
+
 struct GlobalSettings {
     const int WorldWidth = 10000;
     const int WorldHeight = 10000;
@@ -14,7 +22,21 @@ struct GlobalSettings {
     const int MaxRectSize = 10;
     const int MaxQuadTreeDepth = 16;
     const int QuadTreeSplitThreshold = 8;
-    const bool UseQuadTree = true;
+    const SpatialBackend Backend = SpatialBackend::QuadTree;
+    const int GridCellSize = 32;
+    // Quad tree boxes are grown by how far a sprite travels in this long, so
+    // most frames it doesn't have to move in the tree. 0 keeps exact boxes.
+    const int FatBoxMs = 66;
+    // Map the quad tree's lists in huge pages once they pass 2 MB.
+    const bool QuadTreeHugePages = false;
+    const bool DoubleBufferedRebuild = false;
+    // Sweep sprites over each step so fast ones can't pass through each other.
+    const bool ContinuousCollision = false;
+    // Resolve collisions in AVX2 batches. Measured no faster than the scalar
+    // loop (gather/scatter is bound by cache misses), so it is opt-in.
+    const bool SimdCollide = false;
+    // Threads used to build the quad tree and find collisions, 0 = one per core.
+    const int CollisionThreads = 0;
     const int ViewportWidth = 400;
     const int ViewportHeight = 400;
 };
@@ -0,0 +1,186 @@
+#include "cquad_index.h"
+#include "quad_tree_c/quad_tree.h"
+#include "jrender.h"
+
+struct CQuadTreeState
+{
+    Quadtree tree;
+    IntList queryResults;
+};
+
+#ifndef NOIN_HEADLESS
+struct CQuadTreeDrawData
+{
+    SDL_Renderer *renderer;
+    Mat3 *transform;
+    int maxDepth;
+    int offsetX;
+    int offsetY;
+};
+
+static void drawLeafCallback(Quadtree *qt, void *user_data, int node, int depth, int mx, int my, int sx, int sy)
+{
+    CQuadTreeDrawData *data = (CQuadTreeDrawData *)user_data;
+    // Back from the top-left origin to world space.
+    Vec2 p = (*data->transform) * Vec2((mx - sx) - data->offsetX, data->offsetY - (my - sy));
+    SDL_Rect rect = {(int)p.x, (int)p.y, sx << 1, sy << 1};
+    int alpha = 12 + (64 - depth * (64 / data->maxDepth));
+    SDL_SetRenderDrawColor(data->renderer, 255, 255, 255, alpha);
+    SDL_RenderDrawRect(data->renderer, &rect);
+}
+#endif
+
+static bool strictIntersects(int l1, int t1, int r1, int b1,
+                             int l2, int t2, int r2, int b2)
+{
+    // y+ is down in the C tree so top < bottom.
+    return l2 < r1 && r2 > l1 && t2 < b1 && b2 > t1;
+}
+
+CQuadTreeIndex::CQuadTreeIndex(Rect bounds, int maxDepth, int splitThreshold)
+    : _State(new CQuadTreeState),
+      _Bounds(bounds)
+{
+    qt_create(&_State->tree, bounds.w, bounds.h, splitThreshold, maxDepth);
+    il_create(&_State->queryResults, 1);
+}
+
+CQuadTreeIndex::~CQuadTreeIndex()
+{
+    il_destroy(&_State->queryResults);
+    qt_destroy(&_State->tree);
+    delete _State;
+}
+
+int CQuadTreeIndex::Insert(int id, Rect &rect)
+{
+    const int elementIndex = qt_insert(
+        &_State->tree,
+        id,
+        (float)(rect.L() - _Bounds.L()),
+        (float)(_Bounds.T() - rect.T()),
+        (float)(rect.R() - _Bounds.L()),
+        (float)(_Bounds.T() - rect.B()));
+
+    if (elementIndex >= (int)_Alive.size())
+    {
+        _Alive.resize(elementIndex + 1, false);
+    }
+    _Alive[elementIndex] = true;
+    return elementIndex;
+}
+
+void CQuadTreeIndex::Remove(int elementIndex)
+{
+    qt_remove(&_State->tree, elementIndex);
+    _Alive[elementIndex] = false;
+}
+
+int CQuadTreeIndex::Move(int elementIndex, Rect &rect)
+{
+    const int id = il_get(&_State->tree.elts, elementIndex, elt_idx_id);
+    Remove(elementIndex);
+    return Insert(id, rect);
+}
+
+void CQuadTreeIndex::Query(Rect query, vector<int> &output)
+{
+    Quadtree *qt = &_State->tree;
+    IntList *results = &_State->queryResults;
+    const int l = query.L() - _Bounds.L();
+    const int t = _Bounds.T() - query.T();
+    const int r = query.R() - _Bounds.L();
+    const int b = _Bounds.T() - query.B();
+    qt_query(qt, results, (float)l, (float)t, (float)r, (float)b, -1);
+
+    for (int i = 0; i < il_size(results); i++)
+    {
+        // qt_query matches touching edges too, the other backends do not.
+        const int element = il_get(results, i, 0);
+        if (strictIntersects(l, t, r, b,
+                             il_get(&qt->elts, element, elt_idx_lft),
+                             il_get(&qt->elts, element, elt_idx_top),
+                             il_get(&qt->elts, element, elt_idx_rgt),
+                             il_get(&qt->elts, element, elt_idx_btm)))
+        {
+            output.push_back(il_get(&qt->elts, element, elt_idx_id));
+        }
+    }
+}
+
+void CQuadTreeIndex::FindPairs(vector<pair<int, int>> &output)
+{
+    Quadtree *qt = &_State->tree;
+    IntList *results = &_State->queryResults;
+    for (int a = 0; a < (int)_Alive.size(); a++)
+    {
+        if (!_Alive[a])
+        {
+            continue;
+        }
+
+        const int l = il_get(&qt->elts, a, elt_idx_lft);
+        const int t = il_get(&qt->elts, a, elt_idx_top);
+        const int r = il_get(&qt->elts, a, elt_idx_rgt);
+        const int b = il_get(&qt->elts, a, elt_idx_btm);
+        qt_query(qt, results, (float)l, (float)t, (float)r, (float)b, a);
+
+        const int aId = il_get(&qt->elts, a, elt_idx_id);
+        for (int i = 0; i < il_size(results); i++)
+        {
+            // Every pair is seen from both sides, keep the one from the lower index.
+            const int other = il_get(results, i, 0);
+            if (other < a)
+            {
+                continue;
+            }
+            if (strictIntersects(l, t, r, b,
+                                 il_get(&qt->elts, other, elt_idx_lft),
+                                 il_get(&qt->elts, other, elt_idx_top),
+                                 il_get(&qt->elts, other, elt_idx_rgt),
+                                 il_get(&qt->elts, other, elt_idx_btm)))
+            {
+                output.emplace_back(aId, il_get(&qt->elts, other, elt_idx_id));
+            }
+        }
+    }
+}
+
+void CQuadTreeIndex::Clean()
+{
+    qt_cleanup(&_State->tree);
+}
+
+#ifndef NOIN_HEADLESS
+void CQuadTreeIndex::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs, bool renderRects)
+{
+    Quadtree *qt = &_State->tree;
+    CQuadTreeDrawData data;
+    data.renderer = renderer;
+    data.transform = &transform;
+    data.maxDepth = qt->max_depth;
+    data.offsetX = -_Bounds.L();
+    data.offsetY = _Bounds.T();
+    qt_traverse(qt, &data, nullptr, drawLeafCallback);
+
+    if (!renderRects)
+    {
+        return;
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+    for (int element = 0; element < (int)_Alive.size(); element++)
+    {
+        if (!_Alive[element])
+        {
+            continue;
+        }
+        const int l = il_get(&qt->elts, element, elt_idx_lft);
+        const int t = il_get(&qt->elts, element, elt_idx_top);
+        const int r = il_get(&qt->elts, element, elt_idx_rgt);
+        const int b = il_get(&qt->elts, element, elt_idx_btm);
+        Vec2 p = transform * Vec2(l + _Bounds.L(), _Bounds.T() - t);
+        SDL_Rect rect = {(int)p.x, (int)p.y, r - l, b - t};
+        SDL_RenderDrawRect(renderer, &rect);
+    }
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <vector>
+
+#include "jmath.h"
+#include "jrender.h"
+
+using namespace std;
+
+// Lives in its own header so the C IntList (which redefines il_fixed_cap)
+// never ends up in the same translation unit as JIntList.
+struct CQuadTreeState;
+
+// Adapter over the vendored C quad tree (quad_tree_c/quad_tree.h).
+// The C tree has its origin in the top-left corner with y+ going down,
+// so every rect is mapped into that space on the way in.
+class CQuadTreeIndex
+{
+public:
+    CQuadTreeIndex(Rect bounds, int maxDepth, int splitThreshold);
+    ~CQuadTreeIndex();
+    CQuadTreeIndex(const CQuadTreeIndex &) = delete;
+    CQuadTreeIndex &operator=(const CQuadTreeIndex &) = delete;
+
+    int Insert(int id, Rect &rect);
+    void Remove(int elementIndex);
+    int Move(int elementIndex, Rect &rect);
+    // Appends the ids of every element intersecting the query.
+    void Query(Rect query, vector<int> &output);
+    void FindPairs(vector<pair<int, int>> &output);
+    void Clean();
+    void Draw(SDL_Renderer *renderer,
+              Mat3 &transform,
+              chrono::milliseconds deltaMs,
+              bool renderRects);
+
+private:
+    CQuadTreeState *_State;
+    Rect _Bounds;
+    // The C tree recycles the first field of erased elements for its free
+    // list, so liveness has to be tracked on the side for FindPairs.
+    vector<bool> _Alive;
+};
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "jmath.h"
+#include "consts.h"
+#include "scene.h"
+#include "scene_replay.h"
+#include "scene_tools.h"
+#include "spatial_index.h"
+
+using namespace std;
+typedef std::chrono::high_resolution_clock rclock;
+
+// Runs the simulation without a window and reports how fast it went. Built
+// with NOIN_HEADLESS, so it needs neither SDL nor a display.
+
+struct HeadlessOptions
+{
+    int frames = 600;
+    int sprites = g_Settings.NumberSprites;
+    int worldWidth = g_Settings.WorldWidth;
+    int worldHeight = g_Settings.WorldHeight;
+    int stepMs = 16;
+    int threads = g_Settings.CollisionThreads;
+    unsigned seed = 1250;
+    SpatialBackend backend = g_Settings.Backend;
+    SpatialIndexParams params;
+    // Random rect queries against the index after every update.
+    int queries = 0;
+    bool pairCache = false;
+    bool doubleBuffered = g_Settings.DoubleBufferedRebuild;
+    bool continuous = g_Settings.ContinuousCollision;
+    // Writes the run out for --replay.
+    const char *recordPath = nullptr;
+    // Each of these runs instead of the simulation.
+    const char *replayPath = nullptr;
+    const char *rectsPath = nullptr;
+    const char *convertInput = nullptr;
+    const char *convertOutput = nullptr;
+    int rectChunk = RECT_FILE_CHUNK;
+    bool checkSimd = false;
+};
+
+static void printUsage()
+{
+    printf("noin_headless [options]\n"
+           "  --frames N          updates to run (600)\n"
+           "  --sprites N         sprite count (%d)\n"
+           "  --world W H         world size (%d %d)\n"
+           "  --step MS           delta of every update (16)\n"
+           "  --backend NAME      quad, grid, cquad or brute\n"
+           "  --depth N           quad tree max depth (%d)\n"
+           "  --split N           quad tree split threshold (%d)\n"
+           "  --cell N            grid cell size (%d)\n"
+           "  --free-policy NAME  quad tree free slot reuse, lifo or lowest\n"
+           "  --queries N         rect queries after every update (0)\n"
+           "  --threads N         worker threads, 0 = one per core\n"
+           "  --seed N            sprite placement seed (1250)\n"
+           "  --pair-cache        carry collision pairs over between updates\n"
+           "  --double-buffered   rebuild the quad tree on a worker thread\n"
+           "  --continuous        continuous collision\n"
+           "  --record PATH       record the run for --replay\n"
+           "  --replay PATH       replay a recording instead, same index options\n"
+           "  --rects PATH        index a rect dataset (CSV or binary) instead\n"
+           "  --rect-chunk N      rects read at a time (%d)\n"
+           "  --convert-rects IN OUT  rewrite a rect dataset in the binary format\n"
+           "  --check-simd        compare the SIMD sprite kernels with the scalar ones\n",
+           g_Settings.NumberSprites, g_Settings.WorldWidth, g_Settings.WorldHeight,
+           g_Settings.MaxQuadTreeDepth, g_Settings.QuadTreeSplitThreshold, g_Settings.GridCellSize,
+           RECT_FILE_CHUNK);
+}
+
+static bool parseOptions(int argc, char *argv[], HeadlessOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--frames") == 0 && hasValue)
+        {
+            options.frames = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--sprites") == 0 && hasValue)
+        {
+            options.sprites = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--world") == 0 && i + 2 < argc)
+        {
+            options.worldWidth = atoi(argv[++i]);
+            options.worldHeight = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--step") == 0 && hasValue)
+        {
+            options.stepMs = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--backend") == 0 && hasValue)
+        {
+            if (!ParseSpatialBackend(argv[++i], options.backend))
+            {
+                printf("Unknown backend '%s', expected quad, grid, cquad or brute\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--depth") == 0 && hasValue)
+        {
+            options.params.maxDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--split") == 0 && hasValue)
+        {
+            options.params.splitThreshold = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--cell") == 0 && hasValue)
+        {
+            options.params.gridCellSize = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--free-policy") == 0 && hasValue)
+        {
+            const char *name = argv[++i];
+            if (strcmp(name, "lifo") == 0)
+            {
+                options.params.freePolicy = FreeListPolicy::Lifo;
+            }
+            else if (strcmp(name, "lowest") == 0)
+            {
+                options.params.freePolicy = FreeListPolicy::LowestIndex;
+            }
+            else
+            {
+                printf("Unknown free policy '%s', expected lifo or lowest\n", name);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--queries") == 0 && hasValue)
+        {
+            options.queries = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+        {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--seed") == 0 && hasValue)
+        {
+            options.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--pair-cache") == 0)
+        {
+            options.pairCache = true;
+        }
+        else if (strcmp(arg, "--double-buffered") == 0)
+        {
+            options.doubleBuffered = true;
+        }
+        else if (strcmp(arg, "--continuous") == 0)
+        {
+            options.continuous = true;
+        }
+        else if (strcmp(arg, "--record") == 0 && hasValue)
+        {
+            options.recordPath = argv[++i];
+        }
+        else if (strcmp(arg, "--replay") == 0 && hasValue)
+        {
+            options.replayPath = argv[++i];
+        }
+        else if (strcmp(arg, "--rects") == 0 && hasValue)
+        {
+            options.rectsPath = argv[++i];
+        }
+        else if (strcmp(arg, "--rect-chunk") == 0 && hasValue)
+        {
+            options.rectChunk = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--convert-rects") == 0 && i + 2 < argc)
+        {
+            options.convertInput = argv[++i];
+            options.convertOutput = argv[++i];
+        }
+        else if (strcmp(arg, "--check-simd") == 0)
+        {
+            options.checkSimd = true;
+        }
+        else
+        {
+            printUsage();
+            return false;
+        }
+    }
+    if (options.frames < 0 || options.sprites < 0 || options.queries < 0 ||
+        options.worldWidth < 4 || options.worldHeight < 4 ||
+        options.params.maxDepth < 1 || options.params.splitThreshold < 1 || options.params.gridCellSize < 1)
+    {
+        printf("Counts can't be negative, the world must be at least 4x4 and tree/grid parameters at least 1\n");
+        return false;
+    }
+    return true;
+}
+
+// Same placement as the windowed build, sprites start in the middle half of
+// the world.
+static void addSprites(Scene &scene, int count, unsigned seed)
+{
+    srand(seed);
+    scene._Sprites.Reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        const SceneEvent sprite = RandomSpawnEvent(scene._WorldBox);
+        scene._Sprites.Add(Vec2(sprite.x, sprite.y), Vec2(sprite.vx, sprite.vy),
+                           Rect((int)sprite.x, (int)sprite.y, sprite.w, sprite.h));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+    if (options.checkSimd)
+    {
+        return CheckSimd();
+    }
+    if (options.convertInput != nullptr)
+    {
+        return ConvertRectFile(options.convertInput, options.convertOutput, options.rectChunk);
+    }
+    if (options.rectsPath != nullptr)
+    {
+        return IndexRectFile(options.rectsPath, Rect(0, 0, options.worldWidth, options.worldHeight),
+                             options.params, options.rectChunk, options.threads);
+    }
+    if (options.replayPath != nullptr)
+    {
+        return ReplayRecording(options.replayPath, options.threads, options.params);
+    }
+
+    Scene scene(Rect(0, 0, options.worldWidth, options.worldHeight), options.backend, options.params);
+    if (options.threads != g_Settings.CollisionThreads)
+    {
+        scene.SetCollisionThreads(options.threads);
+    }
+    addSprites(scene, options.sprites, options.seed);
+
+    auto start = rclock::now();
+    scene.Build();
+    const double buildMs = chrono::duration<double, milli>(rclock::now() - start).count();
+    scene.SetContinuousCollision(options.continuous);
+    scene.SetDoubleBuffered(options.doubleBuffered);
+    scene.SetPairCache(options.pairCache);
+
+    printf("World %dx%d, %d sprites, %s index, depth %d, split %d, cell %d, %s free list\n",
+           options.worldWidth, options.worldHeight, options.sprites,
+           SpatialBackendName(options.backend), options.params.maxDepth,
+           options.params.splitThreshold, options.params.gridCellSize,
+           options.params.freePolicy == FreeListPolicy::LowestIndex ? "lowest" : "lifo");
+    printf("Built in %.2f ms\n", buildMs);
+
+    // Same start as a recording of the windowed build, which cleans the
+    // tree before it writes the scene out.
+    SceneRecorder recorder;
+    const vector<SceneEvent> noEvents;
+    if (options.recordPath != nullptr)
+    {
+        scene.Clean();
+        if (!recorder.Open(options.recordPath, scene))
+        {
+            printf("Could not record to '%s'\n", options.recordPath);
+            return 1;
+        }
+    }
+
+    // Same order as a frame of the windowed build, minus the drawing.
+    SceneUpdateTimings phases;
+    double cleanMs = 0;
+    double queryMs = 0;
+    long long queryHits = 0;
+    // Own generator, rand() stays as the scene left it.
+    uint32_t queryState = options.seed * 2654435761u + 1;
+    vector<int> queryOutput;
+    const chrono::milliseconds stepMs(options.stepMs);
+    start = rclock::now();
+    for (int frame = 0; frame < options.frames; frame++)
+    {
+        recorder.WriteUpdate(stepMs, noEvents);
+        scene.Update(stepMs);
+        auto cleanStart = rclock::now();
+        scene.Clean();
+        cleanMs += chrono::duration<double, milli>(rclock::now() - cleanStart).count();
+
+        auto queryStart = rclock::now();
+        for (int q = 0; q < options.queries; q++)
+        {
+            queryState = queryState * 1664525u + 1013904223u;
+            const int x = (int)(queryState >> 8) % scene._WorldBox.W2() - scene._WorldBox.W4();
+            queryState = queryState * 1664525u + 1013904223u;
+            const int y = (int)(queryState >> 8) % scene._WorldBox.H2() - scene._WorldBox.H4();
+            const Rect query(x, y, g_Settings.MaxRectSize * 4, g_Settings.MaxRectSize * 4);
+            queryOutput.clear();
+            visit([&](auto &index) { index.Query(query, queryOutput); }, scene._Index);
+            queryHits += (long long)queryOutput.size();
+        }
+        queryMs += chrono::duration<double, milli>(rclock::now() - queryStart).count();
+
+        const SceneUpdateTimings &timings = scene.GetLastUpdateTimings();
+        phases.findPairsMs += timings.findPairsMs;
+        phases.collideMs += timings.collideMs;
+        phases.integrateMs += timings.integrateMs;
+        phases.indexMs += timings.indexMs;
+    }
+    const double totalMs = chrono::duration<double, milli>(rclock::now() - start).count();
+
+    const double perFrame = options.frames > 0 ? 1.0 / options.frames : 0.0;
+    const double seconds = totalMs / 1000.0;
+    printf("%d updates in %.1f ms, %.3f ms per update, %.1f updates/s, %.2f M sprite updates/s\n",
+           options.frames, totalMs, totalMs * perFrame,
+           seconds > 0 ? options.frames / seconds : 0.0,
+           seconds > 0 ? (double)options.frames * scene._Sprites.Size() / seconds / 1e6 : 0.0);
+    printf("  find pairs %.3f ms, collide %.3f ms, integrate %.3f ms, index %.3f ms, clean %.3f ms\n",
+           phases.findPairsMs * perFrame, phases.collideMs * perFrame,
+           phases.integrateMs * perFrame, phases.indexMs * perFrame, cleanMs * perFrame);
+    if (options.queries > 0 && options.frames > 0)
+    {
+        printf("  %d queries %.3f ms, %.1f ids each\n",
+               options.queries, queryMs * perFrame,
+               (double)queryHits / ((double)options.queries * options.frames));
+    }
+    printf("State hash %016llx\n", (unsigned long long)HashScene(scene));
+    if (recorder.IsOpen() && !recorder.Close(scene))
+    {
+        printf("Could not finish recording '%s'\n", options.recordPath);
+        return 1;
+    }
+    return 0;
+}
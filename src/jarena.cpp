@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <algorithm>
+
+#include "jarena.h"
+
+FrameArena::FrameArena(size_t blockSize)
+    : _BlockSize(blockSize)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    for (Block &block : _Blocks)
+    {
+        free(block.data);
+    }
+}
+
+void *FrameArena::Allocate(size_t size, size_t alignment)
+{
+    while (true)
+    {
+        if (_Current < (int)_Blocks.size())
+        {
+            Block &block = _Blocks[_Current];
+            const size_t offset = (_Offset + alignment - 1) & ~(alignment - 1);
+            if (offset + size <= block.size)
+            {
+                _Offset = offset + size;
+                return block.data + offset;
+            }
+            // Doesn't fit, the rest of this block is wasted until a rewind.
+            if (_Current + 1 < (int)_Blocks.size())
+            {
+                _Current++;
+                _Offset = 0;
+                continue;
+            }
+        }
+
+        // Out of blocks. malloc is aligned enough for anything we hold.
+        const size_t blockSize = max(_BlockSize, size + alignment);
+        _Blocks.push_back({(char *)malloc(blockSize), blockSize});
+        _Current = (int)_Blocks.size() - 1;
+        _Offset = 0;
+    }
+}
+
+void FrameArena::Reset()
+{
+    _HighWater = max(_HighWater, BytesUsed());
+    if (_Blocks.size() > 1)
+    {
+        size_t total = 0;
+        for (Block &block : _Blocks)
+        {
+            total += block.size;
+            free(block.data);
+        }
+        _Blocks.clear();
+        _Blocks.push_back({(char *)malloc(total), total});
+    }
+    _Current = 0;
+    _Offset = 0;
+}
+
+void FrameArena::Release()
+{
+    _HighWater = max(_HighWater, BytesUsed());
+    for (Block &block : _Blocks)
+    {
+        free(block.data);
+    }
+    _Blocks.clear();
+    _Current = 0;
+    _Offset = 0;
+}
+
+void FrameArena::Rewind(Marker marker)
+{
+    _HighWater = max(_HighWater, BytesUsed());
+    _Current = marker.block;
+    _Offset = marker.offset;
+}
+
+size_t FrameArena::BytesUsed() const
+{
+    size_t used = _Offset;
+    for (int i = 0; i < _Current && i < (int)_Blocks.size(); i++)
+    {
+        used += _Blocks[i].size;
+    }
+    return used;
+}
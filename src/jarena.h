@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator for temporaries that die by the end of a frame. Freeing
+// is a no-op, everything goes at once with Reset (or back to a Mark with
+// Rewind). Blocks are kept across resets, so once an arena has seen a
+// frame's high water mark it stops calling malloc. Not thread safe, use
+// one per thread.
+class FrameArena
+{
+public:
+    struct Marker
+    {
+        int block;
+        size_t offset;
+    };
+
+    explicit FrameArena(size_t blockSize = 64 * 1024);
+    ~FrameArena();
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    void *Allocate(size_t size, size_t alignment);
+
+    // Releases everything. If the frame spilled over into several blocks
+    // they are replaced by one big enough for all of it.
+    void Reset();
+
+    // Releases everything and frees every block, for arenas which won't see
+    // a frame like the last one again.
+    void Release();
+
+    Marker Mark() const { return {_Current, _Offset}; }
+    // Releases everything allocated since 'marker'.
+    void Rewind(Marker marker);
+
+    // Bytes handed out since the last reset and the most that ever was.
+    size_t BytesUsed() const;
+    size_t HighWater() const { return _HighWater; }
+
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+
+    vector<Block> _Blocks;
+    int _Current = 0;
+    size_t _Offset = 0;
+    size_t _BlockSize;
+    size_t _HighWater = 0;
+};
+
+// Rewinds an arena when it goes out of scope, for temporaries of one call.
+class ArenaScope
+{
+public:
+    explicit ArenaScope(FrameArena &arena) : _Arena(arena), _Marker(arena.Mark()) {}
+    ~ArenaScope() { _Arena.Rewind(_Marker); }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    FrameArena &_Arena;
+    FrameArena::Marker _Marker;
+};
+
+// Standard allocator on top of a FrameArena. Memory only comes back when
+// the arena is reset or rewound, so containers should not outlive that.
+template <class T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    FrameArena *arena;
+
+    ArenaAllocator(FrameArena &arena) : arena(&arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) { return (T *)arena->Allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T *, size_t) {}
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+template <class T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
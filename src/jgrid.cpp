@@ -0,0 +1,301 @@
+#include "jgrid.h"
+#include "jrender.h"
+
+UniformGrid::UniformGrid(Rect bounds, int cellW, int cellH)
+    : _Bounds(bounds),
+      _cellW(cellW),
+      _cellH(cellH)
+{
+    _numCols = (bounds.w + cellW - 1) / cellW;
+    _numRows = (bounds.h + cellH - 1) / cellH;
+    if (_numCols < 1)
+        _numCols = 1;
+    if (_numRows < 1)
+        _numRows = 1;
+
+    for (int i = 0; i < _numCols * _numRows; i++)
+    {
+        _Cells.Add();
+    }
+}
+UniformGrid::~UniformGrid() {}
+
+int UniformGrid::Insert(int id, Rect &rect)
+{
+    const int left = rect.x - (rect.w >> 1);
+    const int top = rect.y + (rect.h >> 1);
+    const int right = rect.x + (rect.w >> 1);
+    const int bottom = rect.y - (rect.h >> 1);
+    const int elementIndex = _Elements.Add(id, left, top, right, bottom);
+
+    LinkElement(elementIndex, CellX(left), CellY(bottom), CellX(right), CellY(top));
+    return elementIndex;
+}
+
+void UniformGrid::Remove(int elementIndex)
+{
+    const int left = _Elements.GetLeft(elementIndex);
+    const int top = _Elements.GetTop(elementIndex);
+    const int right = _Elements.GetRight(elementIndex);
+    const int bottom = _Elements.GetBottom(elementIndex);
+
+    UnlinkElement(elementIndex, CellX(left), CellY(bottom), CellX(right), CellY(top));
+    _Elements.erase(elementIndex);
+}
+
+int UniformGrid::Move(int elementIndex, Rect &rect)
+{
+    const int oldX0 = CellX(_Elements.GetLeft(elementIndex));
+    const int oldY0 = CellY(_Elements.GetBottom(elementIndex));
+    const int oldX1 = CellX(_Elements.GetRight(elementIndex));
+    const int oldY1 = CellY(_Elements.GetTop(elementIndex));
+
+    const int left = rect.x - (rect.w >> 1);
+    const int top = rect.y + (rect.h >> 1);
+    const int right = rect.x + (rect.w >> 1);
+    const int bottom = rect.y - (rect.h >> 1);
+    _Elements.SetLeft(elementIndex, left);
+    _Elements.SetTop(elementIndex, top);
+    _Elements.SetRight(elementIndex, right);
+    _Elements.SetBottom(elementIndex, bottom);
+
+    const int x0 = CellX(left);
+    const int y0 = CellY(bottom);
+    const int x1 = CellX(right);
+    const int y1 = CellY(top);
+
+    // Most movers stay inside the same cells between frames, in which
+    // case updating the bounds is all there is to do.
+    if (x0 != oldX0 || y0 != oldY0 || x1 != oldX1 || y1 != oldY1)
+    {
+        UnlinkElement(elementIndex, oldX0, oldY0, oldX1, oldY1);
+        LinkElement(elementIndex, x0, y0, x1, y1);
+    }
+    return elementIndex;
+}
+
+void UniformGrid::Query(Rect query,
+                        unordered_map<int, bool> &seen,
+                        vector<int> *output)
+{
+    const int left = query.L();
+    const int top = query.T();
+    const int right = query.R();
+    const int bottom = query.B();
+
+    const int x0 = CellX(left);
+    const int y0 = CellY(bottom);
+    const int x1 = CellX(right);
+    const int y1 = CellY(top);
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            int elementNodeIndex = _Cells.GetHead(cy * _numCols + cx);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = _ElementNodes.GetElementId(elementNodeIndex);
+                elementNodeIndex = _ElementNodes.GetNext(elementNodeIndex);
+                if (seen.find(elementIndex) != seen.end())
+                {
+                    continue;
+                }
+
+                const int l = _Elements.GetLeft(elementIndex);
+                const int t = _Elements.GetTop(elementIndex);
+                const int r = _Elements.GetRight(elementIndex);
+                const int b = _Elements.GetBottom(elementIndex);
+                if (Intersects(left, top, right, bottom,
+                               l, t, r, b))
+                {
+                    output->push_back(elementIndex);
+                }
+                seen[elementIndex] = true;
+            }
+        }
+    }
+}
+
+void UniformGrid::FindPairs(vector<pair<int, int>> &output)
+{
+    const int numCells = _numCols * _numRows;
+    for (int cell = 0; cell < numCells; cell++)
+    {
+        if (_Cells.GetCount(cell) < 2)
+        {
+            continue;
+        }
+
+        int aNodeIndex = _Cells.GetHead(cell);
+        while (aNodeIndex != -1)
+        {
+            const int a = _ElementNodes.GetElementId(aNodeIndex);
+            const int aLeft = _Elements.GetLeft(a);
+            const int aTop = _Elements.GetTop(a);
+            const int aRight = _Elements.GetRight(a);
+            const int aBottom = _Elements.GetBottom(a);
+
+            int bNodeIndex = _ElementNodes.GetNext(aNodeIndex);
+            while (bNodeIndex != -1)
+            {
+                const int b = _ElementNodes.GetElementId(bNodeIndex);
+                bNodeIndex = _ElementNodes.GetNext(bNodeIndex);
+
+                const int bLeft = _Elements.GetLeft(b);
+                const int bTop = _Elements.GetTop(b);
+                const int bRight = _Elements.GetRight(b);
+                const int bBottom = _Elements.GetBottom(b);
+                if (!Intersects(aLeft, aTop, aRight, aBottom,
+                                bLeft, bTop, bRight, bBottom))
+                {
+                    continue;
+                }
+
+                // A pair spanning several cells shows up in all of them.
+                // Only the cell holding the top-left corner of the overlap
+                // reports it. That corner lies in both rects, so the cell
+                // always has both elements linked.
+                const int ownerX = CellX(aLeft > bLeft ? aLeft : bLeft);
+                const int ownerY = CellY(aTop < bTop ? aTop : bTop);
+                if (ownerY * _numCols + ownerX != cell)
+                {
+                    continue;
+                }
+                output.emplace_back(_Elements.GetId(a), _Elements.GetId(b));
+            }
+            aNodeIndex = _ElementNodes.GetNext(aNodeIndex);
+        }
+    }
+}
+
+void UniformGrid::Clean() {}
+
+#ifndef NOIN_HEADLESS
+void UniformGrid::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs, bool renderRects)
+{
+    const int gridLeft = _Bounds.L();
+    const int gridBottom = _Bounds.B();
+    const int numCells = _numCols * _numRows;
+    for (int cell = 0; cell < numCells; cell++)
+    {
+        // Only occupied cells are drawn, an empty grid is just noise.
+        if (_Cells.GetCount(cell) == 0)
+        {
+            continue;
+        }
+
+        const int cx = cell % _numCols;
+        const int cy = cell / _numCols;
+        Vec2 p = transform * Vec2(gridLeft + cx * _cellW, gridBottom + (cy + 1) * _cellH);
+        SDL_Rect rect = {(int)p.x, (int)p.y, _cellW, _cellH};
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 40);
+        SDL_RenderDrawRect(renderer, &rect);
+
+        if (!renderRects)
+        {
+            continue;
+        }
+        int elementNodeIndex = _Cells.GetHead(cell);
+        while (elementNodeIndex != -1)
+        {
+            const int elementIndex = _ElementNodes.GetElementId(elementNodeIndex);
+            const int left = _Elements.GetLeft(elementIndex);
+            const int right = _Elements.GetRight(elementIndex);
+            const int top = _Elements.GetTop(elementIndex);
+            const int bottom = _Elements.GetBottom(elementIndex);
+
+            Vec2 newPos = transform * Vec2(left, top);
+            SDL_Rect elementRect = {
+                (int)newPos.x,
+                (int)newPos.y,
+                abs(right - left),
+                abs(top - bottom)};
+            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+            SDL_RenderDrawRect(renderer, &elementRect);
+
+            elementNodeIndex = _ElementNodes.GetNext(elementNodeIndex);
+        }
+    }
+}
+#endif
+
+// ----------------------------------
+// PRIVATE
+// ----------------------------------
+bool UniformGrid::Intersects(
+    const int aLeft, const int aTop, const int aRight, const int aBottom,
+    const int bLeft, const int bTop, const int bRight, const int bBottom)
+{
+    return (
+        aLeft < bRight &&
+        aRight > bLeft &&
+        aTop > bBottom &&
+        aBottom < bTop);
+}
+
+int UniformGrid::CellX(int x)
+{
+    // Anything outside the grid is clamped into the border cells.
+    const int cx = (x - _Bounds.L()) / _cellW;
+    return cx < 0 ? 0 : (cx >= _numCols ? _numCols - 1 : cx);
+}
+
+int UniformGrid::CellY(int y)
+{
+    const int cy = (y - _Bounds.B()) / _cellH;
+    return cy < 0 ? 0 : (cy >= _numRows ? _numRows - 1 : cy);
+}
+
+void UniformGrid::LinkElement(int elementIndex, int x0, int y0, int x1, int y1)
+{
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            const int cell = cy * _numCols + cx;
+            const int elementNodeIndex = _ElementNodes.Add(elementIndex);
+            _ElementNodes.SetNext(elementNodeIndex, _Cells.GetHead(cell));
+            _Cells.SetHead(cell, elementNodeIndex);
+            _Cells.SetCount(cell, _Cells.GetCount(cell) + 1);
+        }
+    }
+}
+
+void UniformGrid::UnlinkElement(int elementIndex, int x0, int y0, int x1, int y1)
+{
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            const int cell = cy * _numCols + cx;
+
+            int beforeIndex = -1;
+            int currentElementNodeIndex = _Cells.GetHead(cell);
+            while (currentElementNodeIndex != -1)
+            {
+                if (_ElementNodes.GetElementId(currentElementNodeIndex) == elementIndex)
+                {
+                    break;
+                }
+                beforeIndex = currentElementNodeIndex;
+                currentElementNodeIndex = _ElementNodes.GetNext(currentElementNodeIndex);
+            }
+            if (currentElementNodeIndex == -1)
+            {
+                continue;
+            }
+
+            const int next = _ElementNodes.GetNext(currentElementNodeIndex);
+            if (beforeIndex == -1)
+            {
+                _Cells.SetHead(cell, next);
+            }
+            else
+            {
+                _ElementNodes.SetNext(beforeIndex, next);
+            }
+            _Cells.SetCount(cell, _Cells.GetCount(cell) - 1);
+            _ElementNodes.erase(currentElementNodeIndex);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+
+#include "jmath.h"
+#include "jint_list.h"
+#include "jrender.h"
+
+using namespace std;
+
+// Flat grid of equally sized cells. Better suited than the QuadTree when
+// every element is roughly the same size and everything moves every frame,
+// since there is no hierarchy to split or clean up.
+//
+// Each cell is an entry in one contiguous array which points to the head of
+// a singly linked list of element nodes (same layout as the QuadTree leaves).
+// An element is linked into every cell its rect overlaps.
+class UniformGrid
+{
+public:
+    // Origin is center, x+ is right, y+ is up
+    Rect _Bounds;
+    QuadElementIntList _Elements;
+    QuadElementNodeIntList _ElementNodes;
+    GridCellsIntList _Cells;
+
+private:
+    int _cellW;
+    int _cellH;
+    int _numCols;
+    int _numRows;
+
+public:
+    UniformGrid(Rect bounds, int cellW, int cellH);
+    ~UniformGrid();
+
+    int Insert(int id, Rect &rect);
+    void Remove(int elementIndex);
+
+    // Updates the bounds of an element. Returns the (possibly new) element
+    // index. Only relinks the element if it moved into a different set of cells.
+    int Move(int elementIndex, Rect &rect);
+
+    // Returns list of elements which intersect the query rectangle
+    void Query(Rect query,
+               unordered_map<int, bool> &seenElements,
+               vector<int> *output);
+
+    // Appends every pair of intersecting elements as (idA, idB).
+    // Each pair is reported exactly once without needing a 'seen' set.
+    void FindPairs(vector<pair<int, int>> &output);
+
+    // Nothing to collapse in a flat grid, kept for parity with QuadTree.
+    void Clean();
+
+    void Draw(SDL_Renderer *renderer,
+              Mat3 &transform,
+              chrono::milliseconds deltaMs,
+              bool renderRects);
+
+    int NumCols() { return _numCols; }
+    int NumRows() { return _numRows; }
+
+protected:
+    bool Intersects(int aLeft, int aTop, int aRight, int aBottom,
+                    int bLeft, int bTop, int bRight, int bBottom);
+
+    int CellX(int x);
+    int CellY(int y);
+
+    void LinkElement(int elementIndex, int x0, int y0, int x1, int y1);
+    void UnlinkElement(int elementIndex, int x0, int y0, int x1, int y1);
+};
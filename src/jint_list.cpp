@@ -3,6 +3,7 @@
 #include <assert.h>
 
 #include "jint_list.h"
+#include "jint_list_alloc.h"
 
 JIntList::JIntList(int num_fields)
 {
@@ -11,21 +12,114 @@ JIntList::JIntList(int num_fields)
     this->cap = il_fixed_cap;
     this->num_fields = num_fields;
     this->free_element = -1;
+    this->allocator = nullptr;
 }
 
 JIntList::~JIntList()
+{
+    free_buffer();
+}
+
+void JIntList::free_buffer()
 {
     // Free the buffer only if it was heap allocated.
-    if (this->data != this->fixed)
+    if (this->data == this->fixed)
+        return;
+    if (this->allocator != nullptr)
+        this->allocator->Free(this->data, this->cap * sizeof(*this->data));
+    else
         free(this->data);
 }
 
+void JIntList::set_allocator(JIntListAllocator *allocator)
+{
+    if (allocator == this->allocator)
+        return;
+    if (this->data == this->fixed)
+    {
+        this->allocator = allocator;
+        return;
+    }
+
+    // Copy the heap buffer across, then let the old allocator have it back.
+    const size_t bytes = this->cap * sizeof(*this->data);
+    int *new_data = allocator != nullptr
+                        ? (int *)allocator->Grow(nullptr, 0, bytes)
+                        : (int *)malloc(bytes);
+    memcpy(new_data, this->data, bytes);
+    free_buffer();
+    this->data = new_data;
+    this->allocator = allocator;
+}
+
+void JIntList::grow(int new_cap)
+{
+    const size_t old_bytes = this->cap * sizeof(*this->data);
+    const size_t new_bytes = new_cap * sizeof(*this->data);
+    const bool fixed = this->data == this->fixed;
+    if (this->allocator != nullptr)
+    {
+        // The first spill copies the fixed buffer over itself.
+        this->data = (int *)this->allocator->Grow(fixed ? nullptr : this->data,
+                                                  fixed ? 0 : old_bytes,
+                                                  new_bytes);
+        if (fixed)
+            memcpy(this->data, this->fixed, sizeof(this->fixed));
+    }
+    else if (fixed)
+    {
+        this->data = (int *)malloc(new_bytes);
+        memcpy(this->data, this->fixed, sizeof(this->fixed));
+    }
+    else
+    {
+        this->data = (int *)realloc(this->data, new_bytes);
+    }
+    this->cap = new_cap;
+}
+
 void JIntList::clear()
 {
     this->num = 0;
     this->free_element = -1;
 }
 
+void JIntList::swap(JIntList &other)
+{
+    const bool thisFixed = this->data == this->fixed;
+    const bool otherFixed = other.data == other.fixed;
+    int *thisData = this->data;
+    int *otherData = other.data;
+
+    int temp[il_fixed_cap];
+    memcpy(temp, this->fixed, sizeof(this->fixed));
+    memcpy(this->fixed, other.fixed, sizeof(this->fixed));
+    memcpy(other.fixed, temp, sizeof(this->fixed));
+
+    this->data = otherFixed ? this->fixed : otherData;
+    other.data = thisFixed ? other.fixed : thisData;
+
+    int tempInt = this->num_fields;
+    this->num_fields = other.num_fields;
+    other.num_fields = tempInt;
+
+    tempInt = this->num;
+    this->num = other.num;
+    other.num = tempInt;
+
+    tempInt = this->cap;
+    this->cap = other.cap;
+    other.cap = tempInt;
+
+    tempInt = this->free_element;
+    this->free_element = other.free_element;
+    other.free_element = tempInt;
+
+    JIntListAllocator *tempAllocator = this->allocator;
+    this->allocator = other.allocator;
+    other.allocator = tempAllocator;
+}
+
 int JIntList::size()
 {
     return this->num;
@@ -43,6 +137,22 @@ void JIntList::set(int n, int field, int val)
     this->data[n*this->num_fields + field] = val;
 }
 
+void JIntList::resize(int n)
+{
+    reserve(n);
+    this->num = n;
+}
+
+void JIntList::reserve(int n)
+{
+    const int new_cap = n * this->num_fields;
+    if (new_cap <= this->cap)
+    {
+        return;
+    }
+    grow(new_cap);
+}
+
 int JIntList::push_back()
 {
     const int new_pos = (this->num+1) * this->num_fields;
@@ -51,23 +161,9 @@ int JIntList::push_back()
     // for the new element.
     if (new_pos > this->cap)
     {
-        // Use double the size for the new capacity.
-        const int new_cap = new_pos * 2;
-
-        // If we're pointing to the fixed buffer, allocate a new array on the
-        // heap and copy the fixed buffer contents to it.
-        if (this->cap == il_fixed_cap)
-        {
-            this->data = (int*) malloc(new_cap * sizeof(*this->data));
-            memcpy(this->data, this->fixed, sizeof(this->fixed));
-        }
-        else
-        {
-            // Otherwise reallocate the heap buffer to the new size.
-            this->data = (int*) realloc(this->data, new_cap * sizeof(*this->data));
-        }
-        // Set the old capacity to the new capacity.
-        this->cap = new_cap;
+        // Use double the size for the new capacity. If we're pointing to
+        // the fixed buffer the contents get copied to the heap.
+        grow(new_pos * 2);
     }
     return this->num++;
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "jmath.h"
+#include "jrecord_list.h"
+
+class JIntListAllocator;
 
 // typedef struct IntList IntList;
 enum {il_fixed_cap = 128};
@@ -27,6 +30,10 @@ public:
     // is empty.
     int free_element;
 
+    // Where the buffer comes from once it outgrows 'fixed', null for
+    // malloc/realloc. Not owned.
+    JIntListAllocator *allocator;
+
     // ---------------------------------------------------------------------------------
     // List Interface
     // ---------------------------------------------------------------------------------
@@ -51,6 +58,15 @@ public:
     // Clears the specified list, making it empty.
     void clear();
 
+    // Exchanges the contents of two lists. Lists still using their 'fixed'
+    // buffer can't trade pointers, so that buffer is copied across.
+    // Allocators go along with their buffers.
+    void swap(JIntList &other);
+
+    // Switches to another allocator (null for malloc/realloc), moving a
+    // heap buffer over to it. The allocator must outlive the list.
+    void set_allocator(JIntListAllocator *allocator);
+
 
     // ---------------------------------------------------------------------------------
     // Stack Interface (do not mix with free list usage; use one or the other)
@@ -61,6 +77,14 @@ public:
     // Removes the element at the back of the list.
     void pop_back();
 
+    // Grows or shrinks the list to 'n' elements. New elements are left
+    // uninitialized.
+    void resize(int n);
+
+    // Makes room for 'n' elements so the buffer doesn't move until the list
+    // grows past that.
+    void reserve(int n);
+
     // ---------------------------------------------------------------------------------
     // Free List Interface (do not mix with stack usage; use one or the other)
     // ---------------------------------------------------------------------------------
@@ -69,11 +93,24 @@ public:
 
     // Removes the nth element in the list.
     void erase(int n);
+
+private:
+    // Moves the contents to a buffer of 'new_cap' ints.
+    void grow(int new_cap);
+    void free_buffer();
 };
 
 
 
-class QuadNodesIntList : public JIntList
+// Coordinate type of the element bounds. int16_t halves the element list
+// when every box (fat margins included) stays within +-32767, anything
+// outside wraps.
+using QuadCoord = int32_t;
+
+// Layout of the element list. SoA gives each bound an array of its own.
+constexpr RecordLayout QuadElementLayout = RecordLayout::AoS;
+
+class QuadNodesIntList : public RecordList<RecordLayout::AoS, int32_t, int32_t>
 {
 public:
     enum
@@ -81,56 +118,55 @@ public:
         children = 0,
         count = 1
     };
-    QuadNodesIntList() : JIntList(2) {}
 
     int AddLeaf()
     {
         int id = insert();
-        data[id * num_fields + children] = -1;
-        data[id * num_fields + count] = 0;
+        set<children>(id, -1);
+        set<count>(id, 0);
         return id;
     }
 
     void MakeBranch(int id, int childrenId)
     {
-        data[id * num_fields + children] = childrenId;
-        data[id * num_fields + count] = -1;
+        set<children>(id, childrenId);
+        set<count>(id, -1);
     }
 
-    bool IsLeaf(int id)
+    bool IsLeaf(int id) const
     {
-        return data[id * num_fields + count] >= 0;
+        return get<count>(id) >= 0;
     }
 
-    bool IsBranch(int id)
+    bool IsBranch(int id) const
     {
-        return data[id * num_fields + count] == -1;
+        return get<count>(id) == -1;
     }
 
-    bool IsEmpty(int id)
+    bool IsEmpty(int id) const
     {
-        return data[id * num_fields + count] == 0;
+        return get<count>(id) == 0;
     }
 
-    int GetChildren(int id)
+    int GetChildren(int id) const
     {
-        return data[id * num_fields + children];
+        return get<children>(id);
     }
-    int GetCount(int id)
+    int GetCount(int id) const
     {
-        return data[id * num_fields + count];
+        return get<count>(id);
     }
     void SetChildren(int id, int v)
     {
-        data[id * num_fields + children] = v;
+        set<children>(id, v);
     }
     void SetCount(int id, int v)
     {
-        data[id * num_fields + count] = v;
+        set<count>(id, v);
     }
 };
 
-class QuadElementIntList : public JIntList
+class QuadElementIntList : public RecordList<QuadElementLayout, int32_t, QuadCoord, QuadCoord, QuadCoord, QuadCoord>
 {
 public:
     enum
@@ -141,72 +177,72 @@ public:
         right = 3,
         bottom = 4
     };
-    QuadElementIntList() : JIntList(5) {}
 
     int Add(int tId, int l, int t, int r, int b)
     {
         int id = insert();
-        data[id * num_fields + ID] = tId;
-        data[id * num_fields + left] = l;
-        data[id * num_fields + top] = t;
-        data[id * num_fields + right] = r;
-        data[id * num_fields + bottom] = b;
+        set<ID>(id, tId);
+        set<left>(id, (QuadCoord)l);
+        set<top>(id, (QuadCoord)t);
+        set<right>(id, (QuadCoord)r);
+        set<bottom>(id, (QuadCoord)b);
         return id;
     }
 
-    int GetId(int id)
+    int GetId(int id) const
     {
-        return data[id * num_fields + ID];
+        return get<ID>(id);
     }
     void SetId(int id, int val)
     {
-        data[id * num_fields + ID] = val;
+        set<ID>(id, val);
     }
 
-    Rect GetRect(int id)
+    Rect GetRect(int id) const
     {
-        const int l = data[id * num_fields + left];
-        const int t = data[id * num_fields + top];
-        const int r = data[id * num_fields + right];
-        const int b = data[id * num_fields + bottom];
-        return Rect(l, t, abs(r - l), abs(t - b));
+        const int l = get<left>(id);
+        const int t = get<top>(id);
+        const int r = get<right>(id);
+        const int b = get<bottom>(id);
+        // Rect is center based.
+        return Rect((l + r) / 2, (t + b) / 2, abs(r - l), abs(t - b));
     }
 
-    int GetLeft(int id)
+    int GetLeft(int id) const
     {
-        return data[id * num_fields + left];
+        return get<left>(id);
     }
-    int GetTop(int id)
+    int GetTop(int id) const
     {
-        return data[id * num_fields + top];
+        return get<top>(id);
     }
-    int GetRight(int id)
+    int GetRight(int id) const
     {
-        return data[id * num_fields + right];
+        return get<right>(id);
     }
-    int GetBottom(int id)
+    int GetBottom(int id) const
     {
-        return data[id * num_fields + bottom];
+        return get<bottom>(id);
     }
     void SetLeft(int id, int val)
     {
-        data[id * num_fields + left] = val;
+        set<left>(id, (QuadCoord)val);
     }
     void SetTop(int id, int val)
     {
-        data[id * num_fields + top] = val;
+        set<top>(id, (QuadCoord)val);
     }
     void SetRight(int id, int val)
     {
-        data[id * num_fields + right] = val;
+        set<right>(id, (QuadCoord)val);
     }
     void SetBottom(int id, int val)
     {
-        data[id * num_fields + bottom] = val;
+        set<bottom>(id, (QuadCoord)val);
     }
 };
 
-class QuadElementNodeIntList : public JIntList
+class QuadElementNodeIntList : public RecordList<RecordLayout::AoS, int32_t, int32_t>
 {
 public:
     enum
@@ -214,32 +250,68 @@ public:
         next = 0,
         elementId = 1
     };
-    QuadElementNodeIntList() : JIntList(2) {}
 
     int Add(int elementIndex)
     {
         int id = insert();
-        data[id * num_fields + next] = -1;
-        data[id * num_fields + elementId] = elementIndex;
+        set<next>(id, -1);
+        set<elementId>(id, elementIndex);
         return id;
     }
 
-    int GetNext(int id)
+    int GetNext(int id) const
     {
-        return data[id * num_fields + next];
+        return get<next>(id);
     }
     void SetNext(int id, int val)
     {
-        data[id * num_fields + next] = val;
+        set<next>(id, val);
     }
 
-    int GetElementId(int id)
+    int GetElementId(int id) const
     {
-        return data[id * num_fields + elementId];
+        return get<elementId>(id);
     }
     void SetElementId(int id, int val)
     {
-        data[id * num_fields + elementId] = val;
+        set<elementId>(id, val);
+    }
+};
+
+class GridCellsIntList : public JIntList
+{
+public:
+    enum
+    {
+        head = 0,
+        count = 1
+    };
+    GridCellsIntList() : JIntList(2) {}
+
+    int Add()
+    {
+        const int back_idx = push_back();
+        data[back_idx * num_fields + head] = -1;
+        data[back_idx * num_fields + count] = 0;
+        return back_idx;
+    }
+
+    int GetHead(int id)
+    {
+        return data[id * num_fields + head];
+    }
+    void SetHead(int id, int val)
+    {
+        data[id * num_fields + head] = val;
+    }
+
+    int GetCount(int id)
+    {
+        return data[id * num_fields + count];
+    }
+    void SetCount(int id, int val)
+    {
+        data[id * num_fields + count] = val;
     }
 };
 
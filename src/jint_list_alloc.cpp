@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+
+#include "jint_list_alloc.h"
+#include "jarena.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t bytes, size_t multiple)
+{
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+static size_t pageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// ---------------------------------------------------------------------------------
+// Mapping helpers
+// ---------------------------------------------------------------------------------
+// Address space only, nothing is backed until committed.
+static void *reserveAddressSpace(size_t bytes)
+{
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *data = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return data == MAP_FAILED ? nullptr : data;
+#endif
+}
+
+static bool commit(void *data, size_t bytes)
+{
+#ifdef _WIN32
+    return VirtualAlloc(data, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+    return mprotect(data, bytes, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void releaseAddressSpace(void *data, size_t bytes)
+{
+#ifdef _WIN32
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, bytes);
+#endif
+}
+
+static void *mapHugePages(size_t bytes)
+{
+#ifdef _WIN32
+    // Needs SeLockMemoryPrivilege, without it fall back to normal pages.
+    const size_t largePage = GetLargePageMinimum();
+    if (largePage != 0)
+    {
+        void *data = VirtualAlloc(nullptr, roundUp(bytes, largePage),
+                                  MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (data != nullptr)
+        {
+            return data;
+        }
+    }
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+    return data;
+#endif
+}
+
+// ---------------------------------------------------------------------------------
+// AlignedIntListAllocator
+// ---------------------------------------------------------------------------------
+void *AlignedIntListAllocator::Grow(void *old, size_t oldBytes, size_t bytes)
+{
+    void *data = ::operator new(bytes, align_val_t(_Alignment));
+    if (old != nullptr)
+    {
+        memcpy(data, old, oldBytes);
+        ::operator delete(old, align_val_t(_Alignment));
+    }
+    return data;
+}
+
+void AlignedIntListAllocator::Free(void *data, size_t)
+{
+    ::operator delete(data, align_val_t(_Alignment));
+}
+
+// ---------------------------------------------------------------------------------
+// ArenaIntListAllocator
+// ---------------------------------------------------------------------------------
+void *ArenaIntListAllocator::Grow(void *old, size_t oldBytes, size_t bytes)
+{
+    void *data = _Arena.Allocate(bytes, alignof(int));
+    if (old != nullptr)
+    {
+        memcpy(data, old, oldBytes);
+    }
+    return data;
+}
+
+// ---------------------------------------------------------------------------------
+// HugePageIntListAllocator
+// ---------------------------------------------------------------------------------
+void *HugePageIntListAllocator::Grow(void *old, size_t oldBytes, size_t bytes)
+{
+    if (bytes < _Threshold)
+    {
+        void *data = realloc(old, bytes);
+        if (data == nullptr)
+        {
+            throw bad_alloc();
+        }
+        return data;
+    }
+
+    const size_t mapped = roundUp(bytes, HUGE_PAGE_SIZE);
+    if (old != nullptr && oldBytes >= _Threshold)
+    {
+        const size_t oldMapped = roundUp(oldBytes, HUGE_PAGE_SIZE);
+        if (mapped == oldMapped)
+        {
+            return old;
+        }
+#if defined(__linux__)
+        // Moves the page tables, not the data.
+        void *data = mremap(old, oldMapped, mapped, MREMAP_MAYMOVE);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, mapped, MADV_HUGEPAGE);
+            return data;
+        }
+#endif
+    }
+
+    // On failure 'old' is left as it was.
+    void *data = mapHugePages(mapped);
+    if (data == nullptr)
+    {
+        throw bad_alloc();
+    }
+    if (old != nullptr)
+    {
+        memcpy(data, old, oldBytes);
+        Free(old, oldBytes);
+    }
+    return data;
+}
+
+void HugePageIntListAllocator::Free(void *data, size_t bytes)
+{
+    if (bytes < _Threshold)
+    {
+        free(data);
+        return;
+    }
+    releaseAddressSpace(data, roundUp(bytes, HUGE_PAGE_SIZE));
+}
+
+// ---------------------------------------------------------------------------------
+// ReservedIntListAllocator
+// ---------------------------------------------------------------------------------
+size_t ReservedIntListAllocator::ReservationFor(size_t bytes) const
+{
+    size_t reservation = _ReserveBytes;
+    while (reservation < bytes)
+    {
+        reservation *= 2;
+    }
+    return reservation;
+}
+
+void *ReservedIntListAllocator::Grow(void *old, size_t oldBytes, size_t bytes)
+{
+    const size_t committed = roundUp(bytes, pageSize());
+    const size_t reservation = ReservationFor(bytes);
+    if (old != nullptr && ReservationFor(oldBytes) == reservation)
+    {
+        // Already committed pages stay as they are.
+        if (!commit(old, committed))
+        {
+            throw bad_alloc();
+        }
+        return old;
+    }
+
+    void *data = reserveAddressSpace(reservation);
+    if (data == nullptr)
+    {
+        throw bad_alloc();
+    }
+    if (!commit(data, committed))
+    {
+        releaseAddressSpace(data, reservation);
+        throw bad_alloc();
+    }
+    if (old != nullptr)
+    {
+        memcpy(data, old, oldBytes);
+        Free(old, oldBytes);
+    }
+    return data;
+}
+
+void ReservedIntListAllocator::Free(void *data, size_t bytes)
+{
+    releaseAddressSpace(data, ReservationFor(bytes));
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+
+class FrameArena;
+
+// Where a JIntList's buffer comes from once it outgrows 'fixed'.
+class JIntListAllocator
+{
+public:
+    virtual ~JIntListAllocator() = default;
+
+    // Like realloc: returns a buffer of at least 'bytes' holding the first
+    // 'oldBytes' of 'old' (null the first time). Returning 'old' means it
+    // grew in place. Throws std::bad_alloc when out of memory, 'old' is then
+    // left as it was.
+    virtual void *Grow(void *old, size_t oldBytes, size_t bytes) = 0;
+    // 'bytes' is what the last Grow of this buffer asked for.
+    virtual void Free(void *data, size_t bytes) = 0;
+};
+
+// Buffers on 'alignment' byte boundaries, e.g. cache lines or SIMD widths.
+// Growing always copies.
+class AlignedIntListAllocator : public JIntListAllocator
+{
+public:
+    explicit AlignedIntListAllocator(size_t alignment) : _Alignment(alignment) {}
+    void *Grow(void *old, size_t oldBytes, size_t bytes) override;
+    void Free(void *data, size_t bytes) override;
+
+private:
+    size_t _Alignment;
+};
+
+// Buffers from a FrameArena, for lists which die by the end of a frame.
+// Free is a no-op, the memory comes back when the arena is reset.
+class ArenaIntListAllocator : public JIntListAllocator
+{
+public:
+    explicit ArenaIntListAllocator(FrameArena &arena) : _Arena(arena) {}
+    void *Grow(void *old, size_t oldBytes, size_t bytes) override;
+    void Free(void *, size_t) override {}
+
+private:
+    FrameArena &_Arena;
+};
+
+// Small buffers come from malloc. From 'threshold' bytes up they are mapped
+// straight from the OS in whole huge pages and marked for transparent huge
+// pages (madvise on Linux, large pages on Windows when the process may lock
+// memory), cutting TLB misses on big lists. On Linux mremap grows them
+// without copying.
+class HugePageIntListAllocator : public JIntListAllocator
+{
+public:
+    explicit HugePageIntListAllocator(size_t threshold = 2 * 1024 * 1024) : _Threshold(threshold) {}
+    void *Grow(void *old, size_t oldBytes, size_t bytes) override;
+    void Free(void *data, size_t bytes) override;
+
+private:
+    size_t _Threshold;
+};
+
+// Reserves 'reserveBytes' of address space per buffer up front and commits
+// pages as the list grows, so the buffer never moves and growing never
+// copies. A list outgrowing its reservation moves once to a reservation
+// twice the size.
+class ReservedIntListAllocator : public JIntListAllocator
+{
+public:
+    explicit ReservedIntListAllocator(size_t reserveBytes = size_t(1) << 30) : _ReserveBytes(reserveBytes) {}
+    void *Grow(void *old, size_t oldBytes, size_t bytes) override;
+    void Free(void *data, size_t bytes) override;
+
+private:
+    // Every buffer committing 'bytes' sits in a reservation this big.
+    size_t ReservationFor(size_t bytes) const;
+
+    size_t _ReserveBytes;
+};
@@ -1,6 +1,8 @@
 #pragma once
 #include <cmath>
+#ifndef NOIN_HEADLESS
 #include "SDL_rect.h"
+#endif
 
 class Vec2
 {
@@ -265,6 +267,7 @@ public:
             r.B() < T());
     }
 
+#ifndef NOIN_HEADLESS
     SDL_Rect ToSDL(Mat3 &transform)
     {
         Vec2 p = transform * Vec2(L(), T());
@@ -275,4 +278,5 @@ public:
         rect.h = h;
         return rect;
     }
+#endif
 };
\ No newline at end of file
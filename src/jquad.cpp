@@ -1,5 +1,10 @@
-#include <SDL_render.h>
+#include <assert.h>
+#include <limits.h>
+#include <atomic>
+#include <utility>
 #include "jquad.h"
+#include "jquad_concurrent.h"
+#include "jrender.h"
 
 QuadTree::QuadTree(Rect bounds, int maxDepth, int splitThreshold)
     : _maxDepth(maxDepth),
@@ -7,70 +12,140 @@ QuadTree::QuadTree(Rect bounds, int maxDepth, int splitThreshold)
       _splitThreshold(splitThreshold)
 {
     _Nodes.AddLeaf();
+    NewContentsVersion();
 };
 QuadTree::~QuadTree() {}
 
+// Edges of 'rect'. A sprite that went NaN sits at INT_MIN, its edges wrap
+// around in unsigned math instead of overflowing.
+static void rectEdges(const Rect &rect, int &left, int &top, int &right, int &bottom)
+{
+    left = (int)((unsigned)rect.x - (unsigned)(rect.w >> 1));
+    top = (int)((unsigned)rect.y + (unsigned)(rect.h >> 1));
+    right = (int)((unsigned)rect.x + (unsigned)(rect.w >> 1));
+    bottom = (int)((unsigned)rect.y - (unsigned)(rect.h >> 1));
+}
+
+// 'edge' moved 'margin' (not negative) outwards, stopping at the int limits.
+static int growDown(int edge, int margin)
+{
+    return edge < INT_MIN + margin ? INT_MIN : edge - margin;
+}
+
+static int growUp(int edge, int margin)
+{
+    return edge > INT_MAX - margin ? INT_MAX : edge + margin;
+}
+
 int QuadTree::Insert(int id, Rect &rect)
 {
-    const int elementIndex = _Elements.Add(
-        id,
-        rect.x - (rect.w >> 1),
-        rect.y + (rect.h >> 1),
-        rect.x + (rect.w >> 1),
-        rect.y - (rect.h >> 1));
+    return Insert(id, rect, _fatMargin);
+}
+
+int QuadTree::Insert(int id, Rect &rect, int margin)
+{
+    const int elementIndex = _Elements.Add(id, 0, 0, 0, 0);
+    SetElementBounds(elementIndex, rect, margin);
     InsertNode(ROOT_QUAD_NODE_INDEX,
                _Bounds.midX, _Bounds.midY, _Bounds.halfW, _Bounds.halfH,
                0,
                elementIndex);
+    if (_trackLeafChanges)
+    {
+        NoteLeafChange(elementIndex, LEAF_PRESENT);
+    }
 
     return elementIndex;
 }
 
 void QuadTree::Remove(int removeElementIndex)
 {
-    LeavesListIntList output;
-    const int left = _Elements.GetLeft(removeElementIndex);
-    const int right = _Elements.GetRight(removeElementIndex);
-    const int top = _Elements.GetTop(removeElementIndex);
-    const int bottom = _Elements.GetBottom(removeElementIndex);
-
-    FindLeavesList(
+    RemoveFromLeaves(
         ROOT_QUAD_NODE_INDEX,
         _Bounds.midX, _Bounds.midY, _Bounds.halfW, _Bounds.halfH,
         0,
-        left, top, right, bottom,
-        output);
-
-    for (int i = 0; i < output.size(); i++)
+        removeElementIndex);
+    if (_trackLeafChanges)
     {
-        const int nodeIndex = output.GetIndex(i);
+        NoteLeafChange(removeElementIndex, LEAF_REMOVED);
+    }
+    _Elements.erase(removeElementIndex);
+}
 
-        int beforeIndex = -1;
-        int currentElementNodeIndex = _Nodes.GetChildren(nodeIndex);
-        while (currentElementNodeIndex != -1)
-        {
-            int elementIndex = _ElementNodes.GetElementId(currentElementNodeIndex);
-            if (removeElementIndex == elementIndex)
-            {
-                break;
-            }
-            beforeIndex = currentElementNodeIndex;
-            currentElementNodeIndex = _ElementNodes.GetNext(currentElementNodeIndex);
-        }
+int QuadTree::Move(int elementIndex, Rect &rect)
+{
+    return Move(elementIndex, rect, _fatMargin);
+}
 
-        _Nodes.SetCount(nodeIndex, _Nodes.GetCount(nodeIndex) - 1);
-        const int next = _ElementNodes.GetNext(currentElementNodeIndex);
-        if (beforeIndex == -1)
+int QuadTree::Move(int elementIndex, Rect &rect, int margin)
+{
+    if (FitsElementBounds(elementIndex, rect))
+    {
+        if (_keepExact)
         {
-            _Nodes.SetChildren(nodeIndex, next);
+            SetExactBounds(elementIndex, rect);
         }
-        else
+        return elementIndex;
+    }
+    const int id = _Elements.GetId(elementIndex);
+    Remove(elementIndex);
+    return Insert(id, rect, margin);
+}
+
+void QuadTree::SetFatMargin(int margin, bool refine)
+{
+    _fatMargin = max(margin, 0);
+    _keepExact = refine;
+    if (_keepExact)
+    {
+        // Elements from before are exactly their stored bounds.
+        _exactBounds.resize(_Elements.size() * 4);
+        for (int i = 0; i < (int)_exactBounds.size() / 4; i++)
         {
-            _ElementNodes.SetNext(beforeIndex, next);
+            _exactBounds[i * 4 + 0] = _Elements.GetLeft(i);
+            _exactBounds[i * 4 + 1] = _Elements.GetTop(i);
+            _exactBounds[i * 4 + 2] = _Elements.GetRight(i);
+            _exactBounds[i * 4 + 3] = _Elements.GetBottom(i);
         }
-        _ElementNodes.erase(currentElementNodeIndex);
     }
-    _Elements.erase(removeElementIndex);
+}
+
+void QuadTree::SetElementBounds(int elementIndex, const Rect &rect, int margin)
+{
+    if (_keepExact)
+    {
+        SetExactBounds(elementIndex, rect);
+    }
+    margin = max(margin, 0);
+    int left, top, right, bottom;
+    rectEdges(rect, left, top, right, bottom);
+    _Elements.SetLeft(elementIndex, growDown(left, margin));
+    _Elements.SetTop(elementIndex, growUp(top, margin));
+    _Elements.SetRight(elementIndex, growUp(right, margin));
+    _Elements.SetBottom(elementIndex, growDown(bottom, margin));
+}
+
+void QuadTree::SetExactBounds(int elementIndex, const Rect &rect)
+{
+    if ((int)_exactBounds.size() <= elementIndex * 4)
+    {
+        _exactBounds.resize(max((elementIndex + 1) * 4, (int)_exactBounds.size() * 2));
+    }
+    int *bounds = &_exactBounds[elementIndex * 4];
+    rectEdges(rect, bounds[0], bounds[1], bounds[2], bounds[3]);
+}
+
+bool QuadTree::FitsElementBounds(int elementIndex, const Rect &rect)
+{
+    int left, top, right, bottom;
+    rectEdges(rect, left, top, right, bottom);
+    // Bounds which wrapped around (e.g. a sprite at INT_MIN) never fit and
+    // go through a plain remove and insert like before.
+    return left <= right && bottom <= top &&
+           left >= _Elements.GetLeft(elementIndex) &&
+           top <= _Elements.GetTop(elementIndex) &&
+           right <= _Elements.GetRight(elementIndex) &&
+           bottom >= _Elements.GetBottom(elementIndex);
 }
 
 void QuadTree::Query(Rect query,
@@ -104,10 +179,8 @@ void QuadTree::Query(Rect query,
                 continue;
             }
 
-            const int l = _Elements.GetLeft(elementIndex);
-            const int t = _Elements.GetTop(elementIndex);
-            const int r = _Elements.GetRight(elementIndex);
-            const int b = _Elements.GetBottom(elementIndex);
+            int l, t, r, b;
+            GetTestBounds(elementIndex, l, t, r, b);
             if (Intersects(left, top, right, bottom,
                            l, t, r, b))
             {
@@ -123,7 +196,8 @@ void QuadTree::Traverse(
     QueryCallback branchCallback,
     QueryCallback leafCallback)
 {
-    vector<tuple<int, Rect, int>> stack;
+    ArenaScope scope(*_arena);
+    ArenaVector<tuple<int, Rect, int>> stack(*_arena);
     stack.emplace_back(ROOT_QUAD_NODE_INDEX, _Bounds.ToRect(), 0);
     while (stack.size() > 0)
     {
@@ -159,7 +233,8 @@ void QuadTree::Clean()
         return;
     }
 
-    vector<int> to_process;
+    ArenaScope scope(*_arena);
+    ArenaVector<int> to_process(*_arena);
     // TODO: Remove magic number
     to_process.reserve(64);
     to_process.push_back(ROOT_QUAD_NODE_INDEX);
@@ -192,12 +267,178 @@ void QuadTree::Clean()
             _Nodes.erase(child + 2);
             _Nodes.erase(child + 1);
             _Nodes.erase(child + 0);
-            _Nodes.erase(currentIndex);
-            _Nodes.AddLeaf();
+            _Nodes.SetChildren(currentIndex, -1);
+            _Nodes.SetCount(currentIndex, 0);
+        }
+    }
+}
+
+void QuadTree::SetListAllocator(JIntListAllocator *allocator)
+{
+    _Elements.set_allocator(allocator);
+    _ElementNodes.set_allocator(allocator);
+    _Nodes.set_allocator(allocator);
+}
+
+void QuadTree::SetFreeListPolicy(FreeListPolicy policy)
+{
+    _Elements.set_free_policy(policy);
+    _ElementNodes.set_free_policy(policy);
+    _Nodes.set_free_policy(policy);
+}
+
+void QuadTree::TrackLeafChanges(bool enabled)
+{
+    // Whatever happened while off wasn't noted.
+    if (enabled && !_trackLeafChanges)
+    {
+        NewContentsVersion();
+    }
+    if (!enabled)
+    {
+        ForgetLeafChanges();
+    }
+    _trackLeafChanges = enabled;
+}
+
+void QuadTree::NoteLeafChange(int elementIndex, LeafChangeState state)
+{
+    if ((int)_leafChangeStates.size() <= elementIndex)
+    {
+        _leafChangeStates.resize(max(elementIndex + 1, (int)_leafChangeStates.size() * 2), LEAF_UNCHANGED);
+    }
+    if (_leafChangeStates[elementIndex] == LEAF_UNCHANGED)
+    {
+        _leafChanges.push_back(elementIndex);
+    }
+    _leafChangeStates[elementIndex] = state;
+}
+
+void QuadTree::ForgetLeafChanges()
+{
+    for (int elementIndex : _leafChanges)
+    {
+        _leafChangeStates[elementIndex] = LEAF_UNCHANGED;
+    }
+    _leafChanges.clear();
+}
+
+void QuadTree::NewContentsVersion()
+{
+    // Shared by every tree, a Swap must not bring back a version a reader
+    // has seen on this one.
+    static atomic<uint64_t> nextVersion{1};
+    _contentsVersion = nextVersion++;
+    ForgetLeafChanges();
+}
+
+void QuadTree::Reserve(int elements, int nodes, int elementNodes)
+{
+    _Elements.reserve(elements);
+    _Nodes.reserve(nodes);
+    _ElementNodes.reserve(elementNodes);
+    if (_keepExact)
+    {
+        _exactBounds.reserve((size_t)elements * 4);
+    }
+}
+
+void QuadTree::ShrinkToFit()
+{
+    // Element indices are handed out, so that list can only lose the free
+    // slots at its end. Node and element node indices never leave the tree,
+    // those lists are rebuilt packed in depth first order instead.
+    _Elements.shrink_to_fit();
+
+    QuadNodesIntList nodes;
+    QuadElementNodeIntList elementNodes;
+    nodes.set_allocator(_Nodes.allocator);
+    nodes.set_free_policy(_Nodes.free_policy());
+    nodes.reserve(_Nodes.size() - _Nodes.num_free);
+    elementNodes.set_allocator(_ElementNodes.allocator);
+    elementNodes.set_free_policy(_ElementNodes.free_policy());
+    elementNodes.reserve(_ElementNodes.size() - _ElementNodes.num_free);
+    {
+        ArenaScope scope(*_arena);
+        // (old index, new index)
+        ArenaVector<pair<int, int>> stack(*_arena);
+        stack.reserve(64);
+        stack.emplace_back(ROOT_QUAD_NODE_INDEX, nodes.push_back());
+        while (stack.size() > 0)
+        {
+            auto [oldIndex, newIndex] = stack.back();
+            stack.pop_back();
+            if (_Nodes.IsBranch(oldIndex))
+            {
+                const int oldChild = _Nodes.GetChildren(oldIndex);
+                const int newChild = nodes.push_back();
+                nodes.push_back();
+                nodes.push_back();
+                nodes.push_back();
+                nodes.MakeBranch(newIndex, newChild);
+                for (int i = 3; i >= 0; i--)
+                {
+                    stack.emplace_back(oldChild + i, newChild + i);
+                }
+                continue;
+            }
+
+            int oldElementNode = _Nodes.GetChildren(oldIndex);
+            nodes.SetChildren(newIndex, oldElementNode != -1 ? elementNodes.size() : -1);
+            nodes.SetCount(newIndex, _Nodes.GetCount(oldIndex));
+            while (oldElementNode != -1)
+            {
+                const int newElementNode = elementNodes.push_back();
+                elementNodes.SetElementId(newElementNode, _ElementNodes.GetElementId(oldElementNode));
+                oldElementNode = _ElementNodes.GetNext(oldElementNode);
+                elementNodes.SetNext(newElementNode, oldElementNode != -1 ? newElementNode + 1 : -1);
+            }
         }
     }
+    _Nodes.swap(nodes);
+    _ElementNodes.swap(elementNodes);
+    if ((int)_exactBounds.size() > _Elements.size() * 4)
+    {
+        _exactBounds.resize(_Elements.size() * 4);
+    }
+    _exactBounds.shrink_to_fit();
+
+    vector<PairLeaf>().swap(_pairLeaves);
+    vector<vector<int>>().swap(_pairBoxes);
+    vector<vector<pair<int, int>>>().swap(_pairBuffers);
+    _buildTrees.clear();
+    _buildTrees.shrink_to_fit();
+    // A shared arena (see SetArena) belongs to whoever set it.
+    _ownArena.Release();
 }
 
+void QuadTree::Clear()
+{
+    _Elements.clear();
+    _ElementNodes.clear();
+    _Nodes.clear();
+    _Nodes.AddLeaf();
+    NewContentsVersion();
+}
+
+void QuadTree::Swap(QuadTree &other)
+{
+    _Elements.swap(other._Elements);
+    _ElementNodes.swap(other._ElementNodes);
+    _Nodes.swap(other._Nodes);
+    std::swap(_Bounds, other._Bounds);
+    std::swap(_splitThreshold, other._splitThreshold);
+    std::swap(_maxDepth, other._maxDepth);
+    std::swap(_fatMargin, other._fatMargin);
+    std::swap(_keepExact, other._keepExact);
+    _exactBounds.swap(other._exactBounds);
+    // The changes go with the contents, whether they are noted stays.
+    _leafChanges.swap(other._leafChanges);
+    _leafChangeStates.swap(other._leafChangeStates);
+    std::swap(_contentsVersion, other._contentsVersion);
+}
+
+#ifndef NOIN_HEADLESS
 void QuadTree::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs, bool render_rects)
 {
     vector<tuple<int, QuadRect, int>> nodes;
@@ -252,6 +493,7 @@ void QuadTree::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::millisecond
         }
     }
 }
+#endif
 
 // ----------------------------------
 // PRIVATE
@@ -328,7 +570,58 @@ void QuadTree::FindLeavesList(
     }
 }
 
-void QuadTree::InsertNode(int quadNodeIndex, int mid_x, int mid_y, int half_w, int half_h, int depth, int elementIndex)
+void QuadTree::RemoveFromLeaves(
+    int quadNodeIndex,
+    int mid_x, int mid_y, int half_w, int half_h,
+    int depth,
+    int removeElementIndex,
+    QuadTreeWriter *writer)
+{
+    LeavesListIntList output;
+    const int left = _Elements.GetLeft(removeElementIndex);
+    const int right = _Elements.GetRight(removeElementIndex);
+    const int top = _Elements.GetTop(removeElementIndex);
+    const int bottom = _Elements.GetBottom(removeElementIndex);
+
+    FindLeavesList(
+        quadNodeIndex,
+        mid_x, mid_y, half_w, half_h,
+        depth,
+        left, top, right, bottom,
+        output);
+
+    for (int i = 0; i < output.size(); i++)
+    {
+        const int nodeIndex = output.GetIndex(i);
+
+        int beforeIndex = -1;
+        int currentElementNodeIndex = _Nodes.GetChildren(nodeIndex);
+        while (currentElementNodeIndex != -1)
+        {
+            int elementIndex = _ElementNodes.GetElementId(currentElementNodeIndex);
+            if (removeElementIndex == elementIndex)
+            {
+                break;
+            }
+            beforeIndex = currentElementNodeIndex;
+            currentElementNodeIndex = _ElementNodes.GetNext(currentElementNodeIndex);
+        }
+
+        _Nodes.SetCount(nodeIndex, _Nodes.GetCount(nodeIndex) - 1);
+        const int next = _ElementNodes.GetNext(currentElementNodeIndex);
+        if (beforeIndex == -1)
+        {
+            _Nodes.SetChildren(nodeIndex, next);
+        }
+        else
+        {
+            _ElementNodes.SetNext(beforeIndex, next);
+        }
+        FreeElementNode(currentElementNodeIndex, writer);
+    }
+}
+
+void QuadTree::InsertNode(int quadNodeIndex, int mid_x, int mid_y, int half_w, int half_h, int depth, int elementIndex, QuadTreeWriter *writer)
 {
     LeavesListIntList output;
     const int left = _Elements.GetLeft(elementIndex);
@@ -354,48 +647,112 @@ void QuadTree::InsertNode(int quadNodeIndex, int mid_x, int mid_y, int half_w, i
             nd_index,
             nd_mx, nd_my, nd_sx, nd_sy,
             nd_depth,
-            elementIndex);
+            elementIndex,
+            writer);
     }
 }
 
-void QuadTree::InsertLeafNode(int quadNodeIndex, int mid_x, int mid_y, int half_w, int half_h, int depth, int elementIndex)
+void QuadTree::InsertLeafNode(int quadNodeIndex, int mid_x, int mid_y, int half_w, int half_h, int depth, int elementIndex, QuadTreeWriter *writer)
 {
     // Update the QuadNodes children to the new elementNode
     // Increment the counters
     const int nodeChild = _Nodes.GetChildren(quadNodeIndex);
     const int currentCount = _Nodes.GetCount(quadNodeIndex);
-    const int elementNodeIndex = _ElementNodes.Add(elementIndex);
+    const int elementNodeIndex = AddElementNode(elementIndex, writer);
     _ElementNodes.SetNext(elementNodeIndex, nodeChild);
     _Nodes.SetChildren(quadNodeIndex, elementNodeIndex);
     _Nodes.SetCount(quadNodeIndex, currentCount + 1);
 
     if ((currentCount + 1) >= _splitThreshold && depth < this->_maxDepth)
     {
-        // Save the list of elementNodes
-        vector<int> tempElementIndices;
-        tempElementIndices.reserve(8);
+        SplitLeaf(quadNodeIndex, mid_x, mid_y, half_w, half_h, depth, writer);
+    }
+}
 
-        int tempIndex = elementNodeIndex;
-        while (tempIndex != -1)
+void QuadTree::SplitLeaf(int quadNodeIndex, int mid_x, int mid_y, int half_w, int half_h, int depth, QuadTreeWriter *writer)
+{
+    // Save the list of elementNodes. Splits nest (the reinserts below can
+    // split again), each one takes the arena from where the last left it.
+    FrameArena &arena = ArenaFor(writer);
+    ArenaScope scope(arena);
+    ArenaVector<int> tempElementIndices(arena);
+    tempElementIndices.reserve(_splitThreshold);
+
+    int tempIndex = _Nodes.GetChildren(quadNodeIndex);
+    while (tempIndex != -1)
+    {
+        int next = _ElementNodes.GetNext(tempIndex);
+        int saveElementId = _ElementNodes.GetElementId(tempIndex);
+        tempElementIndices.push_back(saveElementId);
+        // Writers can't share the list, ConcurrentQuadTree starts a new
+        // version instead.
+        if (_trackLeafChanges && writer == nullptr)
         {
-            int next = _ElementNodes.GetNext(tempIndex);
-            int saveElementId = _ElementNodes.GetElementId(tempIndex);
-            tempElementIndices.push_back(saveElementId);
-            _ElementNodes.erase(tempIndex);
-            tempIndex = next;
+            NoteLeafChange(saveElementId, LEAF_PRESENT);
         }
+        FreeElementNode(tempIndex, writer);
+        tempIndex = next;
+    }
 
-        // Create the new child QuadNodes
-        int tl_index = _Nodes.AddLeaf(); // TL
-        _Nodes.AddLeaf();                // TR
-        _Nodes.AddLeaf();                // BL
-        _Nodes.AddLeaf();                // BR
-        _Nodes.MakeBranch(quadNodeIndex, tl_index);
+    // Create the new child QuadNodes
+    int tl_index = AddLeafBlock(writer);
+    _Nodes.MakeBranch(quadNodeIndex, tl_index);
+
+    // Insert the current node's Elements into the new quad nodes
+    for (auto tempElementIndex : tempElementIndices)
+    {
+        InsertNode(quadNodeIndex, mid_x, mid_y, half_w, half_h, depth, tempElementIndex, writer);
+    }
+}
+
+FrameArena &QuadTree::ArenaFor(QuadTreeWriter *writer)
+{
+    return writer == nullptr ? *_arena : writer->_Arena;
+}
+
+int QuadTree::AddElementNode(int elementIndex, QuadTreeWriter *writer)
+{
+    if (writer == nullptr)
+    {
+        return _ElementNodes.Add(elementIndex);
+    }
+    const int elementNodeIndex = writer->AllocElementNode();
+    _ElementNodes.SetNext(elementNodeIndex, -1);
+    _ElementNodes.SetElementId(elementNodeIndex, elementIndex);
+    return elementNodeIndex;
+}
 
-        // Insert the current node's Elements into the new quad nodes
-        for (auto tempElementIndex : tempElementIndices)
+void QuadTree::FreeElementNode(int elementNodeIndex, QuadTreeWriter *writer)
+{
+    if (writer == nullptr)
+    {
+        _ElementNodes.erase(elementNodeIndex);
+    }
+    else
+    {
+        writer->FreeElementNode(elementNodeIndex);
+    }
+}
+
+int QuadTree::AddLeafBlock(QuadTreeWriter *writer)
+{
+    if (writer == nullptr)
+    {
+        int tl_index = _Nodes.AddLeaf(); // TL
+        // TR, BL, BR. Blocks are freed whole, so under either free list
+        // policy the four come back next to each other.
+        for (int i = 1; i < 4; i++)
         {
-            InsertNode(quadNodeIndex, mid_x, mid_y, half_w, half_h, depth, tempElementIndex);
+            [[maybe_unused]] const int index = _Nodes.AddLeaf();
+            assert(index == tl_index + i);
         }
+        return tl_index;
+    }
+    const int tl_index = writer->AllocNodeBlock();
+    for (int i = 0; i < 4; i++)
+    {
+        _Nodes.SetChildren(tl_index + i, -1);
+        _Nodes.SetCount(tl_index + i, 0);
     }
+    return tl_index;
 }
\ No newline at end of file
@@ -2,13 +2,20 @@
 #include <cstdint>
 #include <chrono>
 #include <functional>
-#include <SDL_render.h>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "jmath.h"
 #include "jint_list.h"
+#include "jarena.h"
+#include "jrender.h"
 
 using namespace std;
 
+class ThreadPool;
+class QuadTreeWriter;
+
 struct QuadRect
 {
     int midX;
@@ -33,6 +40,7 @@ struct QuadRect
         return Rect(midX, midY, halfW << 1, halfH << 1);
     }
 
+#ifndef NOIN_HEADLESS
     SDL_Rect ToSDL(Mat3 &transform)
     {
         Vec2 p = transform * Vec2(midX - halfW, midY + halfH);
@@ -43,18 +51,75 @@ struct QuadRect
         rect.h = halfW << 1;
         return rect;
     }
+#endif
+};
+
+// Memory held by one of a QuadTree's lists.
+struct QuadListStats
+{
+    // Slots allocated, slots handed out so far (the list's size) and how
+    // many of those are on the free list.
+    int capacity = 0;
+    int size = 0;
+    int freeSlots = 0;
+    size_t bytesReserved = 0;
+    // Live slots only.
+    size_t bytesUsed = 0;
+};
+
+struct QuadTreeMemoryStats
+{
+    static constexpr int HISTOGRAM_BUCKETS = 8;
+
+    QuadListStats elements;
+    QuadListStats elementNodes;
+    QuadListStats nodes;
+    // Exact bounds kept next to fat boxes.
+    size_t exactBoundsBytes = 0;
+    size_t bytesReserved = 0;
+    size_t bytesUsed = 0;
+
+    // Element nodes per live element, i.e. how many leaves the average
+    // element is stored in.
+    float duplication = 0;
+    int leaves = 0;
+    // Bucket 0 counts empty leaves, bucket i leaves holding [2^(i-1), 2^i)
+    // elements and the last one everything above.
+    int leafHistogram[HISTOGRAM_BUCKETS] = {};
 };
 
 class QuadTree
 {
+    friend class ConcurrentQuadTree;
+    friend class QuadTreeWriter;
+    friend class QuadTreePairCache;
+    friend class QuadTreeSnapshots;
+
 public:
-    const static int ROOT_QUAD_NODE_INDEX = 0;
+    static constexpr int ROOT_QUAD_NODE_INDEX = 0;
     using QueryCallback = void(
         void *user_data,
         QuadTree *tree,
         int nodeIndex,
         Rect nodeRect,
         int depth);
+    // Same as QueryCallback plus the pool worker running it, handy for
+    // indexing per thread buffers.
+    using ParallelQueryCallback = void(
+        void *user_data,
+        QuadTree *tree,
+        int nodeIndex,
+        Rect nodeRect,
+        int depth,
+        int worker);
+
+    struct TraverseCallback
+    {
+        ParallelQueryCallback *callback = nullptr;
+        // Thread safe callbacks run on whichever worker reaches the node.
+        // Others are called under a lock, one at a time (in no fixed order).
+        bool threadSafe = false;
+    };
 
     // Origin is center, x+ is right, y+ is up
     QuadRect _Bounds;
@@ -66,6 +131,46 @@ private:
     int _splitThreshold = 3;
     int _maxDepth = 25;
 
+    // Fat boxes, see SetFatMargin. With _keepExact the exact bounds of
+    // element i are at _exactBounds[i * 4] as left, top, right, bottom.
+    int _fatMargin = 0;
+    bool _keepExact = false;
+    vector<int> _exactBounds;
+
+    // Scratch for FindPairs, kept around so it doesn't allocate every frame.
+    // A leaf owns the points x in (minX, maxX], y in [minY, maxY).
+    struct PairLeaf
+    {
+        int nodeIndex;
+        int minX, maxX, minY, maxY;
+    };
+    vector<PairLeaf> _pairLeaves;
+    vector<vector<int>> _pairBoxes;
+    vector<vector<pair<int, int>>> _pairBuffers;
+
+    // One subtree per BulkBuild task, kept so rebuilds reuse their buffers.
+    vector<unique_ptr<QuadTree>> _buildTrees;
+
+    // Temporaries (split lists, traversal stacks) come from here, released
+    // by the end of the call which made them.
+    FrameArena _ownArena;
+    FrameArena *_arena = &_ownArena;
+
+    // Leaf membership changes, see TrackLeafChanges. Every element index is
+    // listed once, _leafChangeStates says whether it is in the tree now.
+    enum LeafChangeState : char
+    {
+        LEAF_UNCHANGED,
+        LEAF_PRESENT,
+        LEAF_REMOVED
+    };
+    bool _trackLeafChanges = false;
+    vector<int> _leafChanges;
+    vector<char> _leafChangeStates;
+    // Unique across trees, replaced whenever the contents change in ways the
+    // list doesn't cover.
+    uint64_t _contentsVersion = 0;
+
 public:
     QuadTree(Rect bounds, int maxDepth, int splitThreshold);
     ~QuadTree();
@@ -73,6 +178,20 @@ public:
     int Insert(int id, Rect &rect);
     void Remove(int elementIndex);
 
+    // Updates the bounds of an element. Returns the new element index.
+    int Move(int elementIndex, Rect &rect);
+
+    // Stores elements grown by 'margin' on every side so Move can leave them
+    // alone while their bounds stay inside. With 'refine' the exact bounds
+    // are kept on the side and Query/FindPairs test those, otherwise they
+    // test the grown boxes. Only affects elements added from now on.
+    void SetFatMargin(int margin, bool refine = true);
+    // Same as Insert/Move but grown by 'margin' instead of the fat margin,
+    // e.g. one derived from the element's velocity. Negative margins count
+    // as 0.
+    int Insert(int id, Rect &rect, int margin);
+    int Move(int elementIndex, Rect &rect, int margin);
+
     // Returns list of elements which intersect the query rectangle
     void Query(Rect query,
                unordered_map<int, bool> &seenElements,
@@ -84,14 +203,117 @@ public:
                   QueryCallback branchCallback,
                   QueryCallback leafCallback);
 
+    // Visits the same nodes as Traverse, spread over 'pool'. A task walks
+    // its subtree depth first and, every 'grainSize' nodes, hands the
+    // subtrees still waiting on its stack to the pool for idle workers to
+    // steal. The tree must not change until this returns.
+    void ParallelTraverse(void *userData,
+                          TraverseCallback branchCallback,
+                          TraverseCallback leafCallback,
+                          ThreadPool &pool,
+                          int grainSize = 256);
+
+    // Appends every pair of intersecting elements once as (idA, idB) with
+    // idA < idB, sorted. Given a pool the leaves are split across its workers,
+    // the output is the same whatever the number of threads.
+    void FindPairs(vector<pair<int, int>> &output, ThreadPool *pool = nullptr);
+
     void Clean();
 
+    // Takes temporaries from 'arena' instead of the tree's own, e.g. one the
+    // caller resets every frame. Not owned, null goes back to the tree's own.
+    // Only used from the calling thread, writers and BulkBuild workers have
+    // their own.
+    void SetArena(FrameArena *arena) { _arena = arena != nullptr ? arena : &_ownArena; }
+
+    // Where the element, element node and node lists get their buffers, see
+    // JIntList::set_allocator. Must outlive the tree.
+    void SetListAllocator(JIntListAllocator *allocator);
+
+    // Which free slots the element, element node and node lists reuse. With
+    // LowestIndex live data stays packed at the front after churn.
+    void SetFreeListPolicy(FreeListPolicy policy);
+
+    // While on, Insert, Remove, Move and the splits they cause note every
+    // element put into or taken out of a leaf, so QuadTreePairCache can
+    // catch up without walking the tree. Clear, BulkBuild, Load, Swap and
+    // ConcurrentQuadTree aren't noted, they make the cache start over.
+    void TrackLeafChanges(bool enabled);
+
+    // Replaces the contents with one element per rect, element i gets id
+    // ids[i] and element index i. The result has the same shape as inserting
+    // them one by one. Below the top few levels the subtrees are built on
+    // 'pool' and then stitched into this tree's lists.
+    void BulkBuild(const vector<int> &ids, const vector<Rect> &rects, ThreadPool *pool = nullptr);
+    // BulkBuild fed in chunks, e.g. while the rest of a file is still being
+    // read. Begin empties the tree, every Append adds elements with the next
+    // indices and Finish builds the nodes. Nothing else may touch the tree
+    // in between.
+    void BeginBulkBuild();
+    void AppendBulkBuild(const int *ids, const Rect *rects, int count);
+    void FinishBulkBuild(ThreadPool *pool = nullptr);
+
+    // Removes every element, keeping the allocated buffers around.
+    void Clear();
+
+    // Makes room so the lists don't reallocate until they hold this many
+    // elements, nodes and element nodes, e.g. sized at load from
+    // GetMemoryStats of a previous run.
+    void Reserve(int elements, int nodes, int elementNodes);
+    // Gives back every free slot of the node and element node lists (they
+    // are repacked) and the free slots at the end of the element list, along
+    // with FindPairs and BulkBuild scratch. Element indices stay valid, more
+    // of the element list is freed with FreeListPolicy::LowestIndex, which
+    // keeps its tail free. Not while a ConcurrentQuadTree wraps the tree.
+    void ShrinkToFit();
+
+    // Exchanges the contents (and parameters) of two trees.
+    void Swap(QuadTree &other);
+
+    // Writes the tree to 'path' in the format of jquad_file.h: the bounds,
+    // the parameters and every list's buffers as they are, free slots and
+    // free list state included. False if anything couldn't be written.
+    bool Save(const char *path);
+    // Replaces the contents with a tree written by Save, a handful of large
+    // reads with no per element work. The file must come from a build with
+    // the same list layouts. On failure the tree is left empty and keeps its
+    // bounds and parameters.
+    bool Load(const char *path);
+
+    // Sizes of the lists and how full the leaves are. Walks the branches
+    // once, cheap enough to call every frame.
+    QuadTreeMemoryStats GetMemoryStats();
+
     void Draw(SDL_Renderer *renderer,
               Mat3 &transform,
               chrono::milliseconds deltaMs,
               bool renderRects);
 
 protected:
+    // Writes the grown bounds of an element, and the exact ones if kept.
+    void SetElementBounds(int elementIndex, const Rect &rect, int margin);
+    // Writes only the exact bounds, for moves that stay inside the grown ones.
+    void SetExactBounds(int elementIndex, const Rect &rect);
+    // Whether 'rect' still fits in the stored bounds of an element.
+    bool FitsElementBounds(int elementIndex, const Rect &rect);
+    // The bounds Query and FindPairs test against.
+    void GetTestBounds(int elementIndex, int &left, int &top, int &right, int &bottom)
+    {
+        if (_keepExact)
+        {
+            const int *bounds = &_exactBounds[elementIndex * 4];
+            left = bounds[0];
+            top = bounds[1];
+            right = bounds[2];
+            bottom = bounds[3];
+            return;
+        }
+        left = _Elements.GetLeft(elementIndex);
+        top = _Elements.GetTop(elementIndex);
+        right = _Elements.GetRight(elementIndex);
+        bottom = _Elements.GetBottom(elementIndex);
+    }
+
     bool Intersects(int aLeft, int aTop, int aRight, int aBottom,
                     int bLeft, int bTop, int bRight, int bBottom);
 
@@ -101,13 +323,40 @@ protected:
                         int left, int top, int right, int bottom,
                         LeavesListIntList &output);
                         
+    // The writer is only passed in by ConcurrentQuadTree, slots then come
+    // from (and go back to) its slabs instead of the shared free lists.
     void InsertNode(int quadNodeIndex,
                     int midX, int midY, int halfW, int halfH,
                     int depth,
-                    int elementIndex);
+                    int elementIndex,
+                    QuadTreeWriter *writer = nullptr);
                     
     void InsertLeafNode(int quadNodeIndex,
                         int midX, int midY, int halfW, int halfH,
                         int depth,
-                        int elementIndex);
+                        int elementIndex,
+                        QuadTreeWriter *writer = nullptr);
+
+    void SplitLeaf(int quadNodeIndex,
+                   int midX, int midY, int halfW, int halfH,
+                   int depth,
+                   QuadTreeWriter *writer = nullptr);
+
+    // Unlinks an element from every leaf below the node, the element itself stays.
+    void RemoveFromLeaves(int quadNodeIndex,
+                          int midX, int midY, int halfW, int halfH,
+                          int depth,
+                          int elementIndex,
+                          QuadTreeWriter *writer = nullptr);
+
+    void NoteLeafChange(int elementIndex, LeafChangeState state);
+    void ForgetLeafChanges();
+    // Tells readers of the leaf changes to start over.
+    void NewContentsVersion();
+
+    FrameArena &ArenaFor(QuadTreeWriter *writer);
+    int AddElementNode(int elementIndex, QuadTreeWriter *writer);
+    void FreeElementNode(int elementNodeIndex, QuadTreeWriter *writer);
+    // Four consecutive leaves, TL TR BL BR.
+    int AddLeafBlock(QuadTreeWriter *writer);
 };
@@ -0,0 +1,240 @@
+#include <algorithm>
+
+#include "jquad.h"
+#include "jthread_pool.h"
+
+// A subtree which is built on its own and copied in afterwards.
+struct QuadBuildTask
+{
+    int nodeIndex;
+    QuadRect rect;
+    int depth;
+    ArenaVector<int> elements;
+
+    // Where its nodes (minus the root) and element nodes land in the tree.
+    int nodeBase;
+    int elementNodeBase;
+    int numElementNodes;
+};
+
+void QuadTree::BulkBuild(const vector<int> &ids, const vector<Rect> &rects, ThreadPool *pool)
+{
+    BeginBulkBuild();
+    AppendBulkBuild(ids.data(), rects.data(), (int)rects.size());
+    FinishBulkBuild(pool);
+}
+
+void QuadTree::BeginBulkBuild()
+{
+    Clear();
+}
+
+void QuadTree::AppendBulkBuild(const int *ids, const Rect *rects, int count)
+{
+    const int first = _Elements.size();
+    // Grow geometrically, a stream of small chunks would otherwise copy the
+    // whole list every time.
+    if (first + count > _Elements.cap)
+    {
+        _Elements.reserve(max(first + count, _Elements.cap * 2));
+    }
+    _Elements.resize(first + count);
+    for (int i = 0; i < count; i++)
+    {
+        _Elements.SetId(first + i, ids[i]);
+        SetElementBounds(first + i, rects[i], _fatMargin);
+    }
+}
+
+void QuadTree::FinishBulkBuild(ThreadPool *pool)
+{
+    const int numElements = _Elements.size();
+
+    // Whether a node splits only depends on how many elements overlap it,
+    // not on the insertion order. So the top levels can be split up front
+    // and every subtree below them built independently. Aim for a few
+    // subtrees per worker so uneven ones balance out.
+    const int numWorkers = pool != nullptr ? pool->NumWorkers() : 1;
+    int splitDepth = 0;
+    while ((1 << (2 * splitDepth)) < numWorkers * 8 && splitDepth < _maxDepth)
+    {
+        splitDepth++;
+    }
+
+    // Only this thread touches the task lists, workers just read them. They
+    // hold every element index once per split level, a tree on its own arena
+    // would keep that much scratch around for good, so it gets one of its
+    // own for this call.
+    FrameArena buildArena;
+    FrameArena &arena = _arena == &_ownArena ? buildArena : *_arena;
+    ArenaScope scope(arena);
+    ArenaVector<QuadBuildTask> tasks(arena);
+    ArenaVector<QuadBuildTask> stack(arena);
+    stack.push_back({ROOT_QUAD_NODE_INDEX, _Bounds, 0, ArenaVector<int>(arena), 0, 0, 0});
+    stack.back().elements.resize(numElements);
+    for (int i = 0; i < numElements; i++)
+    {
+        stack.back().elements[i] = i;
+    }
+    while (stack.size() > 0)
+    {
+        QuadBuildTask nd = std::move(stack.back());
+        stack.pop_back();
+
+        if (nd.depth >= splitDepth ||
+            nd.depth >= _maxDepth ||
+            (int)nd.elements.size() < _splitThreshold)
+        {
+            tasks.push_back(std::move(nd));
+            continue;
+        }
+
+        const int child = _Nodes.AddLeaf(); // TL
+        _Nodes.AddLeaf();                   // TR
+        _Nodes.AddLeaf();                   // BL
+        _Nodes.AddLeaf();                   // BR
+        _Nodes.MakeBranch(nd.nodeIndex, child);
+
+        QuadBuildTask children[4] = {
+            {child + 0, nd.rect.TL(), nd.depth + 1, ArenaVector<int>(arena), 0, 0, 0},
+            {child + 1, nd.rect.TR(), nd.depth + 1, ArenaVector<int>(arena), 0, 0, 0},
+            {child + 2, nd.rect.BL(), nd.depth + 1, ArenaVector<int>(arena), 0, 0, 0},
+            {child + 3, nd.rect.BR(), nd.depth + 1, ArenaVector<int>(arena), 0, 0, 0}};
+        const int mx = nd.rect.midX;
+        const int my = nd.rect.midY;
+        for (int elementIndex : nd.elements)
+        {
+            // Same rules as FindLeavesList.
+            const int left = _Elements.GetLeft(elementIndex);
+            const int top = _Elements.GetTop(elementIndex);
+            const int right = _Elements.GetRight(elementIndex);
+            const int bottom = _Elements.GetBottom(elementIndex);
+            if (top >= my)
+            {
+                if (left <= mx)
+                    children[0].elements.push_back(elementIndex);
+                if (right > mx)
+                    children[1].elements.push_back(elementIndex);
+            }
+            if (bottom < my)
+            {
+                if (left <= mx)
+                    children[2].elements.push_back(elementIndex);
+                if (right > mx)
+                    children[3].elements.push_back(elementIndex);
+            }
+        }
+        for (int i = 3; i >= 0; i--)
+        {
+            stack.push_back(std::move(children[i]));
+        }
+    }
+
+    const int numTasks = (int)tasks.size();
+    while ((int)_buildTrees.size() < numTasks)
+    {
+        _buildTrees.push_back(make_unique<QuadTree>(_Bounds.ToRect(), _maxDepth, _splitThreshold));
+    }
+
+    auto run = [&](const function<void(int task, int worker)> &fn)
+    {
+        if (pool != nullptr)
+        {
+            pool->ParallelFor(numTasks, fn);
+        }
+        else
+        {
+            for (int task = 0; task < numTasks; task++)
+            {
+                fn(task, 0);
+            }
+        }
+    };
+
+    // Build every subtree into its own lists. The subtree's elements carry
+    // the element index in this tree as their id.
+    auto buildSubtree = [&](int task, int)
+    {
+        QuadBuildTask &buildTask = tasks[task];
+        QuadTree &subtree = *_buildTrees[task];
+        subtree.Clear();
+        subtree._Bounds = buildTask.rect;
+        subtree._maxDepth = _maxDepth - buildTask.depth;
+        subtree._splitThreshold = _splitThreshold;
+        for (int elementIndex : buildTask.elements)
+        {
+            const int local = subtree._Elements.Add(
+                elementIndex,
+                _Elements.GetLeft(elementIndex),
+                _Elements.GetTop(elementIndex),
+                _Elements.GetRight(elementIndex),
+                _Elements.GetBottom(elementIndex));
+            subtree.InsertNode(ROOT_QUAD_NODE_INDEX,
+                               buildTask.rect.midX, buildTask.rect.midY,
+                               buildTask.rect.halfW, buildTask.rect.halfH,
+                               0,
+                               local);
+        }
+
+        // Splits recycle element nodes, so count what is actually linked.
+        buildTask.numElementNodes = 0;
+        for (int node = 0; node < subtree._Nodes.size(); node++)
+        {
+            if (subtree._Nodes.IsLeaf(node))
+            {
+                buildTask.numElementNodes += subtree._Nodes.GetCount(node);
+            }
+        }
+    };
+    // By reference, std::function would otherwise copy the lambda to the heap.
+    run(ref(buildSubtree));
+
+    // Hand out ranges. A subtree root stays where the split put it, the rest
+    // of its nodes are appended in order so child blocks stay contiguous.
+    int numNodes = _Nodes.size();
+    int numElementNodes = 0;
+    for (int task = 0; task < numTasks; task++)
+    {
+        tasks[task].nodeBase = numNodes;
+        tasks[task].elementNodeBase = numElementNodes;
+        numNodes += _buildTrees[task]->_Nodes.size() - 1;
+        numElementNodes += tasks[task].numElementNodes;
+    }
+    _Nodes.resize(numNodes);
+    _ElementNodes.resize(numElementNodes);
+
+    // Copy the subtrees in, rebasing node indices and compacting element nodes.
+    auto copySubtree = [&](int task, int)
+    {
+        const QuadBuildTask &buildTask = tasks[task];
+        QuadTree &subtree = *_buildTrees[task];
+        auto rebase = [&](int node)
+        { return node == ROOT_QUAD_NODE_INDEX ? buildTask.nodeIndex : buildTask.nodeBase + node - 1; };
+
+        int elementNodeIndex = buildTask.elementNodeBase;
+        for (int node = 0; node < subtree._Nodes.size(); node++)
+        {
+            const int target = rebase(node);
+            if (subtree._Nodes.IsBranch(node))
+            {
+                _Nodes.MakeBranch(target, rebase(subtree._Nodes.GetChildren(node)));
+                continue;
+            }
+
+            const int count = subtree._Nodes.GetCount(node);
+            _Nodes.SetChildren(target, count > 0 ? elementNodeIndex : -1);
+            _Nodes.SetCount(target, count);
+            int local = subtree._Nodes.GetChildren(node);
+            while (local != -1)
+            {
+                const int element = subtree._ElementNodes.GetElementId(local);
+                local = subtree._ElementNodes.GetNext(local);
+                _ElementNodes.SetElementId(elementNodeIndex, subtree._Elements.GetId(element));
+                _ElementNodes.SetNext(elementNodeIndex, local != -1 ? elementNodeIndex + 1 : -1);
+                elementNodeIndex++;
+            }
+        }
+    };
+    run(ref(copySubtree));
+    NewContentsVersion();
+}
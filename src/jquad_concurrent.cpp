@@ -0,0 +1,287 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "jquad_concurrent.h"
+
+// Slots grabbed from the owner at a time.
+static const int ELEMENT_SLAB = 64;
+static const int ELEMENT_NODE_SLAB = 256;
+static const int NODE_BLOCK_SLAB = 16;
+
+// ---------------------------------------------------------------------------------
+// ConcurrentQuadTree
+// ---------------------------------------------------------------------------------
+ConcurrentQuadTree::ConcurrentQuadTree(QuadTree &tree, int lockDepth,
+                                       int maxElements, int maxElementNodes, int maxNodes)
+    : _Tree(tree),
+      _LockDepth(min(min(lockDepth, (int)MAX_LOCK_DEPTH), tree._maxDepth))
+{
+    // Writers don't note their leaf changes.
+    tree.NewContentsVersion();
+    // Split the top levels so every subtree root exists before any writer
+    // starts. Children are listed TL, TR, BL, BR which gives the path order.
+    _Subtrees.push_back({QuadTree::ROOT_QUAD_NODE_INDEX, tree._Bounds});
+    for (int depth = 0; depth < _LockDepth; depth++)
+    {
+        vector<Subtree> next(_Subtrees.size() * 4);
+        for (size_t i = 0; i < _Subtrees.size(); i++)
+        {
+            Subtree &subtree = _Subtrees[i];
+            QuadRect &rect = subtree.rect;
+            if (tree._Nodes.IsLeaf(subtree.nodeIndex))
+            {
+                tree.SplitLeaf(subtree.nodeIndex, rect.midX, rect.midY, rect.halfW, rect.halfH, depth);
+            }
+            const int child = tree._Nodes.GetChildren(subtree.nodeIndex);
+            next[i * 4 + 0] = {child + 0, rect.TL()};
+            next[i * 4 + 1] = {child + 1, rect.TR()};
+            next[i * 4 + 2] = {child + 2, rect.BL()};
+            next[i * 4 + 3] = {child + 3, rect.BR()};
+        }
+        _Subtrees.swap(next);
+    }
+    _Locks.reset(new SubtreeLock[_Subtrees.size()]);
+
+    tree._Elements.reserve(maxElements);
+    if (tree._keepExact && (int)tree._exactBounds.size() < maxElements * 4)
+    {
+        // Writers fill in their own slots, it must not move under them.
+        tree._exactBounds.resize(maxElements * 4);
+    }
+    tree._ElementNodes.reserve(maxElementNodes);
+    tree._Nodes.reserve(maxNodes);
+    tree._Elements.take_free(_FreeElements);
+    tree._ElementNodes.take_free(_FreeElementNodes);
+}
+
+ConcurrentQuadTree::~ConcurrentQuadTree()
+{
+    assert(_NumWriters == 0 && "QuadTreeWriter outlived its ConcurrentQuadTree");
+
+    // Back onto the free lists. Node blocks are erased last to first so
+    // the next four AddLeaf calls get them back contiguous.
+    for (int elementIndex : _FreeElements)
+    {
+        _Tree._Elements.erase(elementIndex);
+    }
+    for (int elementNodeIndex : _FreeElementNodes)
+    {
+        _Tree._ElementNodes.erase(elementNodeIndex);
+    }
+    for (int nodeIndex : _FreeNodeBlocks)
+    {
+        _Tree._Nodes.erase(nodeIndex + 3);
+        _Tree._Nodes.erase(nodeIndex + 2);
+        _Tree._Nodes.erase(nodeIndex + 1);
+        _Tree._Nodes.erase(nodeIndex + 0);
+    }
+}
+
+void ConcurrentQuadTree::FindSubtrees(int left, int top, int right, int bottom, vector<int> &output)
+{
+    // The top levels are all branches, so this only needs the rects. At most
+    // three siblings wait per level.
+    struct Pending
+    {
+        int path;
+        int depth;
+        QuadRect rect;
+    };
+    Pending stack[1 + 3 * MAX_LOCK_DEPTH];
+    int size = 0;
+    stack[size++] = {0, 0, _Tree._Bounds};
+    while (size > 0)
+    {
+        Pending nd = stack[--size];
+        if (nd.depth == _LockDepth)
+        {
+            output.push_back(nd.path);
+            continue;
+        }
+        if (top >= nd.rect.midY)
+        {
+            if (left <= nd.rect.midX) // TL
+            {
+                stack[size++] = {nd.path * 4 + 0, nd.depth + 1, nd.rect.TL()};
+            }
+            if (right > nd.rect.midX) // TR
+            {
+                stack[size++] = {nd.path * 4 + 1, nd.depth + 1, nd.rect.TR()};
+            }
+        }
+        if (bottom < nd.rect.midY)
+        {
+            if (left <= nd.rect.midX) // BL
+            {
+                stack[size++] = {nd.path * 4 + 2, nd.depth + 1, nd.rect.BL()};
+            }
+            if (right > nd.rect.midX) // BR
+            {
+                stack[size++] = {nd.path * 4 + 3, nd.depth + 1, nd.rect.BR()};
+            }
+        }
+    }
+}
+
+template <class List>
+void ConcurrentQuadTree::Refill(List &list, vector<int> &pool, vector<int> &output, int count, int stride)
+{
+    lock_guard<mutex> lock(_AllocMutex);
+    while (count > 0 && pool.size() > 0)
+    {
+        output.push_back(pool.back());
+        pool.pop_back();
+        count--;
+    }
+    if (count > 0)
+    {
+        // Fresh slots off the end, never past the reservation: other writers
+        // use the buffers without this lock, so they must not move. The last
+        // slab may come up short.
+        const int first = list.num;
+        count = min(count, (list.cap - first) / stride);
+        if (count == 0 && output.empty())
+        {
+            fprintf(stderr, "ConcurrentQuadTree ran out of reserved slots\n");
+            abort();
+        }
+        list.resize(first + count * stride);
+        for (int i = count - 1; i >= 0; i--)
+        {
+            output.push_back(first + i * stride);
+        }
+    }
+}
+
+void ConcurrentQuadTree::GiveBack(vector<int> &pool, vector<int> &slots)
+{
+    lock_guard<mutex> lock(_AllocMutex);
+    pool.insert(pool.end(), slots.begin(), slots.end());
+    slots.clear();
+}
+
+// ---------------------------------------------------------------------------------
+// QuadTreeWriter
+// ---------------------------------------------------------------------------------
+QuadTreeWriter::QuadTreeWriter(ConcurrentQuadTree &owner)
+    : _Owner(owner)
+{
+    lock_guard<mutex> lock(_Owner._AllocMutex);
+    _Owner._NumWriters++;
+}
+
+QuadTreeWriter::~QuadTreeWriter()
+{
+    _Owner.GiveBack(_Owner._FreeElements, _FreeElements);
+    _Owner.GiveBack(_Owner._FreeElementNodes, _FreeElementNodes);
+    _Owner.GiveBack(_Owner._FreeNodeBlocks, _FreeNodeBlocks);
+    lock_guard<mutex> lock(_Owner._AllocMutex);
+    _Owner._NumWriters--;
+}
+
+int QuadTreeWriter::Insert(int id, Rect &rect)
+{
+    QuadTree &tree = _Owner._Tree;
+    const int elementIndex = AllocElement();
+    tree._Elements.SetId(elementIndex, id);
+    tree.SetElementBounds(elementIndex, rect, tree._fatMargin);
+
+    // Each subtree is complete on its own, so there is no need to hold more
+    // than one lock at a time (and no lock ordering to get wrong).
+    _Subtrees.clear();
+    _Owner.FindSubtrees(tree._Elements.GetLeft(elementIndex),
+                        tree._Elements.GetTop(elementIndex),
+                        tree._Elements.GetRight(elementIndex),
+                        tree._Elements.GetBottom(elementIndex),
+                        _Subtrees);
+    for (int subtreeIndex : _Subtrees)
+    {
+        const ConcurrentQuadTree::Subtree &subtree = _Owner._Subtrees[subtreeIndex];
+        lock_guard<mutex> lock(_Owner._Locks[subtreeIndex].lock);
+        tree.InsertNode(subtree.nodeIndex,
+                        subtree.rect.midX, subtree.rect.midY, subtree.rect.halfW, subtree.rect.halfH,
+                        _Owner._LockDepth,
+                        elementIndex,
+                        this);
+    }
+    return elementIndex;
+}
+
+void QuadTreeWriter::Remove(int elementIndex)
+{
+    QuadTree &tree = _Owner._Tree;
+    _Subtrees.clear();
+    _Owner.FindSubtrees(tree._Elements.GetLeft(elementIndex),
+                        tree._Elements.GetTop(elementIndex),
+                        tree._Elements.GetRight(elementIndex),
+                        tree._Elements.GetBottom(elementIndex),
+                        _Subtrees);
+    for (int subtreeIndex : _Subtrees)
+    {
+        const ConcurrentQuadTree::Subtree &subtree = _Owner._Subtrees[subtreeIndex];
+        lock_guard<mutex> lock(_Owner._Locks[subtreeIndex].lock);
+        tree.RemoveFromLeaves(subtree.nodeIndex,
+                              subtree.rect.midX, subtree.rect.midY, subtree.rect.halfW, subtree.rect.halfH,
+                              _Owner._LockDepth,
+                              elementIndex,
+                              this);
+    }
+    _FreeElements.push_back(elementIndex);
+}
+
+int QuadTreeWriter::Move(int elementIndex, Rect &rect)
+{
+    QuadTree &tree = _Owner._Tree;
+    if (tree.FitsElementBounds(elementIndex, rect))
+    {
+        // The element is only touched by its owner, no lock needed.
+        if (tree._keepExact)
+        {
+            tree.SetExactBounds(elementIndex, rect);
+        }
+        return elementIndex;
+    }
+    const int id = tree._Elements.GetId(elementIndex);
+    Remove(elementIndex);
+    return Insert(id, rect);
+}
+
+int QuadTreeWriter::AllocElement()
+{
+    if (_FreeElements.empty())
+    {
+        _Owner.Refill(_Owner._Tree._Elements, _Owner._FreeElements, _FreeElements, ELEMENT_SLAB, 1);
+    }
+    const int elementIndex = _FreeElements.back();
+    _FreeElements.pop_back();
+    return elementIndex;
+}
+
+int QuadTreeWriter::AllocElementNode()
+{
+    if (_FreeElementNodes.empty())
+    {
+        _Owner.Refill(_Owner._Tree._ElementNodes, _Owner._FreeElementNodes, _FreeElementNodes, ELEMENT_NODE_SLAB, 1);
+    }
+    const int elementNodeIndex = _FreeElementNodes.back();
+    _FreeElementNodes.pop_back();
+    return elementNodeIndex;
+}
+
+void QuadTreeWriter::FreeElementNode(int elementNodeIndex)
+{
+    _FreeElementNodes.push_back(elementNodeIndex);
+}
+
+int QuadTreeWriter::AllocNodeBlock()
+{
+    if (_FreeNodeBlocks.empty())
+    {
+        _Owner.Refill(_Owner._Tree._Nodes, _Owner._FreeNodeBlocks, _FreeNodeBlocks, NODE_BLOCK_SLAB, 4);
+    }
+    const int nodeIndex = _FreeNodeBlocks.back();
+    _FreeNodeBlocks.pop_back();
+    return nodeIndex;
+}
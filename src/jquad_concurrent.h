@@ -0,0 +1,109 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "jmath.h"
+#include "jquad.h"
+
+using namespace std;
+
+class ConcurrentQuadTree;
+
+// Inserts and removes on behalf of one thread. Holds that thread's slabs of
+// free element, element node and node slots so allocating never touches the
+// tree's shared free lists. Create one per writer thread, destroy them all
+// before the ConcurrentQuadTree.
+class QuadTreeWriter
+{
+public:
+    explicit QuadTreeWriter(ConcurrentQuadTree &owner);
+    QuadTreeWriter(const QuadTreeWriter &) = delete;
+    QuadTreeWriter &operator=(const QuadTreeWriter &) = delete;
+    // Hands unused slots back to the owner.
+    ~QuadTreeWriter();
+
+    // Same as the QuadTree versions. Safe to call from several writers at
+    // once, as long as no two of them touch the same element.
+    int Insert(int id, Rect &rect);
+    void Remove(int elementIndex);
+    int Move(int elementIndex, Rect &rect);
+
+private:
+    friend class QuadTree;
+    int AllocElement();
+    int AllocElementNode();
+    void FreeElementNode(int elementNodeIndex);
+    int AllocNodeBlock();
+
+    ConcurrentQuadTree &_Owner;
+    vector<int> _FreeElements;
+    vector<int> _FreeElementNodes;
+    vector<int> _FreeNodeBlocks;
+    vector<int> _Subtrees;
+    // Temporaries of this writer's splits.
+    FrameArena _Arena;
+};
+
+// Concurrent insert/remove mode for a QuadTree.
+//
+// The top 'lockDepth' levels are split up front and stay fixed, every
+// subtree below them gets its own lock. A writer only locks the subtrees its
+// element overlaps (one at a time), so writers in different parts of the
+// world don't wait on each other. Slots come from per writer slabs which are
+// refilled in chunks from room reserved up front, the lists never move while
+// writers run.
+//
+// Only writers may touch the tree while this object exists. Queries, Clean
+// and plain QuadTree::Insert/Remove have to wait until it is destroyed, at
+// which point unused slots go back onto the tree's free lists.
+class ConcurrentQuadTree
+{
+public:
+    // 4^8 locks is already far more than there are cores to contend.
+    static const int MAX_LOCK_DEPTH = 8;
+
+    // The max counts are totals for the tree (including what is already in
+    // it). Going past them aborts, the lists can't grow while writers run.
+    ConcurrentQuadTree(QuadTree &tree, int lockDepth,
+                       int maxElements, int maxElementNodes, int maxNodes);
+    ConcurrentQuadTree(const ConcurrentQuadTree &) = delete;
+    ConcurrentQuadTree &operator=(const ConcurrentQuadTree &) = delete;
+    ~ConcurrentQuadTree();
+
+    int NumSubtrees() { return (int)_Subtrees.size(); }
+
+private:
+    friend class QuadTreeWriter;
+
+    struct Subtree
+    {
+        int nodeIndex;
+        QuadRect rect;
+    };
+    struct alignas(64) SubtreeLock
+    {
+        mutex lock;
+    };
+
+    // Appends the subtrees the bounds overlap, same rules as FindLeavesList.
+    void FindSubtrees(int left, int top, int right, int bottom, vector<int> &output);
+
+    // Moves 'count' free slots of 'list' into 'output', taking recycled ones
+    // from 'pool' first. Slots are 'stride' elements wide.
+    template <class List>
+    void Refill(List &list, vector<int> &pool, vector<int> &output, int count, int stride);
+    void GiveBack(vector<int> &pool, vector<int> &slots);
+
+    QuadTree &_Tree;
+    int _LockDepth;
+    // Indexed by the quadrants taken on the way down, two bits per level.
+    vector<Subtree> _Subtrees;
+    unique_ptr<SubtreeLock[]> _Locks;
+
+    mutex _AllocMutex;
+    vector<int> _FreeElements;
+    vector<int> _FreeElementNodes;
+    vector<int> _FreeNodeBlocks;
+    int _NumWriters = 0;
+};
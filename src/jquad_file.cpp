@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "jquad.h"
+#include "jquad_file.h"
+
+static bool isLittleEndian()
+{
+    const uint16_t one = 1;
+    unsigned char low;
+    memcpy(&low, &one, 1);
+    return low == 1;
+}
+
+// 64 bit offsets, long is 32 bits on Windows.
+static bool seekTo(FILE *file, uint64_t offset)
+{
+#if defined(_MSC_VER)
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t sizeOf(FILE *file)
+{
+#if defined(_MSC_VER)
+    return _fseeki64(file, 0, SEEK_END) == 0 ? (uint64_t)_ftelli64(file) : 0;
+#else
+    return fseeko(file, 0, SEEK_END) == 0 ? (uint64_t)ftello(file) : 0;
+#endif
+}
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + QUAD_FILE_ALIGNMENT - 1) / QUAD_FILE_ALIGNMENT * QUAD_FILE_ALIGNMENT;
+}
+
+// Fills in 'desc' for a list whose arrays start at 'offset' or later.
+// Returns the end of them.
+template <class List>
+static uint64_t describeList(List &list, QuadFileList &desc, uint64_t offset)
+{
+    static_assert(List::num_columns <= QUAD_FILE_MAX_COLUMNS, "too many columns for the file format");
+    memset(&desc, 0, sizeof(desc));
+    desc.num = list.size();
+    desc.numFree = list.num_free;
+    desc.freeElement = list.free_element;
+    desc.freePolicy = (int32_t)list.free_policy();
+    desc.numFields = List::num_fields;
+    desc.layout = (int32_t)List::layout;
+    desc.numColumns = List::num_columns;
+    desc.numBitmapWords = list.free_policy() == FreeListPolicy::LowestIndex ? (int32_t)list.free_bitmap().size() : 0;
+    for (int c = 0; c < List::num_columns; c++)
+    {
+        offset = alignUp(offset);
+        desc.columnSizes[c] = (uint32_t)List::column_size(c);
+        desc.columnOffsets[c] = offset;
+        offset += (uint64_t)desc.num * desc.columnSizes[c];
+    }
+    offset = alignUp(offset);
+    desc.bitmapOffset = offset;
+    offset += (uint64_t)(desc.numBitmapWords + (desc.numBitmapWords + 63) / 64) * sizeof(uint64_t);
+    return offset;
+}
+
+// Whether the list described could be read into a List of this build.
+template <class List>
+static bool matchesList(const QuadFileList &desc, uint64_t fileSize)
+{
+    if (desc.numFields != List::num_fields ||
+        desc.layout != (int32_t)List::layout ||
+        desc.numColumns != List::num_columns ||
+        desc.num < 0 || desc.numFree < 0 || desc.numFree > desc.num ||
+        desc.freeElement < -1 || desc.freeElement >= desc.num ||
+        (desc.numFree > 0 && desc.freeElement < 0) ||
+        desc.numBitmapWords < 0 || desc.numBitmapWords > (desc.num + 63) / 64)
+    {
+        return false;
+    }
+    // Lifo keeps no bitmaps. LowestIndex needs them to cover every free slot.
+    if (desc.freePolicy == (int32_t)FreeListPolicy::Lifo)
+    {
+        if (desc.numBitmapWords != 0)
+        {
+            return false;
+        }
+    }
+    else if (desc.freePolicy == (int32_t)FreeListPolicy::LowestIndex)
+    {
+        if (desc.numFree > 0 &&
+            (desc.numBitmapWords == 0 || desc.freeElement >= desc.numBitmapWords * 64))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    for (int c = 0; c < List::num_columns; c++)
+    {
+        if (desc.columnSizes[c] != List::column_size(c) ||
+            desc.columnOffsets[c] % QUAD_FILE_ALIGNMENT != 0 ||
+            desc.columnOffsets[c] > fileSize ||
+            (uint64_t)desc.num * desc.columnSizes[c] > fileSize - desc.columnOffsets[c])
+        {
+            return false;
+        }
+    }
+    const uint64_t bitmapBytes = (uint64_t)(desc.numBitmapWords + (desc.numBitmapWords + 63) / 64) * sizeof(uint64_t);
+    return desc.bitmapOffset % QUAD_FILE_ALIGNMENT == 0 &&
+           desc.bitmapOffset <= fileSize &&
+           bitmapBytes <= fileSize - desc.bitmapOffset;
+}
+
+// Writes 'bytes' at 'offset', zero filling from 'position' up to it.
+static bool writeAt(FILE *file, uint64_t &position, uint64_t offset, const void *data, size_t bytes)
+{
+    static const char zeros[QUAD_FILE_ALIGNMENT] = {};
+    while (position < offset)
+    {
+        const size_t pad = (size_t)min<uint64_t>(offset - position, sizeof(zeros));
+        if (fwrite(zeros, 1, pad, file) != pad)
+        {
+            return false;
+        }
+        position += pad;
+    }
+    if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes)
+    {
+        return false;
+    }
+    position += bytes;
+    return true;
+}
+
+static bool readAt(FILE *file, uint64_t offset, void *data, size_t bytes)
+{
+    if (bytes == 0)
+    {
+        return true;
+    }
+    return seekTo(file, offset) && fread(data, 1, bytes, file) == bytes;
+}
+
+template <class List>
+static bool writeList(FILE *file, uint64_t &position, List &list, const QuadFileList &desc)
+{
+    bool ok = true;
+    for (int c = 0; c < List::num_columns && ok; c++)
+    {
+        ok = writeAt(file, position, desc.columnOffsets[c], list.column(c), (size_t)desc.num * desc.columnSizes[c]);
+    }
+    if (desc.numBitmapWords > 0)
+    {
+        ok = ok && writeAt(file, position, desc.bitmapOffset, list.free_bitmap().data(), desc.numBitmapWords * sizeof(uint64_t));
+        ok = ok && writeAt(file, position, position, list.free_bitmap_summary().data(), ((desc.numBitmapWords + 63) / 64) * sizeof(uint64_t));
+    }
+    return ok;
+}
+
+template <class List>
+static bool readList(FILE *file, List &list, const QuadFileList &desc)
+{
+    list.clear();
+    list.resize(desc.num);
+    bool ok = true;
+    for (int c = 0; c < List::num_columns && ok; c++)
+    {
+        ok = readAt(file, desc.columnOffsets[c], list.column(c), (size_t)desc.num * desc.columnSizes[c]);
+    }
+    if (desc.numBitmapWords > 0)
+    {
+        const int summaryWords = (desc.numBitmapWords + 63) / 64;
+        list.free_bitmap().resize(desc.numBitmapWords);
+        list.free_bitmap_summary().resize(summaryWords);
+        ok = ok && readAt(file, desc.bitmapOffset, list.free_bitmap().data(), desc.numBitmapWords * sizeof(uint64_t));
+        ok = ok && fread(list.free_bitmap_summary().data(), sizeof(uint64_t), summaryWords, file) == (size_t)summaryWords;
+    }
+    list.set_free_state((FreeListPolicy)desc.freePolicy, desc.freeElement, desc.numFree);
+    return ok;
+}
+
+bool CheckQuadFileHeader(const QuadFileHeader &header, uint64_t fileSize)
+{
+    return isLittleEndian() &&
+           memcmp(header.magic, QUAD_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+           header.version == QUAD_FILE_VERSION &&
+           header.headerSize == sizeof(header) &&
+           header.fileSize <= fileSize &&
+           matchesList<QuadNodesIntList>(header.nodes, header.fileSize) &&
+           matchesList<QuadElementIntList>(header.elements, header.fileSize) &&
+           matchesList<QuadElementNodeIntList>(header.elementNodes, header.fileSize) &&
+           header.nodes.num > 0 &&
+           header.numExactBounds == (header.keepExact ? header.elements.num : 0) &&
+           header.exactBoundsOffset % QUAD_FILE_ALIGNMENT == 0 &&
+           header.exactBoundsOffset <= header.fileSize &&
+           (uint64_t)header.numExactBounds * 4 * sizeof(int) <= header.fileSize - header.exactBoundsOffset;
+}
+
+bool QuadTree::Save(const char *path)
+{
+    if (!isLittleEndian())
+    {
+        return false;
+    }
+
+    QuadFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QUAD_FILE_MAGIC, sizeof(header.magic));
+    header.version = QUAD_FILE_VERSION;
+    header.headerSize = sizeof(header);
+    header.midX = _Bounds.midX;
+    header.midY = _Bounds.midY;
+    header.halfW = _Bounds.halfW;
+    header.halfH = _Bounds.halfH;
+    header.maxDepth = _maxDepth;
+    header.splitThreshold = _splitThreshold;
+    header.fatMargin = _fatMargin;
+    header.keepExact = _keepExact ? 1 : 0;
+
+    uint64_t offset = sizeof(header);
+    offset = describeList(_Nodes, header.nodes, offset);
+    offset = describeList(_Elements, header.elements, offset);
+    offset = describeList(_ElementNodes, header.elementNodes, offset);
+    header.numExactBounds = _keepExact ? min(_Elements.size(), (int)_exactBounds.size() / 4) : 0;
+    header.exactBoundsOffset = alignUp(offset);
+    header.fileSize = header.exactBoundsOffset + (uint64_t)header.numExactBounds * 4 * sizeof(int);
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    uint64_t position = 0;
+    bool ok = writeAt(file, position, 0, &header, sizeof(header));
+    ok = ok && writeList(file, position, _Nodes, header.nodes);
+    ok = ok && writeList(file, position, _Elements, header.elements);
+    ok = ok && writeList(file, position, _ElementNodes, header.elementNodes);
+    ok = ok && writeAt(file, position, header.exactBoundsOffset, _exactBounds.data(), (size_t)header.numExactBounds * 4 * sizeof(int));
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+bool QuadTree::Load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    QuadFileHeader header;
+    vector<int> exactBounds;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              CheckQuadFileHeader(header, sizeOf(file));
+    if (ok)
+    {
+        ok = readList(file, _Nodes, header.nodes) &&
+             readList(file, _Elements, header.elements) &&
+             readList(file, _ElementNodes, header.elementNodes);
+        exactBounds.resize((size_t)header.numExactBounds * 4);
+        ok = ok && readAt(file, header.exactBoundsOffset, exactBounds.data(), exactBounds.size() * sizeof(int));
+    }
+    fclose(file);
+    if (!ok)
+    {
+        Clear();
+        return false;
+    }
+
+    // The parameters only change once the whole tree has been read.
+    _Bounds = QuadRect(header.midX, header.midY, header.halfW, header.halfH);
+    _maxDepth = header.maxDepth;
+    _splitThreshold = header.splitThreshold;
+    _fatMargin = header.fatMargin;
+    _keepExact = header.keepExact != 0;
+    _exactBounds.swap(exactBounds);
+    NewContentsVersion();
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+
+// On-disk layout written by QuadTree::Save and read by QuadTree::Load.
+// Little-endian throughout. Every array starts on a QUAD_FILE_ALIGNMENT
+// boundary and holds the lists' buffers byte for byte, so a mapped file can
+// be used in place.
+
+static const char QUAD_FILE_MAGIC[8] = {'J', 'Q', 'U', 'A', 'D', 'T', 'R', 'E'};
+static const uint32_t QUAD_FILE_VERSION = 1;
+static const int QUAD_FILE_ALIGNMENT = 64;
+static const int QUAD_FILE_MAX_COLUMNS = 8;
+
+// One RecordList.
+struct QuadFileList
+{
+    // Slots (free ones included), how many are free, the free list head and
+    // the FreeListPolicy.
+    int32_t num;
+    int32_t numFree;
+    int32_t freeElement;
+    int32_t freePolicy;
+    // Shape of the list, must match the build reading it.
+    int32_t numFields;
+    int32_t layout;
+    int32_t numColumns;
+    // FreeListPolicy::LowestIndex only, 0 otherwise.
+    int32_t numBitmapWords;
+    uint32_t columnSizes[QUAD_FILE_MAX_COLUMNS];
+    // Column c is num * columnSizes[c] bytes.
+    uint64_t columnOffsets[QUAD_FILE_MAX_COLUMNS];
+    // numBitmapWords free bits followed by (numBitmapWords + 63) / 64
+    // summary words.
+    uint64_t bitmapOffset;
+};
+
+struct QuadFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+
+    int32_t midX;
+    int32_t midY;
+    int32_t halfW;
+    int32_t halfH;
+    int32_t maxDepth;
+    int32_t splitThreshold;
+    int32_t fatMargin;
+    int32_t keepExact;
+
+    QuadFileList nodes;
+    QuadFileList elements;
+    QuadFileList elementNodes;
+
+    // keepExact only, left, top, right, bottom per element.
+    int32_t numExactBounds;
+    int32_t unused;
+    uint64_t exactBoundsOffset;
+};
+
+// Whether a file of 'fileSize' bytes starting with 'header' can be read by
+// this build: magic, version, list shapes and every section aligned and
+// inside the file.
+bool CheckQuadFileHeader(const QuadFileHeader &header, uint64_t fileSize);
+
+static_assert(sizeof(QuadFileList) == 136, "QuadFileList must not change size");
+static_assert(sizeof(QuadFileHeader) == 480, "QuadFileHeader must not change size");
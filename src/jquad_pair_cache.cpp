@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <iterator>
+
+#include "jquad_pair_cache.h"
+
+void QuadTreePairCache::Update(QuadTree &tree)
+{
+    if (&tree == _Tree && tree._trackLeafChanges && tree._contentsVersion == _TreeVersion)
+    {
+        ApplyLeafChanges(tree);
+        FindLeavesOfDirty(tree);
+        RefreshBoxes(tree);
+        FindFreshCandidatesOfDirty(tree);
+        _LeafStart.clear();
+        _LeafKeys.clear();
+    }
+    else
+    {
+        // From here on the notes cover every change, the walk sees the rest.
+        tree.TrackLeafChanges(true);
+        tree.ForgetLeafChanges();
+        CollectLeaves(tree);
+        FindDirty();
+        FindFreshCandidates();
+        _Tree = &tree;
+        _TreeVersion = tree._contentsVersion;
+    }
+
+    // Two clean elements share a leaf now exactly when they did last update,
+    // so their candidates carry over. Fresh candidates all have a dirty
+    // element, the two lists never overlap.
+    _Kept.clear();
+    for (auto [a, b] : _Candidates)
+    {
+        if (!_Dirty[a] && !_Dirty[b])
+        {
+            _Kept.emplace_back(a, b);
+        }
+    }
+    _Candidates.clear();
+    merge(_Kept.begin(), _Kept.end(), _Fresh.begin(), _Fresh.end(), back_inserter(_Candidates));
+
+    swap(_Pairs, _PrevPairs);
+    _Pairs.clear();
+    for (auto [a, b] : _Candidates)
+    {
+        const int *A = &_Boxes[a * 4];
+        const int *B = &_Boxes[b * 4];
+        if (tree.Intersects(A[0], A[1], A[2], A[3], B[0], B[1], B[2], B[3]))
+        {
+            _Pairs.emplace_back(a, b);
+        }
+    }
+
+    _Began.clear();
+    _Ended.clear();
+    set_difference(_Pairs.begin(), _Pairs.end(), _PrevPairs.begin(), _PrevPairs.end(), back_inserter(_Began));
+    set_difference(_PrevPairs.begin(), _PrevPairs.end(), _Pairs.begin(), _Pairs.end(), back_inserter(_Ended));
+
+    _LastStats.candidates = (int)_Candidates.size();
+    _LastStats.freshCandidates = (int)_Fresh.size();
+
+    swap(_LeafStart, _PrevLeafStart);
+    swap(_LeafKeys, _PrevLeafKeys);
+}
+
+void QuadTreePairCache::Clear()
+{
+    _PrevLeafStart.clear();
+    _PrevLeafKeys.clear();
+    _Candidates.clear();
+    _Pairs.clear();
+    _Began.clear();
+    _Ended.clear();
+    _NumIds = 0;
+    _Tree = nullptr;
+}
+
+void QuadTreePairCache::GrowIds(int id)
+{
+    if ((size_t)id < _NumIds)
+    {
+        return;
+    }
+    _NumIds = (size_t)id + 1;
+    if (_IdElements.size() < _NumIds)
+    {
+        const size_t size = max(_NumIds, _IdElements.size() * 2);
+        _IdElements.resize(size, -1);
+        _IdLeaves.resize(size * KNOWN_LEAVES);
+        _IdLeafCount.resize(size, -1);
+        _Boxes.resize(size * 4);
+    }
+}
+
+void QuadTreePairCache::MarkDirty(int id)
+{
+    if (_Dirty.size() < _NumIds)
+    {
+        _Dirty.resize(_NumIds, 0);
+    }
+    if (!_Dirty[id])
+    {
+        _Dirty[id] = 1;
+        _DirtyIds.push_back(id);
+    }
+}
+
+bool QuadTreePairCache::SameLeaves(int id, const LeafKey *keys, int count) const
+{
+    return count == _IdLeafCount[id] &&
+           equal(keys, keys + count, _IdLeaves.begin() + id * KNOWN_LEAVES);
+}
+
+void QuadTreePairCache::SetLeaves(int id, const LeafKey *keys, int count)
+{
+    if (count > KNOWN_LEAVES)
+    {
+        _IdLeafCount[id] = -1;
+        return;
+    }
+    copy(keys, keys + count, _IdLeaves.begin() + id * KNOWN_LEAVES);
+    _IdLeafCount[id] = (signed char)count;
+}
+
+void QuadTreePairCache::CollectLeaves(QuadTree &tree)
+{
+    // Same walk as FindPairs, leaves come out in TL, TR, BL, BR order so an
+    // element whose leaves didn't change lists them in the same order.
+    vector<Pending> &stack = _Stack;
+    stack.push_back({QuadTree::ROOT_QUAD_NODE_INDEX,
+                     tree._Bounds.midX, tree._Bounds.midY, tree._Bounds.halfW, tree._Bounds.halfH,
+                     0});
+    _Leaves.clear();
+    _LeafIds.clear();
+    _ElementIds.assign(tree._Elements.size(), -1);
+    fill(_IdElements.begin(), _IdElements.end(), -1);
+    while (stack.size() > 0)
+    {
+        const Pending nd = stack.back();
+        stack.pop_back();
+
+        if (tree._Nodes.IsLeaf(nd.nodeIndex))
+        {
+            if (tree._Nodes.GetCount(nd.nodeIndex) == 0)
+            {
+                continue;
+            }
+            _Leaves.push_back({nd.nodeIndex, {nd.mx, nd.my, nd.depth}, (int)_LeafIds.size()});
+            int elementNodeIndex = tree._Nodes.GetChildren(nd.nodeIndex);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = tree._ElementNodes.GetElementId(elementNodeIndex);
+                elementNodeIndex = tree._ElementNodes.GetNext(elementNodeIndex);
+                const int id = tree._Elements.GetId(elementIndex);
+                GrowIds(id);
+                int *box = &_Boxes[id * 4];
+                tree.GetTestBounds(elementIndex, box[0], box[1], box[2], box[3]);
+                _LeafIds.push_back(id);
+                _ElementIds[elementIndex] = id;
+                _IdElements[id] = elementIndex;
+            }
+            continue;
+        }
+
+        const int child = tree._Nodes.GetChildren(nd.nodeIndex);
+        const int w4 = nd.sx >> 1;
+        const int h4 = nd.sy >> 1;
+        const int l = nd.mx - w4;
+        const int r = nd.mx + w4;
+        const int t = nd.my + h4;
+        const int b = nd.my - h4;
+        stack.push_back({child + 3, r, b, w4, h4, nd.depth + 1});
+        stack.push_back({child + 2, l, b, w4, h4, nd.depth + 1});
+        stack.push_back({child + 1, r, t, w4, h4, nd.depth + 1});
+        stack.push_back({child + 0, l, t, w4, h4, nd.depth + 1});
+    }
+}
+
+void QuadTreePairCache::FindDirty()
+{
+    // Lay out the leaf keys of every id one after the other, then compare
+    // them with last update's.
+    const size_t numIds = _NumIds;
+    // None after a Clear or an update from the tree's notes, any id may
+    // have moved since the last walk.
+    const bool compare = !_PrevLeafStart.empty();
+    _LeafStart.assign(numIds + 1, 0);
+    if (compare)
+    {
+        _PrevLeafStart.resize(numIds + 1, _PrevLeafStart.back());
+    }
+    for (int id : _LeafIds)
+    {
+        _LeafStart[id + 1]++;
+    }
+    for (size_t id = 0; id < numIds; id++)
+    {
+        _LeafStart[id + 1] += _LeafStart[id];
+    }
+    _LeafKeys.resize(_LeafIds.size());
+    for (int leaf = 0; leaf < (int)_Leaves.size(); leaf++)
+    {
+        const int last = leaf + 1 < (int)_Leaves.size() ? _Leaves[leaf + 1].firstId : (int)_LeafIds.size();
+        for (int i = _Leaves[leaf].firstId; i < last; i++)
+        {
+            // Borrow _LeafStart[id] as the write cursor, it is put back below.
+            _LeafKeys[_LeafStart[_LeafIds[i]]++] = _Leaves[leaf].key;
+        }
+    }
+    for (size_t id = numIds; id > 0; id--)
+    {
+        _LeafStart[id] = _LeafStart[id - 1];
+    }
+    _LeafStart[0] = 0;
+
+    _Dirty.assign(numIds, 0);
+    int elements = 0;
+    int dirtyElements = 0;
+    for (size_t id = 0; id < numIds; id++)
+    {
+        const int first = _LeafStart[id];
+        const int count = _LeafStart[id + 1] - first;
+        elements += count > 0;
+        SetLeaves(id, _LeafKeys.data() + first, count);
+        if (!compare)
+        {
+            _Dirty[id] = 1;
+            dirtyElements += count > 0;
+            continue;
+        }
+        const int prevFirst = _PrevLeafStart[id];
+        const int prevCount = _PrevLeafStart[id + 1] - prevFirst;
+        if (count != prevCount ||
+            !equal(_LeafKeys.begin() + first, _LeafKeys.begin() + first + count,
+                   _PrevLeafKeys.begin() + prevFirst))
+        {
+            _Dirty[id] = 1;
+            dirtyElements++;
+        }
+    }
+    _LastStats.elements = elements;
+    _LastStats.dirtyElements = dirtyElements;
+}
+
+void QuadTreePairCache::FindFreshCandidates()
+{
+    _Fresh.clear();
+    for (int leaf = 0; leaf < (int)_Leaves.size(); leaf++)
+    {
+        const int first = _Leaves[leaf].firstId;
+        const int last = leaf + 1 < (int)_Leaves.size() ? _Leaves[leaf + 1].firstId : (int)_LeafIds.size();
+        _LeafDirty.clear();
+        for (int a = first; a < last; a++)
+        {
+            if (_Dirty[_LeafIds[a]])
+            {
+                _LeafDirty.push_back(a);
+            }
+        }
+
+        // Only pairs with a dirty element are fresh. Pair each dirty id with
+        // every clean one and with the dirty ones after it.
+        for (int a : _LeafDirty)
+        {
+            const int A = _LeafIds[a];
+            for (int b = first; b < last; b++)
+            {
+                const int B = _LeafIds[b];
+                if (b != a && (b > a || !_Dirty[B]))
+                {
+                    _Fresh.emplace_back(min(A, B), max(A, B));
+                }
+            }
+        }
+    }
+    // A pair sharing several leaves shows up once per leaf.
+    sort(_Fresh.begin(), _Fresh.end());
+    _Fresh.erase(unique(_Fresh.begin(), _Fresh.end()), _Fresh.end());
+}
+
+void QuadTreePairCache::ApplyLeafChanges(QuadTree &tree)
+{
+    _Dirty.assign(_NumIds, 0);
+    _DirtyIds.clear();
+
+    // Ids leave their old element first, one that moved can come back
+    // further down the list.
+    const vector<int> &changes = tree._leafChanges;
+    for (int elementIndex : changes)
+    {
+        const int id = elementIndex < (int)_ElementIds.size() ? _ElementIds[elementIndex] : -1;
+        if (id < 0)
+        {
+            continue;
+        }
+        MarkDirty(id);
+        if (_IdElements[id] == elementIndex)
+        {
+            _IdElements[id] = -1;
+        }
+        _ElementIds[elementIndex] = -1;
+    }
+    for (int elementIndex : changes)
+    {
+        if (tree._leafChangeStates[elementIndex] != QuadTree::LEAF_PRESENT)
+        {
+            continue;
+        }
+        const int id = tree._Elements.GetId(elementIndex);
+        GrowIds(id);
+        MarkDirty(id);
+        if (elementIndex >= (int)_ElementIds.size())
+        {
+            _ElementIds.resize(max(elementIndex + 1, (int)_ElementIds.size() * 2), -1);
+        }
+        _ElementIds[elementIndex] = id;
+        _IdElements[id] = elementIndex;
+    }
+    tree.ForgetLeafChanges();
+}
+
+void QuadTreePairCache::FindLeaves(QuadTree &tree, int elementIndex)
+{
+    // The leaves it was inserted into, in the order CollectLeaves meets them.
+    const int left = tree._Elements.GetLeft(elementIndex);
+    const int top = tree._Elements.GetTop(elementIndex);
+    const int right = tree._Elements.GetRight(elementIndex);
+    const int bottom = tree._Elements.GetBottom(elementIndex);
+    vector<Pending> &stack = _Stack;
+    stack.push_back({QuadTree::ROOT_QUAD_NODE_INDEX,
+                     tree._Bounds.midX, tree._Bounds.midY, tree._Bounds.halfW, tree._Bounds.halfH,
+                     0});
+    while (stack.size() > 0)
+    {
+        const Pending nd = stack.back();
+        stack.pop_back();
+
+        if (tree._Nodes.IsLeaf(nd.nodeIndex))
+        {
+            _FoundNodes.push_back(nd.nodeIndex);
+            _FoundKeys.push_back({nd.mx, nd.my, nd.depth});
+            continue;
+        }
+
+        const int child = tree._Nodes.GetChildren(nd.nodeIndex);
+        const int w4 = nd.sx >> 1;
+        const int h4 = nd.sy >> 1;
+        const int l = nd.mx - w4;
+        const int r = nd.mx + w4;
+        const int t = nd.my + h4;
+        const int b = nd.my - h4;
+        if (bottom < nd.my)
+        {
+            if (right > nd.mx) // BR
+            {
+                stack.push_back({child + 3, r, b, w4, h4, nd.depth + 1});
+            }
+            if (left <= nd.mx) // BL
+            {
+                stack.push_back({child + 2, l, b, w4, h4, nd.depth + 1});
+            }
+        }
+        if (top >= nd.my)
+        {
+            if (right > nd.mx) // TR
+            {
+                stack.push_back({child + 1, r, t, w4, h4, nd.depth + 1});
+            }
+            if (left <= nd.mx) // TL
+            {
+                stack.push_back({child + 0, l, t, w4, h4, nd.depth + 1});
+            }
+        }
+    }
+}
+
+void QuadTreePairCache::FindLeavesOfDirty(QuadTree &tree)
+{
+    // The notes only say an element was reinserted, most come back to the
+    // leaves they left. Those are clean again.
+    _FoundNodes.clear();
+    _FoundKeys.clear();
+    _FoundStart.clear();
+    int dirty = 0;
+    for (int id : _DirtyIds)
+    {
+        const int elementIndex = _IdElements[id];
+        const int first = (int)_FoundNodes.size();
+        if (elementIndex >= 0)
+        {
+            FindLeaves(tree, elementIndex);
+        }
+        const int count = (int)_FoundNodes.size() - first;
+        if (elementIndex >= 0 && SameLeaves(id, _FoundKeys.data() + first, count))
+        {
+            _Dirty[id] = 0;
+            _FoundNodes.resize(first);
+            _FoundKeys.resize(first);
+            continue;
+        }
+        SetLeaves(id, _FoundKeys.data() + first, count);
+        _DirtyIds[dirty++] = id;
+        _FoundStart.push_back(first);
+    }
+    _DirtyIds.resize(dirty);
+    _FoundStart.push_back((int)_FoundNodes.size());
+}
+
+void QuadTreePairCache::RefreshBoxes(QuadTree &tree)
+{
+    // Elements which stayed in their leaves still moved inside them.
+    int elements = 0;
+    for (size_t id = 0; id < _NumIds; id++)
+    {
+        const int elementIndex = _IdElements[id];
+        if (elementIndex < 0)
+        {
+            continue;
+        }
+        int *box = &_Boxes[id * 4];
+        tree.GetTestBounds(elementIndex, box[0], box[1], box[2], box[3]);
+        elements++;
+    }
+    _LastStats.elements = elements;
+    _LastStats.dirtyElements = (int)_DirtyIds.size();
+}
+
+void QuadTreePairCache::FindFreshCandidatesOfDirty(QuadTree &tree)
+{
+    _Fresh.clear();
+    for (int d = 0; d < (int)_DirtyIds.size(); d++)
+    {
+        const int A = _DirtyIds[d];
+        for (int i = _FoundStart[d]; i < _FoundStart[d + 1]; i++)
+        {
+            int elementNodeIndex = tree._Nodes.GetChildren(_FoundNodes[i]);
+            while (elementNodeIndex != -1)
+            {
+                const int B = tree._Elements.GetId(tree._ElementNodes.GetElementId(elementNodeIndex));
+                elementNodeIndex = tree._ElementNodes.GetNext(elementNodeIndex);
+                // A pair of two dirty ids comes from the lower one.
+                if (B != A && (!_Dirty[B] || A < B))
+                {
+                    _Fresh.emplace_back(min(A, B), max(A, B));
+                }
+            }
+        }
+    }
+    sort(_Fresh.begin(), _Fresh.end());
+    _Fresh.erase(unique(_Fresh.begin(), _Fresh.end()), _Fresh.end());
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <utility>
+#include <vector>
+
+#include "jquad.h"
+
+using namespace std;
+
+// Keeps the intersecting pairs of a QuadTree from one update to the next.
+//
+// Candidates are the pairs sharing a leaf. Only elements whose set of leaves
+// changed since the last update go back to the tree for new candidates, the
+// candidates of everything else carry over and just have their boxes
+// re-tested. The tree notes those elements as it goes (see
+// QuadTree::TrackLeafChanges, turned on by the first update), so only their
+// leaves are looked up. After Clear, BulkBuild, Load or Swap the whole tree is
+// walked once more. Ids must be small non-negative ints (sprite indices),
+// they index flat arrays.
+class QuadTreePairCache
+{
+public:
+    struct UpdateStats
+    {
+        int elements = 0;
+        // Elements which moved to other leaves, appeared or went away.
+        int dirtyElements = 0;
+        int candidates = 0;
+        // Candidates which had to come from the tree this update.
+        int freshCandidates = 0;
+    };
+
+    // Brings the cache up to date with the tree. Afterwards Pairs() is what
+    // QuadTree::FindPairs would return.
+    void Update(QuadTree &tree);
+    // Forgets everything, the next update starts from scratch.
+    void Clear();
+
+    // Intersecting (idA, idB) with idA < idB, sorted.
+    const vector<pair<int, int>> &Pairs() const { return _Pairs; }
+    // Pairs which started intersecting in the last update.
+    const vector<pair<int, int>> &Began() const { return _Began; }
+    // Pairs which stopped intersecting (or lost an element) in the last update.
+    const vector<pair<int, int>> &Ended() const { return _Ended; }
+
+    const UpdateStats &GetLastStats() const { return _LastStats; }
+
+private:
+    // Leaves are told apart by region, node indices get reused.
+    struct LeafKey
+    {
+        int midX, midY, depth;
+        bool operator==(const LeafKey &other) const
+        {
+            return midX == other.midX && midY == other.midY && depth == other.depth;
+        }
+    };
+    struct Pending
+    {
+        int nodeIndex;
+        int mx, my, sx, sy;
+        int depth;
+    };
+    struct Leaf
+    {
+        int nodeIndex;
+        LeafKey key;
+        // Where the leaf's ids start in _LeafIds.
+        int firstId;
+    };
+
+    // Walking the whole tree.
+    void CollectLeaves(QuadTree &tree);
+    void FindDirty();
+    void FindFreshCandidates();
+    // Working off the tree's notes.
+    void ApplyLeafChanges(QuadTree &tree);
+    void FindLeaves(QuadTree &tree, int elementIndex);
+    void FindLeavesOfDirty(QuadTree &tree);
+    void RefreshBoxes(QuadTree &tree);
+    void FindFreshCandidatesOfDirty(QuadTree &tree);
+
+    void GrowIds(int id);
+    void MarkDirty(int id);
+    bool SameLeaves(int id, const LeafKey *keys, int count) const;
+    void SetLeaves(int id, const LeafKey *keys, int count);
+
+    // The tree the last update saw, and its QuadTree::_contentsVersion.
+    const QuadTree *_Tree = nullptr;
+    uint64_t _TreeVersion = 0;
+
+    // Every leaf with elements and, one leaf after the other, their ids.
+    // Only filled by a walk over the whole tree.
+    vector<Pending> _Stack;
+    vector<Leaf> _Leaves;
+    vector<int> _LeafIds;
+    // left, top, right, bottom per id.
+    vector<int> _Boxes;
+
+    // The id of every element index and the element index of every id, -1
+    // for none, as of the last update.
+    vector<int> _ElementIds;
+    vector<int> _IdElements;
+    // The leaves of every id as of the last update, up to KNOWN_LEAVES of
+    // them, with their count or -1 for more. A reinserted element which came
+    // back to the same leaves stays clean.
+    static constexpr int KNOWN_LEAVES = 4;
+    vector<LeafKey> _IdLeaves;
+    vector<signed char> _IdLeafCount;
+
+    // Leaves of every id in traversal order, as offsets into the keys. Empty
+    // after an update off the notes, the next walk compares against nothing.
+    vector<int> _LeafStart;
+    vector<LeafKey> _LeafKeys;
+    vector<int> _PrevLeafStart;
+    vector<LeafKey> _PrevLeafKeys;
+
+    vector<char> _Dirty;
+    vector<int> _DirtyIds;
+    size_t _NumIds = 0;
+    // Leaves of the dirty ids, one id after the other.
+    vector<int> _FoundNodes;
+    vector<LeafKey> _FoundKeys;
+    vector<int> _FoundStart;
+    // Positions in _LeafIds of the dirty ids of one leaf.
+    vector<int> _LeafDirty;
+
+    vector<pair<int, int>> _Candidates;
+    vector<pair<int, int>> _Kept;
+    vector<pair<int, int>> _Fresh;
+
+    vector<pair<int, int>> _Pairs;
+    vector<pair<int, int>> _PrevPairs;
+    vector<pair<int, int>> _Began;
+    vector<pair<int, int>> _Ended;
+    UpdateStats _LastStats;
+};
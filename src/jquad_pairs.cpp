@@ -0,0 +1,140 @@
+#include <limits.h>
+#include <algorithm>
+
+#include "jquad.h"
+#include "jthread_pool.h"
+
+// Leaves handed to a worker at a time. Small enough to balance well, big
+// enough that grabbing a task is noise.
+static const int PAIR_LEAVES_PER_TASK = 32;
+
+void QuadTree::FindPairs(vector<pair<int, int>> &output, ThreadPool *pool)
+{
+    // Collect the leaves worth looking at, together with the points each one
+    // owns. The split rules match FindLeavesList: the mid line belongs to the
+    // left and to the top half.
+    struct Pending
+    {
+        int nodeIndex;
+        int mx, my, sx, sy;
+        int minX, maxX, minY, maxY;
+    };
+    ArenaScope scope(*_arena);
+    ArenaVector<Pending> stack(*_arena);
+    stack.push_back({ROOT_QUAD_NODE_INDEX,
+                     _Bounds.midX, _Bounds.midY, _Bounds.halfW, _Bounds.halfH,
+                     INT_MIN, INT_MAX, INT_MIN, INT_MAX});
+    _pairLeaves.clear();
+    while (stack.size() > 0)
+    {
+        const Pending nd = stack.back();
+        stack.pop_back();
+
+        if (_Nodes.IsLeaf(nd.nodeIndex))
+        {
+            if (_Nodes.GetCount(nd.nodeIndex) > 1)
+            {
+                _pairLeaves.push_back({nd.nodeIndex, nd.minX, nd.maxX, nd.minY, nd.maxY});
+            }
+            continue;
+        }
+
+        const int child = _Nodes.GetChildren(nd.nodeIndex);
+        const int w4 = nd.sx >> 1;
+        const int h4 = nd.sy >> 1;
+        const int l = nd.mx - w4;
+        const int r = nd.mx + w4;
+        const int t = nd.my + h4;
+        const int b = nd.my - h4;
+        // Pushed in reverse so leaves come out in TL, TR, BL, BR order.
+        stack.push_back({child + 3, r, b, w4, h4, nd.mx, nd.maxX, nd.minY, nd.my});
+        stack.push_back({child + 2, l, b, w4, h4, nd.minX, nd.mx, nd.minY, nd.my});
+        stack.push_back({child + 1, r, t, w4, h4, nd.mx, nd.maxX, nd.my, nd.maxY});
+        stack.push_back({child + 0, l, t, w4, h4, nd.minX, nd.mx, nd.my, nd.maxY});
+    }
+
+    const int numWorkers = pool != nullptr ? pool->NumWorkers() : 1;
+    if ((int)_pairBuffers.size() < numWorkers)
+    {
+        _pairBuffers.resize(numWorkers);
+        _pairBoxes.resize(numWorkers);
+    }
+    for (int worker = 0; worker < numWorkers; worker++)
+    {
+        _pairBuffers[worker].clear();
+    }
+
+    // A pair can share several leaves. It is only reported by the leaf which
+    // owns the top-left corner of the overlap, so workers never need to talk
+    // to each other about what they have already seen.
+    auto findInLeaves = [this](int task, int worker)
+    {
+        vector<pair<int, int>> &pairs = _pairBuffers[worker];
+        vector<int> &boxes = _pairBoxes[worker];
+        const int first = task * PAIR_LEAVES_PER_TASK;
+        const int last = min(first + PAIR_LEAVES_PER_TASK, (int)_pairLeaves.size());
+        for (int leaf = first; leaf < last; leaf++)
+        {
+            const PairLeaf &region = _pairLeaves[leaf];
+
+            // id, left, top, right, bottom
+            boxes.clear();
+            int elementNodeIndex = _Nodes.GetChildren(region.nodeIndex);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = _ElementNodes.GetElementId(elementNodeIndex);
+                elementNodeIndex = _ElementNodes.GetNext(elementNodeIndex);
+                int left, top, right, bottom;
+                GetTestBounds(elementIndex, left, top, right, bottom);
+                boxes.push_back(_Elements.GetId(elementIndex));
+                boxes.push_back(left);
+                boxes.push_back(top);
+                boxes.push_back(right);
+                boxes.push_back(bottom);
+            }
+
+            const int count = (int)boxes.size();
+            for (int a = 0; a < count; a += 5)
+            {
+                const int *A = &boxes[a];
+                for (int b = a + 5; b < count; b += 5)
+                {
+                    const int *B = &boxes[b];
+                    if (!Intersects(A[1], A[2], A[3], A[4], B[1], B[2], B[3], B[4]))
+                    {
+                        continue;
+                    }
+                    const int ownerX = max(A[1], B[1]);
+                    const int ownerY = min(A[2], B[2]);
+                    if (ownerX <= region.minX || ownerX > region.maxX ||
+                        ownerY < region.minY || ownerY >= region.maxY)
+                    {
+                        continue;
+                    }
+                    pairs.emplace_back(min(A[0], B[0]), max(A[0], B[0]));
+                }
+            }
+        }
+    };
+
+    const int numTasks = ((int)_pairLeaves.size() + PAIR_LEAVES_PER_TASK - 1) / PAIR_LEAVES_PER_TASK;
+    if (pool != nullptr)
+    {
+        pool->ParallelFor(numTasks, findInLeaves);
+    }
+    else
+    {
+        for (int task = 0; task < numTasks; task++)
+        {
+            findInLeaves(task, 0);
+        }
+    }
+
+    // Which worker found a pair depends on timing, the sorted order doesn't.
+    const size_t firstOutput = output.size();
+    for (int worker = 0; worker < numWorkers; worker++)
+    {
+        output.insert(output.end(), _pairBuffers[worker].begin(), _pairBuffers[worker].end());
+    }
+    sort(output.begin() + firstOutput, output.end());
+}
@@ -0,0 +1,82 @@
+#include "jquad_rebuild.h"
+
+QuadTreeRebuilder::QuadTreeRebuilder()
+    : _Worker(&QuadTreeRebuilder::Run, this) {}
+
+QuadTreeRebuilder::~QuadTreeRebuilder()
+{
+    {
+        lock_guard<mutex> lock(_Mutex);
+        _Quit = true;
+    }
+    _Wake.notify_one();
+    _Worker.join();
+}
+
+void QuadTreeRebuilder::Start(QuadTree *tree,
+                              vector<int> *ids,
+                              vector<Rect> *boxes,
+                              vector<int> *handles)
+{
+    {
+        unique_lock<mutex> lock(_Mutex);
+        // Only one rebuild in flight at a time.
+        _Done.wait(lock, [this]
+                   { return !_Busy; });
+        _Tree = tree;
+        _Ids = ids;
+        _Boxes = boxes;
+        _Handles = handles;
+        _Busy = true;
+        _Pending = true;
+    }
+    _Wake.notify_one();
+}
+
+bool QuadTreeRebuilder::Wait()
+{
+    unique_lock<mutex> lock(_Mutex);
+    if (!_Pending)
+    {
+        return false;
+    }
+    _Done.wait(lock, [this]
+               { return !_Busy; });
+    _Pending = false;
+    return true;
+}
+
+void QuadTreeRebuilder::Run()
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(_Mutex);
+            _Wake.wait(lock, [this]
+                       { return _Quit || _Busy; });
+            if (_Quit)
+            {
+                return;
+            }
+        }
+
+        QuadTree *tree = _Tree;
+        vector<int> &ids = *_Ids;
+        vector<Rect> &boxes = *_Boxes;
+        vector<int> &handles = *_Handles;
+
+        // No pool, the scene's one is busy with the frame we run next to.
+        tree->BulkBuild(ids, boxes);
+        handles.resize(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            handles[i] = (int)i;
+        }
+
+        {
+            lock_guard<mutex> lock(_Mutex);
+            _Busy = false;
+        }
+        _Done.notify_all();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jmath.h"
+#include "jquad.h"
+
+using namespace std;
+
+// Rebuilds a QuadTree from scratch on a background thread.
+//
+// The caller hands over a tree plus the ids and boxes to insert, and must
+// leave all of them alone until Wait() returns. Nothing else is shared with
+// the worker, so the caller is free to keep using any other tree meanwhile.
+class QuadTreeRebuilder
+{
+public:
+    QuadTreeRebuilder();
+    ~QuadTreeRebuilder();
+
+    // 'handles' receives the element index of every box, in the same order.
+    void Start(QuadTree *tree,
+               vector<int> *ids,
+               vector<Rect> *boxes,
+               vector<int> *handles);
+
+    // Blocks until the last Start() has finished. Returns false if nothing
+    // was started since the previous Wait().
+    bool Wait();
+
+private:
+    void Run();
+
+    mutex _Mutex;
+    condition_variable _Wake;
+    condition_variable _Done;
+    bool _Pending = false;
+    bool _Busy = false;
+    bool _Quit = false;
+
+    QuadTree *_Tree = nullptr;
+    vector<int> *_Ids = nullptr;
+    vector<Rect> *_Boxes = nullptr;
+    vector<int> *_Handles = nullptr;
+
+    // Last, so everything the worker touches is constructed before it starts.
+    thread _Worker;
+};
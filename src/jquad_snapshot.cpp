@@ -0,0 +1,371 @@
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <thread>
+#include <tuple>
+
+#include "jquad_snapshot.h"
+
+// ---------------------------------------------------------------------------------
+// SnapshotIntList
+// ---------------------------------------------------------------------------------
+template <class List>
+int SnapshotIntList::CopyFrom(const List &live, const SnapshotIntList *previous)
+{
+    num_fields = List::num_fields;
+    num = live.num;
+    free_element = live.free_element;
+
+    // Lists not laid out as plain ints are converted a page at a time.
+    int converted[page_ints];
+    const int numInts = live.num * num_fields;
+    const int numPages = (numInts + page_ints - 1) >> page_shift;
+    pages.resize(numPages);
+    owners.resize(numPages);
+
+    int pagesCopied = 0;
+    for (int p = 0; p < numPages; p++)
+    {
+        const int start = p << page_shift;
+        const int count = min((int)page_ints, numInts - start);
+        const int *src = converted;
+        if constexpr (List::packed_ints)
+        {
+            src = live.ints() + start;
+        }
+        else
+        {
+            live.copy_ints(start, count, converted);
+        }
+
+        // Unused tails are zero filled, so comparing the live range is
+        // enough even if the previous page held fewer ints.
+        if (previous != nullptr &&
+            p < (int)previous->pages.size() &&
+            memcmp(previous->pages[p], src, count * sizeof(int)) == 0)
+        {
+            owners[p] = previous->owners[p];
+            pages[p] = previous->pages[p];
+            continue;
+        }
+
+        int *page = new int[page_ints];
+        memcpy(page, src, count * sizeof(int));
+        memset(page + count, 0, (page_ints - count) * sizeof(int));
+        owners[p] = shared_ptr<int>(page, default_delete<int[]>());
+        pages[p] = page;
+        pagesCopied++;
+    }
+    return pagesCopied;
+}
+
+// The exact bounds of a tree, paged like one of its lists.
+struct ExactBoundsList
+{
+    static constexpr int num_fields = 4;
+    static constexpr bool packed_ints = true;
+    int num;
+    int free_element;
+    const int *data;
+
+    const int *ints() const { return data; }
+};
+
+// ---------------------------------------------------------------------------------
+// QuadTreeSnapshot
+// ---------------------------------------------------------------------------------
+void QuadTreeSnapshot::GetTestBounds(int elementIndex, int &left, int &top, int &right, int &bottom) const
+{
+    if (_ExactBounds.num > 0)
+    {
+        left = _ExactBounds.get(elementIndex, 0);
+        top = _ExactBounds.get(elementIndex, 1);
+        right = _ExactBounds.get(elementIndex, 2);
+        bottom = _ExactBounds.get(elementIndex, 3);
+        return;
+    }
+    left = _Elements.get(elementIndex, QuadElementIntList::left);
+    top = _Elements.get(elementIndex, QuadElementIntList::top);
+    right = _Elements.get(elementIndex, QuadElementIntList::right);
+    bottom = _Elements.get(elementIndex, QuadElementIntList::bottom);
+}
+
+Rect QuadTreeSnapshot::GetRect(int elementIndex) const
+{
+    int l, t, r, b;
+    GetTestBounds(elementIndex, l, t, r, b);
+    return Rect((l + r) / 2, (t + b) / 2, abs(r - l), abs(t - b));
+}
+
+void QuadTreeSnapshot::Query(Rect query, vector<int> &output) const
+{
+    const int left = query.L();
+    const int top = query.T();
+    const int right = query.R();
+    const int bottom = query.B();
+    const size_t firstOutput = output.size();
+
+    LeavesListIntList stack;
+    stack.Add(QuadTree::ROOT_QUAD_NODE_INDEX, 0, _Bounds.midX, _Bounds.midY, _Bounds.halfW, _Bounds.halfH);
+    while (stack.size() > 0)
+    {
+        const int stack_index = stack.size() - 1;
+        const int nd_mx = stack.GetMx(stack_index);
+        const int nd_my = stack.GetMy(stack_index);
+        const int nd_sx = stack.GetSx(stack_index);
+        const int nd_sy = stack.GetSy(stack_index);
+        const int currentIndex = stack.GetIndex(stack_index);
+        const int depth = stack.GetDepth(stack_index);
+        stack.pop_back();
+
+        if (IsLeaf(currentIndex))
+        {
+            int elementNodeIndex = GetChildren(currentIndex);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = GetElementId(elementNodeIndex);
+                elementNodeIndex = GetNext(elementNodeIndex);
+                int eLeft, eTop, eRight, eBottom;
+                GetTestBounds(elementIndex, eLeft, eTop, eRight, eBottom);
+                if (left < eRight &&
+                    right > eLeft &&
+                    top > eBottom &&
+                    bottom < eTop)
+                {
+                    output.push_back(elementIndex);
+                }
+            }
+            continue;
+        }
+
+        const int child = GetChildren(currentIndex);
+        const int w4 = nd_sx >> 1;
+        const int h4 = nd_sy >> 1;
+        const int l = nd_mx - w4;
+        const int r = nd_mx + w4;
+        const int t = nd_my + h4;
+        const int b = nd_my - h4;
+        if (top >= nd_my)
+        {
+            if (left <= nd_mx) // TL
+            {
+                stack.Add(child + 0, depth + 1, l, t, w4, h4);
+            }
+            if (right > nd_mx) // TR
+            {
+                stack.Add(child + 1, depth + 1, r, t, w4, h4);
+            }
+        }
+        if (bottom < nd_my)
+        {
+            if (left <= nd_mx) // BL
+            {
+                stack.Add(child + 2, depth + 1, l, b, w4, h4);
+            }
+            if (right > nd_mx) // BR
+            {
+                stack.Add(child + 3, depth + 1, r, b, w4, h4);
+            }
+        }
+    }
+
+    // Elements spanning several leaves were found more than once. Readers
+    // can't share a 'seen' table, so dedupe the (small) result instead.
+    sort(output.begin() + firstOutput, output.end());
+    output.erase(unique(output.begin() + firstOutput, output.end()), output.end());
+}
+
+void QuadTreeSnapshot::Traverse(
+    void *userData,
+    QueryCallback branchCallback,
+    QueryCallback leafCallback) const
+{
+    QuadRect bounds = _Bounds;
+    vector<tuple<int, Rect, int>> stack;
+    stack.emplace_back(QuadTree::ROOT_QUAD_NODE_INDEX, bounds.ToRect(), 0);
+    while (stack.size() > 0)
+    {
+        auto [nodeIndex, rect, depth] = stack.back();
+        stack.pop_back();
+
+        if (IsLeaf(nodeIndex))
+        {
+            if (leafCallback != nullptr)
+            {
+                leafCallback(userData, this, nodeIndex, rect, depth);
+            }
+        }
+        else
+        {
+            if (branchCallback != nullptr)
+            {
+                branchCallback(userData, this, nodeIndex, rect, depth);
+            }
+            const int child = GetChildren(nodeIndex);
+            stack.emplace_back(child + 0, rect.TL(), depth + 1);
+            stack.emplace_back(child + 1, rect.TR(), depth + 1);
+            stack.emplace_back(child + 2, rect.BL(), depth + 1);
+            stack.emplace_back(child + 3, rect.BR(), depth + 1);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------
+// QuadTreeSnapshotHandle
+// ---------------------------------------------------------------------------------
+QuadTreeSnapshotHandle::QuadTreeSnapshotHandle(QuadTreeSnapshotHandle &&other)
+    : _Owner(other._Owner), _Slot(other._Slot), _Snapshot(other._Snapshot)
+{
+    other._Owner = nullptr;
+    other._Slot = -1;
+    other._Snapshot = nullptr;
+}
+
+QuadTreeSnapshotHandle &QuadTreeSnapshotHandle::operator=(QuadTreeSnapshotHandle &&other)
+{
+    if (this != &other)
+    {
+        Release();
+        _Owner = other._Owner;
+        _Slot = other._Slot;
+        _Snapshot = other._Snapshot;
+        other._Owner = nullptr;
+        other._Slot = -1;
+        other._Snapshot = nullptr;
+    }
+    return *this;
+}
+
+QuadTreeSnapshotHandle::~QuadTreeSnapshotHandle()
+{
+    Release();
+}
+
+void QuadTreeSnapshotHandle::Release()
+{
+    if (_Owner != nullptr)
+    {
+        _Owner->Release(_Slot);
+    }
+    _Owner = nullptr;
+    _Slot = -1;
+    _Snapshot = nullptr;
+}
+
+// ---------------------------------------------------------------------------------
+// QuadTreeSnapshots
+// ---------------------------------------------------------------------------------
+QuadTreeSnapshots::QuadTreeSnapshots(QuadTree &tree)
+    : _Tree(tree)
+{
+    Publish();
+}
+
+QuadTreeSnapshots::~QuadTreeSnapshots()
+{
+    for (int i = 0; i < MAX_READERS; i++)
+    {
+        assert(!_Readers[i].inUse.load() && "snapshot handle outlived its QuadTreeSnapshots");
+    }
+    for (auto [epoch, snapshot] : _Retired)
+    {
+        delete snapshot;
+    }
+    delete _Current.load();
+}
+
+void QuadTreeSnapshots::Publish()
+{
+    QuadTreeSnapshot *previous = _Current.load();
+    QuadTreeSnapshot *next = new QuadTreeSnapshot();
+    next->_Bounds = _Tree._Bounds;
+    next->_Version = _NextVersion++;
+
+    int pagesCopied = 0;
+    pagesCopied += next->_Nodes.CopyFrom(_Tree._Nodes, previous ? &previous->_Nodes : nullptr);
+    pagesCopied += next->_Elements.CopyFrom(_Tree._Elements, previous ? &previous->_Elements : nullptr);
+    pagesCopied += next->_ElementNodes.CopyFrom(_Tree._ElementNodes, previous ? &previous->_ElementNodes : nullptr);
+    if (_Tree._keepExact)
+    {
+        const int numExact = min(_Tree._Elements.size(), (int)_Tree._exactBounds.size() / 4);
+        const ExactBoundsList exact = {numExact, -1, _Tree._exactBounds.data()};
+        pagesCopied += next->_ExactBounds.CopyFrom(exact, previous ? &previous->_ExactBounds : nullptr);
+    }
+    _LastStats.pagesCopied = pagesCopied;
+    _LastStats.pagesShared = (int)(next->_Nodes.pages.size() +
+                                   next->_Elements.pages.size() +
+                                   next->_ElementNodes.pages.size() +
+                                   next->_ExactBounds.pages.size()) -
+                             pagesCopied;
+
+    // Readers which loaded 'previous' announced an epoch no later than the
+    // one returned here, anyone announcing afterwards already sees 'next'.
+    _Current.store(next);
+    if (previous != nullptr)
+    {
+        const uint64_t retiredEpoch = _GlobalEpoch.fetch_add(1);
+        _Retired.emplace_back(retiredEpoch, previous);
+    }
+    Reclaim();
+}
+
+QuadTreeSnapshotHandle QuadTreeSnapshots::Acquire()
+{
+    // Spread threads over the slots so they rarely race for the same one.
+    const int start = (int)(hash<thread::id>()(this_thread::get_id()) % MAX_READERS);
+    while (true)
+    {
+        for (int i = 0; i < MAX_READERS; i++)
+        {
+            const int slot = (start + i) % MAX_READERS;
+            bool expected = false;
+            if (_Readers[slot].inUse.load(memory_order_relaxed) ||
+                !_Readers[slot].inUse.compare_exchange_strong(expected, true))
+            {
+                continue;
+            }
+
+            // Announce first, then load. Both are seq_cst so the writer either
+            // sees this epoch or this reader sees the newer snapshot.
+            _Readers[slot].epoch.store(_GlobalEpoch.load());
+            const QuadTreeSnapshot *snapshot = _Current.load();
+            return QuadTreeSnapshotHandle(this, slot, snapshot);
+        }
+        this_thread::yield();
+    }
+}
+
+void QuadTreeSnapshots::Release(int slot)
+{
+    _Readers[slot].epoch.store(0);
+    _Readers[slot].inUse.store(false);
+}
+
+void QuadTreeSnapshots::Reclaim()
+{
+    uint64_t oldestActive = UINT64_MAX;
+    for (int i = 0; i < MAX_READERS; i++)
+    {
+        const uint64_t epoch = _Readers[i].epoch.load();
+        if (epoch != 0 && epoch < oldestActive)
+        {
+            oldestActive = epoch;
+        }
+    }
+
+    // Retired in epoch e means only readers which entered in an epoch <= e
+    // could still be holding it.
+    size_t kept = 0;
+    for (size_t i = 0; i < _Retired.size(); i++)
+    {
+        if (_Retired[i].first < oldestActive)
+        {
+            delete _Retired[i].second;
+        }
+        else
+        {
+            _Retired[kept++] = _Retired[i];
+        }
+    }
+    _Retired.resize(kept);
+}
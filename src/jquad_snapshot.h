@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "jmath.h"
+#include "jint_list.h"
+#include "jquad.h"
+
+using namespace std;
+
+// Immutable copy of one of the tree's lists, read back as if it were a
+// JIntList (field f of element n is int n * num_fields + f). The ints are
+// split into fixed size pages and a page is shared with the previous
+// version whenever its contents did not change, so publishing only pays for
+// the blocks the writer touched.
+class SnapshotIntList
+{
+public:
+    enum
+    {
+        page_shift = 10,
+        page_ints = 1 << page_shift,
+        page_mask = page_ints - 1
+    };
+
+    int num_fields = 0;
+    int num = 0;
+    int free_element = -1;
+
+    // Raw page pointers for readers, kept alive by 'owners'.
+    vector<const int *> pages;
+    vector<shared_ptr<int>> owners;
+
+    int get(int n, int field) const
+    {
+        const int pos = n * num_fields + field;
+        return pages[pos >> page_shift][pos & page_mask];
+    }
+
+    // Copies 'live' into this list, sharing pages with 'previous' (may be null).
+    // Returns the number of pages which had to be copied.
+    template <class List>
+    int CopyFrom(const List &live, const SnapshotIntList *previous);
+};
+
+// Read only view of a QuadTree at the time it was published.
+// Element and node indices are the same as in the live tree at that time.
+class QuadTreeSnapshot
+{
+public:
+    using QueryCallback = void(
+        void *user_data,
+        const QuadTreeSnapshot *snapshot,
+        int nodeIndex,
+        Rect nodeRect,
+        int depth);
+
+    QuadRect _Bounds;
+    SnapshotIntList _Elements;
+    SnapshotIntList _ElementNodes;
+    SnapshotIntList _Nodes;
+    // The exact bounds as left, top, right, bottom when the tree keeps fat
+    // boxes, see QuadTree::SetFatMargin. Empty otherwise.
+    SnapshotIntList _ExactBounds;
+    uint64_t _Version = 0;
+
+    // Appends the indices of every element intersecting the query, each once.
+    void Query(Rect query, vector<int> &output) const;
+
+    // Same traversal order and callbacks as QuadTree::Traverse.
+    void Traverse(void *userData,
+                  QueryCallback branchCallback,
+                  QueryCallback leafCallback) const;
+
+    int GetId(int elementIndex) const { return _Elements.get(elementIndex, QuadElementIntList::ID); }
+    // The exact bounds when kept, otherwise the stored ones.
+    Rect GetRect(int elementIndex) const;
+
+    bool IsLeaf(int nodeIndex) const { return _Nodes.get(nodeIndex, QuadNodesIntList::count) >= 0; }
+    int GetChildren(int nodeIndex) const { return _Nodes.get(nodeIndex, QuadNodesIntList::children); }
+    int GetNext(int elementNodeIndex) const { return _ElementNodes.get(elementNodeIndex, QuadElementNodeIntList::next); }
+    int GetElementId(int elementNodeIndex) const { return _ElementNodes.get(elementNodeIndex, QuadElementNodeIntList::elementId); }
+
+private:
+    // Same as QuadTree::GetTestBounds.
+    void GetTestBounds(int elementIndex, int &left, int &top, int &right, int &bottom) const;
+};
+
+class QuadTreeSnapshots;
+
+// Keeps a snapshot alive until released (or destroyed). Move only.
+class QuadTreeSnapshotHandle
+{
+public:
+    QuadTreeSnapshotHandle() = default;
+    QuadTreeSnapshotHandle(QuadTreeSnapshotHandle &&other);
+    QuadTreeSnapshotHandle &operator=(QuadTreeSnapshotHandle &&other);
+    QuadTreeSnapshotHandle(const QuadTreeSnapshotHandle &) = delete;
+    QuadTreeSnapshotHandle &operator=(const QuadTreeSnapshotHandle &) = delete;
+    ~QuadTreeSnapshotHandle();
+
+    void Release();
+
+    const QuadTreeSnapshot *operator->() const { return _Snapshot; }
+    const QuadTreeSnapshot &operator*() const { return *_Snapshot; }
+    explicit operator bool() const { return _Snapshot != nullptr; }
+
+private:
+    friend class QuadTreeSnapshots;
+    QuadTreeSnapshotHandle(QuadTreeSnapshots *owner, int slot, const QuadTreeSnapshot *snapshot)
+        : _Owner(owner), _Slot(slot), _Snapshot(snapshot) {}
+
+    QuadTreeSnapshots *_Owner = nullptr;
+    int _Slot = -1;
+    const QuadTreeSnapshot *_Snapshot = nullptr;
+};
+
+// Publishes versions of a QuadTree for concurrent readers.
+//
+// One writer thread mutates the tree and calls Publish() between batches of
+// changes. Any number of reader threads call Acquire() and use the returned
+// snapshot without taking a lock. Old versions are reclaimed with epochs:
+// a reader announces the epoch it entered in, and a retired version is only
+// freed once every active reader entered after it was retired.
+//
+// All handles must be released before this object is destroyed.
+class QuadTreeSnapshots
+{
+public:
+    static const int MAX_READERS = 64;
+
+    struct PublishStats
+    {
+        int pagesCopied = 0;
+        int pagesShared = 0;
+    };
+
+    explicit QuadTreeSnapshots(QuadTree &tree);
+    ~QuadTreeSnapshots();
+
+    // Writer only. Makes the current state of the tree visible to readers
+    // and frees versions no reader can still see.
+    void Publish();
+
+    // Any thread. Blocks only if every reader slot is taken.
+    QuadTreeSnapshotHandle Acquire();
+
+    // Writer only.
+    const PublishStats &GetLastPublishStats() const { return _LastStats; }
+    int NumRetired() const { return (int)_Retired.size(); }
+
+private:
+    friend class QuadTreeSnapshotHandle;
+    void Release(int slot);
+    void Reclaim();
+
+    struct alignas(64) ReaderSlot
+    {
+        atomic<bool> inUse{false};
+        // 0 while idle, otherwise the epoch the reader entered in.
+        atomic<uint64_t> epoch{0};
+    };
+
+    QuadTree &_Tree;
+    atomic<QuadTreeSnapshot *> _Current{nullptr};
+    atomic<uint64_t> _GlobalEpoch{1};
+    ReaderSlot _Readers[MAX_READERS];
+
+    // (epoch retired in, version) pairs. Writer only.
+    vector<pair<uint64_t, QuadTreeSnapshot *>> _Retired;
+    uint64_t _NextVersion = 1;
+    PublishStats _LastStats;
+};
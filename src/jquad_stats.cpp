@@ -0,0 +1,64 @@
+#include "jquad.h"
+
+template <class List>
+static QuadListStats listStats(const List &list)
+{
+    QuadListStats stats;
+    stats.capacity = list.cap;
+    stats.size = list.size();
+    stats.freeSlots = list.num_free;
+    stats.bytesReserved = (size_t)list.cap * List::element_size();
+    stats.bytesUsed = (size_t)(list.size() - list.num_free) * List::element_size();
+    return stats;
+}
+
+QuadTreeMemoryStats QuadTree::GetMemoryStats()
+{
+    QuadTreeMemoryStats stats;
+    stats.elements = listStats(_Elements);
+    stats.elementNodes = listStats(_ElementNodes);
+    stats.nodes = listStats(_Nodes);
+    stats.exactBoundsBytes = _exactBounds.capacity() * sizeof(int);
+    stats.bytesReserved = stats.elements.bytesReserved +
+                          stats.elementNodes.bytesReserved +
+                          stats.nodes.bytesReserved +
+                          stats.exactBoundsBytes;
+    stats.bytesUsed = stats.elements.bytesUsed +
+                      stats.elementNodes.bytesUsed +
+                      stats.nodes.bytesUsed +
+                      (_keepExact ? (size_t)(_Elements.size() - _Elements.num_free) * 4 * sizeof(int) : 0);
+
+    const int liveElements = _Elements.size() - _Elements.num_free;
+    const int liveElementNodes = _ElementNodes.size() - _ElementNodes.num_free;
+    stats.duplication = liveElements > 0 ? (float)liveElementNodes / liveElements : 0.0f;
+
+    // Free node slots keep stale counts, so walk down from the root rather
+    // than scanning the list.
+    ArenaScope scope(*_arena);
+    ArenaVector<int> stack(*_arena);
+    stack.reserve(64);
+    stack.push_back(ROOT_QUAD_NODE_INDEX);
+    while (stack.size() > 0)
+    {
+        const int nodeIndex = stack.back();
+        stack.pop_back();
+        if (_Nodes.IsBranch(nodeIndex))
+        {
+            const int child = _Nodes.GetChildren(nodeIndex);
+            for (int i = 0; i < 4; i++)
+            {
+                stack.push_back(child + i);
+            }
+            continue;
+        }
+
+        int bucket = 0;
+        for (int count = _Nodes.GetCount(nodeIndex); count > 0 && bucket < QuadTreeMemoryStats::HISTOGRAM_BUCKETS - 1; count >>= 1)
+        {
+            bucket++;
+        }
+        stats.leafHistogram[bucket]++;
+        stats.leaves++;
+    }
+    return stats;
+}
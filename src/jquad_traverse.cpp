@@ -0,0 +1,94 @@
+#include <mutex>
+#include <tuple>
+
+#include "jquad.h"
+#include "jthread_pool.h"
+
+struct ParallelTraverseState
+{
+    QuadTree *tree;
+    void *userData;
+    QuadTree::TraverseCallback branchCallback;
+    QuadTree::TraverseCallback leafCallback;
+    ThreadPool *pool;
+    int grainSize;
+    mutex callbackLock;
+};
+
+static void invoke(ParallelTraverseState &state,
+                   const QuadTree::TraverseCallback &callback,
+                   int nodeIndex, Rect rect, int depth, int worker)
+{
+    if (callback.callback == nullptr)
+    {
+        return;
+    }
+    if (callback.threadSafe)
+    {
+        callback.callback(state.userData, state.tree, nodeIndex, rect, depth, worker);
+    }
+    else
+    {
+        lock_guard<mutex> lock(state.callbackLock);
+        callback.callback(state.userData, state.tree, nodeIndex, rect, depth, worker);
+    }
+}
+
+static void traverseSubtree(ParallelTraverseState &state, int rootIndex, Rect rootRect, int rootDepth, int worker)
+{
+    QuadTree *tree = state.tree;
+    vector<tuple<int, Rect, int>> stack;
+    stack.emplace_back(rootIndex, rootRect, rootDepth);
+    int visited = 0;
+    while (stack.size() > 0)
+    {
+        auto [nodeIndex, rect, depth] = stack.back();
+        stack.pop_back();
+
+        if (tree->_Nodes.IsLeaf(nodeIndex))
+        {
+            invoke(state, state.leafCallback, nodeIndex, rect, depth, worker);
+        }
+        else
+        {
+            invoke(state, state.branchCallback, nodeIndex, rect, depth, worker);
+            const int child = tree->_Nodes.GetChildren(nodeIndex);
+            stack.emplace_back(child + 0, rect.TL(), depth + 1);
+            stack.emplace_back(child + 1, rect.TR(), depth + 1);
+            stack.emplace_back(child + 2, rect.BL(), depth + 1);
+            stack.emplace_back(child + 3, rect.BR(), depth + 1);
+        }
+
+        // Keep the node on top for ourselves, the rest are up for grabs.
+        if (++visited >= state.grainSize && stack.size() > 1)
+        {
+            for (size_t i = 0; i + 1 < stack.size(); i++)
+            {
+                auto [spawnIndex, spawnRect, spawnDepth] = stack[i];
+                state.pool->Spawn(worker, [&state, spawnIndex, spawnRect, spawnDepth](int thief)
+                                  { traverseSubtree(state, spawnIndex, spawnRect, spawnDepth, thief); });
+            }
+            stack.erase(stack.begin(), stack.end() - 1);
+            visited = 0;
+        }
+    }
+}
+
+void QuadTree::ParallelTraverse(
+    void *userData,
+    TraverseCallback branchCallback,
+    TraverseCallback leafCallback,
+    ThreadPool &pool,
+    int grainSize)
+{
+    ParallelTraverseState state;
+    state.tree = this;
+    state.userData = userData;
+    state.branchCallback = branchCallback;
+    state.leafCallback = leafCallback;
+    state.pool = &pool;
+    state.grainSize = grainSize < 1 ? 1 : grainSize;
+
+    pool.RunTasks([&](int worker)
+                  { traverseSubtree(state, ROOT_QUAD_NODE_INDEX, _Bounds.ToRect(), 0, worker); });
+}
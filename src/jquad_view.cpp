@@ -0,0 +1,384 @@
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <tuple>
+#include <unordered_set>
+
+#include "jquad_view.h"
+#include "jquad_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+QuadTreeView::~QuadTreeView()
+{
+    Close();
+}
+
+bool QuadTreeView::Open(const char *path)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    void *data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    _File = file;
+    _Mapping = mapping;
+    if (data == nullptr)
+    {
+        Close();
+        return false;
+    }
+    _Data = (const unsigned char *)data;
+    _Size = (uint64_t)size.QuadPart;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // The mapping keeps the file alive.
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    _Data = (const unsigned char *)data;
+    _Size = (uint64_t)info.st_size;
+#endif
+
+    QuadFileHeader header;
+    if (_Size < sizeof(header))
+    {
+        Close();
+        return false;
+    }
+    memcpy(&header, _Data, sizeof(header));
+    if (!CheckQuadFileHeader(header, _Size))
+    {
+        Close();
+        return false;
+    }
+
+    _Bounds = QuadRect(header.midX, header.midY, header.halfW, header.halfH);
+    _Nodes.num = header.nodes.num;
+    for (int c = 0; c < QuadNodesIntList::num_columns; c++)
+    {
+        _Nodes.columns[c] = _Data + header.nodes.columnOffsets[c];
+    }
+    _Elements.num = header.elements.num;
+    for (int c = 0; c < QuadElementIntList::num_columns; c++)
+    {
+        _Elements.columns[c] = _Data + header.elements.columnOffsets[c];
+    }
+    _ElementNodes.num = header.elementNodes.num;
+    for (int c = 0; c < QuadElementNodeIntList::num_columns; c++)
+    {
+        _ElementNodes.columns[c] = _Data + header.elementNodes.columnOffsets[c];
+    }
+    _NumExactBounds = header.keepExact ? header.numExactBounds : 0;
+    _ExactBounds = _NumExactBounds > 0 ? (const int *)(_Data + header.exactBoundsOffset) : nullptr;
+    if (!CheckLinks())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool QuadTreeView::CheckLinks() const
+{
+    vector<char> seenNodes(_Nodes.num, 0);
+    vector<char> seenElementNodes(_ElementNodes.num, 0);
+    vector<int> stack;
+    stack.push_back(QuadTree::ROOT_QUAD_NODE_INDEX);
+    seenNodes[QuadTree::ROOT_QUAD_NODE_INDEX] = 1;
+    while (stack.size() > 0)
+    {
+        const int nodeIndex = stack.back();
+        stack.pop_back();
+
+        const int child = GetChildren(nodeIndex);
+        if (IsLeaf(nodeIndex))
+        {
+            for (int elementNodeIndex = child; elementNodeIndex != -1; elementNodeIndex = GetNext(elementNodeIndex))
+            {
+                if (elementNodeIndex < 0 || elementNodeIndex >= _ElementNodes.num ||
+                    seenElementNodes[elementNodeIndex])
+                {
+                    return false;
+                }
+                seenElementNodes[elementNodeIndex] = 1;
+                const int elementIndex = GetElementId(elementNodeIndex);
+                if (elementIndex < 0 || elementIndex >= _Elements.num)
+                {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        if (child < 0 || child > _Nodes.num - 4)
+        {
+            return false;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            if (seenNodes[child + i])
+            {
+                return false;
+            }
+            seenNodes[child + i] = 1;
+            stack.push_back(child + i);
+        }
+    }
+    return true;
+}
+
+void QuadTreeView::Close()
+{
+#ifdef _WIN32
+    if (_Data != nullptr)
+    {
+        UnmapViewOfFile(_Data);
+    }
+    if (_Mapping != nullptr)
+    {
+        CloseHandle(_Mapping);
+    }
+    if (_File != nullptr)
+    {
+        CloseHandle(_File);
+    }
+#else
+    if (_Data != nullptr)
+    {
+        munmap((void *)_Data, (size_t)_Size);
+    }
+#endif
+    _Data = nullptr;
+    _Size = 0;
+    _File = nullptr;
+    _Mapping = nullptr;
+    _Nodes = RecordView<QuadNodesIntList>();
+    _Elements = RecordView<QuadElementIntList>();
+    _ElementNodes = RecordView<QuadElementNodeIntList>();
+    _ExactBounds = nullptr;
+    _NumExactBounds = 0;
+}
+
+void QuadTreeView::GetTestBounds(int elementIndex, int &left, int &top, int &right, int &bottom) const
+{
+    if (elementIndex < _NumExactBounds)
+    {
+        const int *bounds = &_ExactBounds[elementIndex * 4];
+        left = bounds[0];
+        top = bounds[1];
+        right = bounds[2];
+        bottom = bounds[3];
+        return;
+    }
+    left = _Elements.get<QuadElementIntList::left>(elementIndex);
+    top = _Elements.get<QuadElementIntList::top>(elementIndex);
+    right = _Elements.get<QuadElementIntList::right>(elementIndex);
+    bottom = _Elements.get<QuadElementIntList::bottom>(elementIndex);
+}
+
+Rect QuadTreeView::GetRect(int elementIndex) const
+{
+    int l, t, r, b;
+    GetTestBounds(elementIndex, l, t, r, b);
+    return Rect((l + r) / 2, (t + b) / 2, abs(r - l), abs(t - b));
+}
+
+void QuadTreeView::Query(Rect query, vector<int> &output) const
+{
+    const int left = query.L();
+    const int top = query.T();
+    const int right = query.R();
+    const int bottom = query.B();
+    const size_t firstOutput = output.size();
+
+    vector<pair<int, QuadRect>> stack;
+    stack.emplace_back(QuadTree::ROOT_QUAD_NODE_INDEX, _Bounds);
+    while (stack.size() > 0)
+    {
+        auto [nodeIndex, rect] = stack.back();
+        stack.pop_back();
+
+        if (IsLeaf(nodeIndex))
+        {
+            int elementNodeIndex = GetChildren(nodeIndex);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = GetElementId(elementNodeIndex);
+                elementNodeIndex = GetNext(elementNodeIndex);
+                int eLeft, eTop, eRight, eBottom;
+                GetTestBounds(elementIndex, eLeft, eTop, eRight, eBottom);
+                if (left < eRight &&
+                    right > eLeft &&
+                    top > eBottom &&
+                    bottom < eTop)
+                {
+                    output.push_back(elementIndex);
+                }
+            }
+            continue;
+        }
+
+        // Same leaf rules as QuadTree::FindLeavesList.
+        const int child = GetChildren(nodeIndex);
+        if (top >= rect.midY)
+        {
+            if (left <= rect.midX)
+            {
+                stack.emplace_back(child + 0, rect.TL());
+            }
+            if (right > rect.midX)
+            {
+                stack.emplace_back(child + 1, rect.TR());
+            }
+        }
+        if (bottom < rect.midY)
+        {
+            if (left <= rect.midX)
+            {
+                stack.emplace_back(child + 2, rect.BL());
+            }
+            if (right > rect.midX)
+            {
+                stack.emplace_back(child + 3, rect.BR());
+            }
+        }
+    }
+
+    // Elements spanning several leaves were found more than once.
+    sort(output.begin() + firstOutput, output.end());
+    output.erase(unique(output.begin() + firstOutput, output.end()), output.end());
+}
+
+void QuadTreeView::Traverse(
+    void *userData,
+    QueryCallback branchCallback,
+    QueryCallback leafCallback) const
+{
+    vector<tuple<int, QuadRect, int>> stack;
+    stack.emplace_back(QuadTree::ROOT_QUAD_NODE_INDEX, _Bounds, 0);
+    while (stack.size() > 0)
+    {
+        auto [nodeIndex, rect, depth] = stack.back();
+        stack.pop_back();
+
+        if (IsLeaf(nodeIndex))
+        {
+            if (leafCallback != nullptr)
+            {
+                leafCallback(userData, this, nodeIndex, rect.ToRect(), depth);
+            }
+            continue;
+        }
+        if (branchCallback != nullptr)
+        {
+            branchCallback(userData, this, nodeIndex, rect.ToRect(), depth);
+        }
+        const int child = GetChildren(nodeIndex);
+        stack.emplace_back(child + 0, rect.TL(), depth + 1);
+        stack.emplace_back(child + 1, rect.TR(), depth + 1);
+        stack.emplace_back(child + 2, rect.BL(), depth + 1);
+        stack.emplace_back(child + 3, rect.BR(), depth + 1);
+    }
+}
+
+// Squared distance from (x, y) to the box, 0 inside it.
+static int64_t distanceSquared(int x, int y, int left, int top, int right, int bottom)
+{
+    const int64_t dx = x < left ? (int64_t)left - x : (x > right ? (int64_t)x - right : 0);
+    const int64_t dy = y < bottom ? (int64_t)bottom - y : (y > top ? (int64_t)y - top : 0);
+    return dx * dx + dy * dy;
+}
+
+void QuadTreeView::Nearest(int x, int y, int k, vector<int> &output) const
+{
+    // Best first: nodes are keyed by the distance to their region, which
+    // no element stored below can beat, so elements come out in order.
+    struct Entry
+    {
+        int64_t distance;
+        // Elements before nodes at the same distance.
+        bool isNode;
+        int index;
+        QuadRect rect;
+
+        bool operator>(const Entry &other) const
+        {
+            return tie(distance, isNode, index) > tie(other.distance, other.isNode, other.index);
+        }
+    };
+    priority_queue<Entry, vector<Entry>, greater<Entry>> queue;
+    unordered_set<int> queued;
+
+    queue.push({0, true, QuadTree::ROOT_QUAD_NODE_INDEX, _Bounds});
+    int found = 0;
+    while (found < k && !queue.empty())
+    {
+        Entry entry = queue.top();
+        queue.pop();
+        if (!entry.isNode)
+        {
+            output.push_back(entry.index);
+            found++;
+            continue;
+        }
+
+        if (IsLeaf(entry.index))
+        {
+            int elementNodeIndex = GetChildren(entry.index);
+            while (elementNodeIndex != -1)
+            {
+                const int elementIndex = GetElementId(elementNodeIndex);
+                elementNodeIndex = GetNext(elementNodeIndex);
+                if (!queued.insert(elementIndex).second)
+                {
+                    continue;
+                }
+                int left, top, right, bottom;
+                GetTestBounds(elementIndex, left, top, right, bottom);
+                queue.push({distanceSquared(x, y, left, top, right, bottom), false, elementIndex, QuadRect()});
+            }
+            continue;
+        }
+
+        const int child = GetChildren(entry.index);
+        const QuadRect children[4] = {entry.rect.TL(), entry.rect.TR(), entry.rect.BL(), entry.rect.BR()};
+        for (int i = 0; i < 4; i++)
+        {
+            const QuadRect &rect = children[i];
+            const int64_t distance = distanceSquared(x, y,
+                                                     rect.midX - rect.halfW, rect.midY + rect.halfH,
+                                                     rect.midX + rect.halfW, rect.midY - rect.halfH);
+            queue.push({distance, true, child + i, rect});
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "jmath.h"
+#include "jquad.h"
+
+using namespace std;
+
+// Read only QuadTree used straight out of a file written by QuadTree::Save.
+// The file is mapped rather than read, so pages come in as they are touched
+// and processes mapping the same file share one copy in the page cache.
+// Opening checks the header and walks the node and element node links once,
+// the element columns are only read by queries. Element and node indices
+// are the ones the saved tree had.
+class QuadTreeView
+{
+public:
+    using QueryCallback = void(
+        void *user_data,
+        const QuadTreeView *view,
+        int nodeIndex,
+        Rect nodeRect,
+        int depth);
+
+    QuadRect _Bounds;
+
+    QuadTreeView() = default;
+    ~QuadTreeView();
+    QuadTreeView(const QuadTreeView &) = delete;
+    QuadTreeView &operator=(const QuadTreeView &) = delete;
+
+    // Maps 'path'. False, and left closed, if it can't be mapped, wasn't
+    // written by a build with the same list layouts or links outside the
+    // lists.
+    bool Open(const char *path);
+    void Close();
+    bool IsOpen() const { return _Data != nullptr; }
+
+    // Appends the indices of every element intersecting the query, each once.
+    void Query(Rect query, vector<int> &output) const;
+
+    // Same traversal order and callbacks as QuadTree::Traverse.
+    void Traverse(void *userData,
+                  QueryCallback branchCallback,
+                  QueryCallback leafCallback) const;
+
+    // Appends the indices of the (up to) k elements closest to (x, y),
+    // nearest first, ties by element index. The distance is to the box, 0
+    // inside it. Exact for elements inside the tree's bounds.
+    void Nearest(int x, int y, int k, vector<int> &output) const;
+
+    int GetId(int elementIndex) const { return _Elements.get<QuadElementIntList::ID>(elementIndex); }
+    // The exact bounds when kept, otherwise the stored ones.
+    Rect GetRect(int elementIndex) const;
+
+    bool IsLeaf(int nodeIndex) const { return _Nodes.get<QuadNodesIntList::count>(nodeIndex) >= 0; }
+    int GetChildren(int nodeIndex) const { return _Nodes.get<QuadNodesIntList::children>(nodeIndex); }
+    int GetCount(int nodeIndex) const { return _Nodes.get<QuadNodesIntList::count>(nodeIndex); }
+    int GetNext(int elementNodeIndex) const { return _ElementNodes.get<QuadElementNodeIntList::next>(elementNodeIndex); }
+    int GetElementId(int elementNodeIndex) const { return _ElementNodes.get<QuadElementNodeIntList::elementId>(elementNodeIndex); }
+
+private:
+    // Whether every child, next and element index reached from the root is
+    // in range and no node or element node is reached twice, so traversals
+    // stay inside the mapping and end.
+    bool CheckLinks() const;
+    // Same as QuadTree::GetTestBounds.
+    void GetTestBounds(int elementIndex, int &left, int &top, int &right, int &bottom) const;
+
+    RecordView<QuadNodesIntList> _Nodes;
+    RecordView<QuadElementIntList> _Elements;
+    RecordView<QuadElementNodeIntList> _ElementNodes;
+    // Four ints per element when the tree kept exact bounds, else null.
+    const int *_ExactBounds = nullptr;
+    int _NumExactBounds = 0;
+
+    const unsigned char *_Data = nullptr;
+    uint64_t _Size = 0;
+    // File and mapping handles, Windows only.
+    void *_File = nullptr;
+    void *_Mapping = nullptr;
+};
@@ -0,0 +1,570 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "jint_list_alloc.h"
+
+using namespace std;
+
+// Index of the lowest set bit, 'bits' must not be 0.
+static inline int lowest_bit(uint64_t bits)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Whether the fields of an element sit next to each other (array of
+// structs) or every field gets an array of its own (struct of arrays).
+enum class RecordLayout
+{
+    AoS,
+    SoA
+};
+
+// Which free slot insert() hands out. Lifo reuses the last one erased, in
+// O(1) but scattered over the list after churn. LowestIndex finds the
+// lowest one with a two level bitmap, keeping live elements packed at the
+// front.
+enum class FreeListPolicy
+{
+    Lifo,
+    LowestIndex
+};
+
+// A JIntList whose fields are typed and fixed at compile time, so field
+// addresses are a constant stride and offset away and fields can be
+// narrower than an int. Field F of element n is get<F>(n).
+//
+// Same stack and free list interfaces (and rules) as JIntList. With
+// FreeListPolicy::Lifo the free list is threaded through field 0, which
+// must be an int32_t. There is no inline buffer, the first element
+// allocates.
+template <RecordLayout Layout, class... Fields>
+class RecordList
+{
+public:
+    static constexpr int num_fields = sizeof...(Fields);
+
+    template <int F>
+    using field_t = tuple_element_t<F, tuple<Fields...>>;
+
+    static_assert(is_same<field_t<0>, int32_t>::value, "field 0 holds the free list links");
+
+    static constexpr RecordLayout layout = Layout;
+    // One buffer for AoS, one per field for SoA.
+    static constexpr int num_columns = Layout == RecordLayout::AoS ? 1 : num_fields;
+
+private:
+    static constexpr size_t field_sizes[num_fields] = {sizeof(Fields)...};
+    static constexpr size_t field_aligns[num_fields] = {alignof(Fields)...};
+
+    static constexpr size_t round_up(size_t n, size_t alignment)
+    {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+public:
+    // Byte offset of field 'f' within an AoS record.
+    static constexpr size_t field_offset(int f)
+    {
+        size_t offset = 0;
+        for (int i = 0; i < f; i++)
+        {
+            offset = round_up(offset, field_aligns[i]) + field_sizes[i];
+        }
+        return round_up(offset, field_aligns[f]);
+    }
+
+    // Bytes per element, for AoS the size of a record with its padding.
+    static constexpr size_t record_size()
+    {
+        size_t alignment = 1;
+        for (int i = 0; i < num_fields; i++)
+        {
+            alignment = field_aligns[i] > alignment ? field_aligns[i] : alignment;
+        }
+        return round_up(field_offset(num_fields - 1) + field_sizes[num_fields - 1], alignment);
+    }
+
+    // Bytes each element takes across all its buffers.
+    static constexpr size_t element_size()
+    {
+        if constexpr (Layout == RecordLayout::AoS)
+        {
+            return record_size();
+        }
+        size_t bytes = 0;
+        for (int i = 0; i < num_fields; i++)
+        {
+            bytes += field_sizes[i];
+        }
+        return bytes;
+    }
+
+    // True when the buffer is laid out exactly like a JIntList with the
+    // same number of fields, see ints().
+    static constexpr bool packed_ints =
+        Layout == RecordLayout::AoS &&
+        conjunction<is_same<Fields, int32_t>...>::value &&
+        record_size() == num_fields * sizeof(int32_t);
+
+    // Stores the number of elements in the list.
+    int num;
+
+    // Stores the capacity of the list in elements.
+    int cap;
+
+    // Stores an index to the free element or -1 if the free list
+    // is empty. With FreeListPolicy::LowestIndex it is the lowest one.
+    int free_element;
+
+    // Stores how many of the 'num' slots are on the free list.
+    int num_free;
+
+    // Where the buffers come from, null for malloc/realloc. Not owned.
+    JIntListAllocator *allocator;
+
+    RecordList() : num(0), cap(0), free_element(-1), num_free(0), allocator(nullptr)
+    {
+        for (int c = 0; c < num_columns; c++)
+        {
+            columns[c] = nullptr;
+        }
+    }
+    ~RecordList() { free_buffers(); }
+
+    RecordList(const RecordList &) = delete;
+    RecordList &operator=(const RecordList &) = delete;
+
+    // Returns the number of elements in the list.
+    int size() const { return num; }
+
+    template <int F>
+    field_t<F> get(int n) const
+    {
+        assert(n >= 0 && n < num);
+        return *address<F>(n);
+    }
+
+    template <int F>
+    void set(int n, field_t<F> val)
+    {
+        assert(n >= 0 && n < num);
+        *address<F>(n) = val;
+    }
+
+    FreeListPolicy free_policy() const { return policy; }
+
+    // Switches policy, keeping the slots currently free.
+    void set_free_policy(FreeListPolicy new_policy)
+    {
+        if (new_policy == policy)
+        {
+            return;
+        }
+        vector<int> free_slots;
+        take_free(free_slots);
+        policy = new_policy;
+        for (int index : free_slots)
+        {
+            erase(index);
+        }
+    }
+
+    // Moves every free slot into 'output' and empties the free list. The
+    // slot insert() would have handed out first ends up at the back.
+    void take_free(vector<int> &output)
+    {
+        const size_t first = output.size();
+        if (policy == FreeListPolicy::Lifo)
+        {
+            for (int index = free_element; index != -1; index = *address<0>(index))
+            {
+                output.push_back(index);
+            }
+        }
+        else
+        {
+            for (int word = 0; word < (int)free_bits.size(); word++)
+            {
+                for (uint64_t bits = free_bits[word]; bits != 0; bits &= bits - 1)
+                {
+                    output.push_back(word * 64 + lowest_bit(bits));
+                }
+            }
+            free_bits.clear();
+            free_summary.clear();
+        }
+        reverse(output.begin() + first, output.end());
+        free_element = -1;
+        num_free = 0;
+    }
+
+    // The elements as num * num_fields ints, only when packed_ints.
+    const int *ints() const
+    {
+        static_assert(packed_ints, "only AoS lists of int32_t fields are laid out as ints");
+        return (const int *)columns[0];
+    }
+
+    // Writes 'count' ints starting at int 'first' as if the list were a
+    // JIntList, i.e. int i is field i % num_fields of element i / num_fields.
+    void copy_ints(int first, int count, int *output) const
+    {
+        if constexpr (packed_ints)
+        {
+            memcpy(output, ints() + first, count * sizeof(int));
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const int pos = first + i;
+                output[i] = get_int(pos / num_fields, pos % num_fields, make_index_sequence<num_fields>());
+            }
+        }
+    }
+
+    // Clears the specified list, making it empty.
+    void clear()
+    {
+        num = 0;
+        free_element = -1;
+        num_free = 0;
+        free_bits.clear();
+        free_summary.clear();
+    }
+
+    // Exchanges the contents of two lists, allocators included.
+    void swap(RecordList &other)
+    {
+        for (int c = 0; c < num_columns; c++)
+        {
+            std::swap(columns[c], other.columns[c]);
+        }
+        std::swap(num, other.num);
+        std::swap(cap, other.cap);
+        std::swap(free_element, other.free_element);
+        std::swap(num_free, other.num_free);
+        std::swap(allocator, other.allocator);
+        std::swap(policy, other.policy);
+        free_bits.swap(other.free_bits);
+        free_summary.swap(other.free_summary);
+    }
+
+    // Switches to another allocator (null for malloc/realloc), moving the
+    // buffers over to it. The allocator must outlive the list.
+    void set_allocator(JIntListAllocator *new_allocator)
+    {
+        if (new_allocator == allocator)
+        {
+            return;
+        }
+        for (int c = 0; c < num_columns; c++)
+        {
+            if (columns[c] == nullptr)
+            {
+                continue;
+            }
+            const size_t bytes = (size_t)cap * column_size(c);
+            unsigned char *data = new_allocator != nullptr
+                                      ? (unsigned char *)new_allocator->Grow(nullptr, 0, bytes)
+                                      : (unsigned char *)malloc(bytes);
+            memcpy(data, columns[c], bytes);
+            free_column(c);
+            columns[c] = data;
+        }
+        allocator = new_allocator;
+    }
+
+    // ---------------------------------------------------------------------------------
+    // Raw Buffers (for saving and loading)
+    // ---------------------------------------------------------------------------------
+    // Column c holds cap elements of column_size(c) bytes. Under Lifo free
+    // slots are linked through field 0, under LowestIndex they are only
+    // recorded in the free bitmaps.
+    static constexpr size_t column_size(int c)
+    {
+        return Layout == RecordLayout::AoS ? record_size() : field_sizes[c];
+    }
+    unsigned char *column(int c) const { return columns[c]; }
+    vector<uint64_t> &free_bitmap() { return free_bits; }
+    vector<uint64_t> &free_bitmap_summary() { return free_summary; }
+
+    // Sets the free list bookkeeping kept outside the buffers, once the
+    // columns (and bitmaps) have been filled in.
+    void set_free_state(FreeListPolicy new_policy, int first_free, int free_count)
+    {
+        policy = new_policy;
+        free_element = first_free;
+        num_free = free_count;
+    }
+
+    // ---------------------------------------------------------------------------------
+    // Stack Interface (do not mix with free list usage; use one or the other)
+    // ---------------------------------------------------------------------------------
+    // Inserts an element to the back of the list and returns an index to it.
+    int push_back()
+    {
+        if (num + 1 > cap)
+        {
+            grow((num + 1) * 2);
+        }
+        return num++;
+    }
+
+    // Removes the element at the back of the list.
+    void pop_back()
+    {
+        assert(num > 0);
+        --num;
+    }
+
+    // Grows or shrinks the list to 'n' elements. New elements are left
+    // uninitialized.
+    void resize(int n)
+    {
+        reserve(n);
+        num = n;
+    }
+
+    // Makes room for 'n' elements so the buffers don't move until the list
+    // grows past that.
+    void reserve(int n)
+    {
+        if (n > cap)
+        {
+            grow(n);
+        }
+    }
+
+    // Drops free slots from the end of the list, then gives back every byte
+    // of capacity past the remaining size. Live indices don't change.
+    void shrink_to_fit()
+    {
+        if (num_free > 0)
+        {
+            vector<int> free_slots;
+            take_free(free_slots);
+            vector<bool> is_free(num, false);
+            for (int index : free_slots)
+            {
+                is_free[index] = true;
+            }
+            while (num > 0 && is_free[num - 1])
+            {
+                num--;
+            }
+            // In take_free order, so reuse order is kept.
+            for (int index : free_slots)
+            {
+                if (index < num)
+                {
+                    erase(index);
+                }
+            }
+            free_bits.shrink_to_fit();
+            free_summary.shrink_to_fit();
+        }
+        if (num == cap)
+        {
+            return;
+        }
+        for (int c = 0; c < num_columns; c++)
+        {
+            unsigned char *data = nullptr;
+            const size_t bytes = (size_t)num * column_size(c);
+            if (num > 0)
+            {
+                data = allocator != nullptr
+                           ? (unsigned char *)allocator->Grow(nullptr, 0, bytes)
+                           : (unsigned char *)malloc(bytes);
+                memcpy(data, columns[c], bytes);
+            }
+            free_column(c);
+            columns[c] = data;
+        }
+        cap = num;
+    }
+
+    // ---------------------------------------------------------------------------------
+    // Free List Interface (do not mix with stack usage; use one or the other)
+    // ---------------------------------------------------------------------------------
+    // Inserts an element to a vacant position in the list and returns an index to it.
+    int insert()
+    {
+        if (free_element == -1)
+        {
+            return push_back();
+        }
+        const int index = free_element;
+        num_free--;
+        if (policy == FreeListPolicy::Lifo)
+        {
+            free_element = *address<0>(index);
+            return index;
+        }
+
+        // Nothing below 'index' is free, so the search starts from there.
+        const int word = index >> 6;
+        free_bits[word] &= ~(uint64_t(1) << (index & 63));
+        if (free_bits[word] == 0)
+        {
+            free_summary[word >> 6] &= ~(uint64_t(1) << (word & 63));
+        }
+        free_element = -1;
+        for (int group = word >> 6; group < (int)free_summary.size(); group++)
+        {
+            if (free_summary[group] != 0)
+            {
+                const int next = group * 64 + lowest_bit(free_summary[group]);
+                free_element = next * 64 + lowest_bit(free_bits[next]);
+                break;
+            }
+        }
+        return index;
+    }
+
+    // Removes the nth element in the list.
+    void erase(int n)
+    {
+        num_free++;
+        if (policy == FreeListPolicy::Lifo)
+        {
+            *address<0>(n) = free_element;
+            free_element = n;
+            return;
+        }
+
+        const int word = n >> 6;
+        if ((int)free_bits.size() <= word)
+        {
+            free_bits.resize(word + 1, 0);
+            free_summary.resize((word >> 6) + 1, 0);
+        }
+        free_bits[word] |= uint64_t(1) << (n & 63);
+        free_summary[word >> 6] |= uint64_t(1) << (word & 63);
+        if (free_element == -1 || n < free_element)
+        {
+            free_element = n;
+        }
+    }
+
+private:
+    // One buffer for AoS, one per field for SoA.
+    unsigned char *columns[num_columns];
+
+    // FreeListPolicy::LowestIndex only. Bit i of free_bits is set while
+    // slot i is free, bit w of free_summary while free_bits[w] is not 0.
+    FreeListPolicy policy = FreeListPolicy::Lifo;
+    vector<uint64_t> free_bits;
+    vector<uint64_t> free_summary;
+
+    template <int F>
+    field_t<F> *address(int n) const
+    {
+        if constexpr (Layout == RecordLayout::AoS)
+        {
+            return (field_t<F> *)(columns[0] + (size_t)n * record_size() + field_offset(F));
+        }
+        else
+        {
+            return (field_t<F> *)columns[F] + n;
+        }
+    }
+
+    template <size_t... F>
+    int get_int(int n, int field, index_sequence<F...>) const
+    {
+        int value = 0;
+        ((field == (int)F ? (value = (int)*address<F>(n), 0) : 0), ...);
+        return value;
+    }
+
+    void grow(int new_cap)
+    {
+        for (int c = 0; c < num_columns; c++)
+        {
+            const size_t old_bytes = (size_t)cap * column_size(c);
+            const size_t new_bytes = (size_t)new_cap * column_size(c);
+            if (allocator != nullptr)
+            {
+                columns[c] = (unsigned char *)allocator->Grow(columns[c], columns[c] ? old_bytes : 0, new_bytes);
+            }
+            else
+            {
+                columns[c] = (unsigned char *)realloc(columns[c], new_bytes);
+            }
+        }
+        cap = new_cap;
+    }
+
+    void free_column(int c)
+    {
+        if (columns[c] == nullptr)
+        {
+            return;
+        }
+        if (allocator != nullptr)
+        {
+            allocator->Free(columns[c], (size_t)cap * column_size(c));
+        }
+        else
+        {
+            free(columns[c]);
+        }
+    }
+
+    void free_buffers()
+    {
+        for (int c = 0; c < num_columns; c++)
+        {
+            free_column(c);
+        }
+    }
+};
+
+// Read only access to the buffers of a List (a RecordList) kept somewhere
+// else, e.g. in a mapped file written by QuadTree::Save. Same addressing as
+// the list itself.
+template <class List>
+class RecordView
+{
+public:
+    // Element count and one pointer per column, laid out as List's.
+    int num = 0;
+    const unsigned char *columns[List::num_columns] = {};
+
+    int size() const { return num; }
+
+    template <int F>
+    typename List::template field_t<F> get(int n) const
+    {
+        assert(n >= 0 && n < num);
+        using field = typename List::template field_t<F>;
+        if constexpr (List::layout == RecordLayout::AoS)
+        {
+            return *(const field *)(columns[0] + (size_t)n * List::record_size() + List::field_offset(F));
+        }
+        else
+        {
+            return ((const field *)columns[F])[n];
+        }
+    }
+};
@@ -0,0 +1,441 @@
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "jquad.h"
+#include "jrect_file.h"
+
+typedef std::chrono::high_resolution_clock rclock;
+
+// Fields per binary record, and bytes.
+static const int RECORD_INTS = 5;
+static const int RECORD_BYTES = RECORD_INTS * 4;
+// Starting size of the CSV read buffer. It only grows for longer lines.
+static const int CSV_BUFFER_BYTES = 1 << 20;
+
+static bool isLittleEndian()
+{
+    const uint16_t one = 1;
+    unsigned char low;
+    memcpy(&low, &one, 1);
+    return low == 1;
+}
+
+static int32_t swapBytes(int32_t value)
+{
+    const uint32_t v = (uint32_t)value;
+    return (int32_t)((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24));
+}
+
+static double msSince(rclock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(rclock::now() - start).count();
+}
+
+static void skipSpaces(const char *&p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+}
+
+// Parses [-+]digits[.digits], rounding half away from zero.
+static bool parseNumber(const char *&p, const char *end, int &value)
+{
+    skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    const char *digits = p;
+    int64_t whole = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        whole = whole * 10 + (*p - '0');
+        if (whole > INT_MAX)
+        {
+            return false;
+        }
+        p++;
+    }
+    bool any = p > digits;
+    if (p < end && *p == '.')
+    {
+        p++;
+        const char *fraction = p;
+        if (p < end && *p >= '5' && *p <= '9')
+        {
+            whole++;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+        any = any || p > fraction;
+    }
+    if (!any || whole > INT_MAX)
+    {
+        return false;
+    }
+    value = (int)(negative ? -whole : whole);
+    skipSpaces(p, end);
+    return true;
+}
+
+RectFileReader::~RectFileReader()
+{
+    Close();
+}
+
+bool RectFileReader::Open(const char *path, int chunkSize, bool background)
+{
+    Close();
+    _File = fopen(path, "rb");
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    _ChunkSize = max(chunkSize, 1);
+
+    char magic[sizeof(RECT_FILE_MAGIC)];
+    _Binary = fread(magic, 1, sizeof(magic), _File) == sizeof(magic) &&
+              memcmp(magic, RECT_FILE_MAGIC, sizeof(magic)) == 0;
+    if (!_Binary)
+    {
+        rewind(_File);
+    }
+    _Buffer.resize(_Binary ? (size_t)_ChunkSize * RECORD_BYTES : CSV_BUFFER_BYTES);
+
+    if (background)
+    {
+        _Thread = thread(&RectFileReader::ReadAhead, this);
+    }
+    return true;
+}
+
+void RectFileReader::Close()
+{
+    if (_Thread.joinable())
+    {
+        {
+            lock_guard<mutex> lock(_Mutex);
+            _Quit = true;
+        }
+        _Taken.notify_one();
+        _Thread.join();
+    }
+    if (_File != nullptr)
+    {
+        fclose(_File);
+        _File = nullptr;
+    }
+    _Binary = false;
+    _Eof = false;
+    _Done = false;
+    _NextRect = 0;
+    _NumLines = 0;
+    _NumRead = 0;
+    _NumErrors = 0;
+    _Pos = 0;
+    _End = 0;
+    _AheadFull = false;
+    _Quit = false;
+    // Give back the buffers, they scale with the chunk size.
+    _Buffer = vector<char>();
+    _Ahead = RectChunk();
+}
+
+bool RectFileReader::Read(RectChunk &chunk)
+{
+    if (_Done)
+    {
+        chunk.ids.clear();
+        chunk.rects.clear();
+        return false;
+    }
+    if (_Thread.joinable())
+    {
+        unique_lock<mutex> lock(_Mutex);
+        _Filled.wait(lock, [&]
+                     { return _AheadFull; });
+        swap(chunk, _Ahead);
+        _AheadFull = false;
+        lock.unlock();
+        _Taken.notify_one();
+    }
+    else
+    {
+        Parse(chunk);
+    }
+    _NumRead += (int64_t)chunk.rects.size();
+    _NumErrors += chunk.errors;
+    _Done = chunk.rects.empty();
+    return !_Done;
+}
+
+void RectFileReader::ReadAhead()
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(_Mutex);
+            _Taken.wait(lock, [&]
+                        { return !_AheadFull || _Quit; });
+            if (_Quit)
+            {
+                return;
+            }
+        }
+        Parse(_Ahead);
+        const bool last = _Ahead.rects.empty();
+        {
+            lock_guard<mutex> lock(_Mutex);
+            _AheadFull = true;
+        }
+        _Filled.notify_one();
+        if (last)
+        {
+            return;
+        }
+    }
+}
+
+void RectFileReader::Parse(RectChunk &chunk)
+{
+    chunk.ids.clear();
+    chunk.rects.clear();
+    chunk.errors = 0;
+    if (_Binary)
+    {
+        ParseBinary(chunk);
+    }
+    else
+    {
+        ParseCsv(chunk);
+    }
+}
+
+void RectFileReader::ParseBinary(RectChunk &chunk)
+{
+    if (_Eof)
+    {
+        return;
+    }
+    const size_t bytes = fread(_Buffer.data(), 1, (size_t)_ChunkSize * RECORD_BYTES, _File);
+    if (bytes < (size_t)_ChunkSize * RECORD_BYTES)
+    {
+        _Eof = true;
+        // A record cut short by the end of the file.
+        chunk.errors += bytes % RECORD_BYTES != 0 ? 1 : 0;
+    }
+    const int count = (int)(bytes / RECORD_BYTES);
+    const bool swap = !isLittleEndian();
+    chunk.ids.resize(count);
+    chunk.rects.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        int32_t record[RECORD_INTS];
+        memcpy(record, &_Buffer[(size_t)i * RECORD_BYTES], RECORD_BYTES);
+        if (swap)
+        {
+            for (int f = 0; f < RECORD_INTS; f++)
+            {
+                record[f] = swapBytes(record[f]);
+            }
+        }
+        chunk.ids[i] = record[0];
+        chunk.rects[i] = Rect(record[1], record[2], record[3], record[4]);
+    }
+    _NextRect += count;
+}
+
+void RectFileReader::ParseCsv(RectChunk &chunk)
+{
+    while ((int)chunk.rects.size() < _ChunkSize)
+    {
+        const char *start = _Buffer.data() + _Pos;
+        const char *newline = (const char *)memchr(start, '\n', _End - _Pos);
+        if (newline == nullptr && !_Eof)
+        {
+            // Move the partial line to the front and read more behind it.
+            memmove(_Buffer.data(), start, _End - _Pos);
+            _End -= _Pos;
+            _Pos = 0;
+            if (_End == _Buffer.size())
+            {
+                _Buffer.resize(_Buffer.size() * 2);
+            }
+            const size_t bytes = fread(_Buffer.data() + _End, 1, _Buffer.size() - _End, _File);
+            _End += bytes;
+            _Eof = bytes == 0;
+            continue;
+        }
+        if (newline == nullptr && _Pos == _End)
+        {
+            return;
+        }
+
+        // The last line may not end in a newline.
+        const char *end = newline != nullptr ? newline : _Buffer.data() + _End;
+        _Pos = end - _Buffer.data() + (newline != nullptr ? 1 : 0);
+        _NumLines++;
+        if (end > start && end[-1] == '\r')
+        {
+            end--;
+        }
+        const char *p = start;
+        skipSpaces(p, end);
+        if (p == end || *p == '#')
+        {
+            continue;
+        }
+
+        int id;
+        Rect rect;
+        if (!ParseCsvLine(p, end, id, rect))
+        {
+            // Most likely a header.
+            chunk.errors += _NumLines > 1 ? 1 : 0;
+            continue;
+        }
+        chunk.ids.push_back(id);
+        chunk.rects.push_back(rect);
+        _NextRect++;
+    }
+}
+
+bool RectFileReader::ParseCsvLine(const char *p, const char *end, int &id, Rect &rect)
+{
+    int fields[RECORD_INTS];
+    int numFields = 0;
+    while (true)
+    {
+        if (numFields == RECORD_INTS || !parseNumber(p, end, fields[numFields]))
+        {
+            return false;
+        }
+        numFields++;
+        if (p == end)
+        {
+            break;
+        }
+        if (*p != ',')
+        {
+            return false;
+        }
+        p++;
+    }
+    if (numFields < RECORD_INTS - 1)
+    {
+        return false;
+    }
+    const int *values = numFields == RECORD_INTS ? fields + 1 : fields;
+    if (values[2] < 0 || values[3] < 0)
+    {
+        return false;
+    }
+    id = numFields == RECORD_INTS ? fields[0] : (int)_NextRect;
+    rect = Rect(values[0], values[1], values[2], values[3]);
+    return true;
+}
+
+bool RectFileWriter::Open(const char *path)
+{
+    Close();
+    _File = fopen(path, "wb");
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    _Failed = fwrite(RECT_FILE_MAGIC, 1, sizeof(RECT_FILE_MAGIC), _File) != sizeof(RECT_FILE_MAGIC);
+    return !_Failed;
+}
+
+bool RectFileWriter::Write(const int *ids, const Rect *rects, int count)
+{
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    const bool swap = !isLittleEndian();
+    _Records.resize((size_t)count * RECORD_INTS);
+    for (int i = 0; i < count; i++)
+    {
+        int32_t *record = &_Records[(size_t)i * RECORD_INTS];
+        record[0] = ids[i];
+        record[1] = rects[i].x;
+        record[2] = rects[i].y;
+        record[3] = rects[i].w;
+        record[4] = rects[i].h;
+        if (swap)
+        {
+            for (int f = 0; f < RECORD_INTS; f++)
+            {
+                record[f] = swapBytes(record[f]);
+            }
+        }
+    }
+    if (fwrite(_Records.data(), RECORD_BYTES, count, _File) != (size_t)count)
+    {
+        _Failed = true;
+    }
+    return !_Failed;
+}
+
+bool RectFileWriter::Close()
+{
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    const bool closed = fclose(_File) == 0;
+    _File = nullptr;
+    _Records = vector<int32_t>();
+    return closed && !_Failed;
+}
+
+bool LoadRectFile(QuadTree &tree,
+                  const char *path,
+                  int chunkSize,
+                  bool background,
+                  ThreadPool *pool,
+                  RectLoadStats *stats)
+{
+    RectFileReader reader;
+    if (!reader.Open(path, chunkSize, background))
+    {
+        return false;
+    }
+
+    RectLoadStats local;
+    RectChunk chunk;
+    tree.BeginBulkBuild();
+    while (true)
+    {
+        auto start = rclock::now();
+        const bool more = reader.Read(chunk);
+        local.readMs += msSince(start);
+        if (!more)
+        {
+            break;
+        }
+        start = rclock::now();
+        tree.AppendBulkBuild(chunk.ids.data(), chunk.rects.data(), (int)chunk.rects.size());
+        local.appendMs += msSince(start);
+    }
+    auto start = rclock::now();
+    tree.FinishBulkBuild(pool);
+    local.buildMs = msSince(start);
+
+    local.rects = reader.NumRead();
+    local.errors = reader.NumErrors();
+    if (stats != nullptr)
+    {
+        *stats = local;
+    }
+    return true;
+}
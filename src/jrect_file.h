@@ -0,0 +1,141 @@
+#pragma once
+#include <stdio.h>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jmath.h"
+
+using namespace std;
+
+class QuadTree;
+class ThreadPool;
+
+// Rect datasets read and written a chunk at a time, so memory stays bounded
+// by the chunk size however large the file is.
+//
+// CSV: one rect per line as "id,x,y,w,h", or "x,y,w,h" in which case the id
+// is the rect's position in the file. x and y are the centre, as in Rect.
+// Fractions are rounded. Blank lines, lines starting with '#' and a header
+// on the first line are skipped.
+//
+// Binary: RECT_FILE_MAGIC followed by int32 id, x, y, w, h per rect, all
+// little-endian.
+
+static const char RECT_FILE_MAGIC[8] = {'J', 'R', 'E', 'C', 'T', 'S', '0', '1'};
+static const int RECT_FILE_CHUNK = 1 << 16;
+
+struct RectChunk
+{
+    vector<int> ids;
+    vector<Rect> rects;
+    // Lines or records skipped while reading it.
+    int errors = 0;
+};
+
+class RectFileReader
+{
+public:
+    RectFileReader() = default;
+    ~RectFileReader();
+    RectFileReader(const RectFileReader &) = delete;
+    RectFileReader &operator=(const RectFileReader &) = delete;
+
+    // Binary when the file starts with RECT_FILE_MAGIC, CSV otherwise. With
+    // 'background' a thread parses the next chunk while the caller works on
+    // the current one, holding at most one chunk besides the caller's.
+    bool Open(const char *path, int chunkSize = RECT_FILE_CHUNK, bool background = false);
+    void Close();
+    bool IsBinary() const { return _Binary; }
+
+    // Replaces the contents of 'chunk' with up to chunkSize rects. False once
+    // the file is exhausted.
+    bool Read(RectChunk &chunk);
+
+    // Rects returned and lines or records skipped so far.
+    int64_t NumRead() const { return _NumRead; }
+    int64_t NumErrors() const { return _NumErrors; }
+
+private:
+    // Run on the reading thread, whichever that is.
+    void Parse(RectChunk &chunk);
+    void ParseBinary(RectChunk &chunk);
+    void ParseCsv(RectChunk &chunk);
+    bool ParseCsvLine(const char *line, const char *end, int &id, Rect &rect);
+    void ReadAhead();
+
+    FILE *_File = nullptr;
+    bool _Binary = false;
+    int _ChunkSize = RECT_FILE_CHUNK;
+    bool _Eof = false;
+    // Set by Read once it returned the last rects.
+    bool _Done = false;
+    // Position in the file of the next rect, the default CSV id.
+    int64_t _NextRect = 0;
+    int64_t _NumLines = 0;
+    int64_t _NumRead = 0;
+    int64_t _NumErrors = 0;
+    // Raw bytes not parsed yet are [_Pos, _End).
+    vector<char> _Buffer;
+    size_t _Pos = 0;
+    size_t _End = 0;
+
+    // Read ahead. The thread owns _Ahead while _AheadFull is false.
+    thread _Thread;
+    mutex _Mutex;
+    condition_variable _Filled;
+    condition_variable _Taken;
+    RectChunk _Ahead;
+    bool _AheadFull = false;
+    bool _Quit = false;
+};
+
+class RectFileWriter
+{
+public:
+    RectFileWriter() = default;
+    ~RectFileWriter() { Close(); }
+    RectFileWriter(const RectFileWriter &) = delete;
+    RectFileWriter &operator=(const RectFileWriter &) = delete;
+
+    // Always writes the binary format.
+    bool Open(const char *path);
+    bool Write(const int *ids, const Rect *rects, int count);
+    // False if anything since Open failed to write.
+    bool Close();
+
+private:
+    FILE *_File = nullptr;
+    bool _Failed = false;
+    vector<int32_t> _Records;
+};
+
+struct RectLoadStats
+{
+    int64_t rects = 0;
+    int64_t errors = 0;
+    // Time the caller spent waiting on the file, appending elements and
+    // building the nodes at the end.
+    double readMs = 0;
+    double appendMs = 0;
+    double buildMs = 0;
+};
+
+// Replaces the contents of 'tree' with the rects in 'path' through the bulk
+// build path, see QuadTree::BeginBulkBuild. The nodes are built on 'pool'
+// (may be null). False if the file can't be opened.
+//
+// Reading the next chunk only overlaps appending the last one. The nodes
+// are built once the whole file is in, so memory is not bounded by the
+// chunk size. Besides the tree and two chunks, it peaks at one element
+// index per element and split level (a handful of levels, freed when the
+// build returns), plus the per-task build trees, about one more copy of the
+// tree. Those are kept for the next build until QuadTree::ShrinkToFit.
+bool LoadRectFile(QuadTree &tree,
+                  const char *path,
+                  int chunkSize = RECT_FILE_CHUNK,
+                  bool background = true,
+                  ThreadPool *pool = nullptr,
+                  RectLoadStats *stats = nullptr);
@@ -0,0 +1,10 @@
+#pragma once
+
+// Drawing goes through SDL. The headless build (NOIN_HEADLESS) keeps the Draw
+// declarations but compiles none of their definitions, so nothing in it
+// includes or links SDL.
+#ifndef NOIN_HEADLESS
+#include <SDL_render.h>
+#else
+struct SDL_Renderer;
+#endif
@@ -0,0 +1,185 @@
+#include "jthread_pool.h"
+
+ThreadPool::ThreadPool(int numWorkers)
+{
+    if (numWorkers <= 0)
+    {
+        numWorkers = (int)thread::hardware_concurrency();
+    }
+    _NumWorkers = numWorkers < 1 ? 1 : numWorkers;
+    _Queues.reset(new WorkQueue[_NumWorkers]);
+
+    // Worker 0 is whoever calls ParallelFor.
+    for (int worker = 1; worker < _NumWorkers; worker++)
+    {
+        _Threads.emplace_back(&ThreadPool::Run, this, worker);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(_Mutex);
+        _Quit = true;
+    }
+    _Wake.notify_all();
+    for (thread &t : _Threads)
+    {
+        t.join();
+    }
+}
+
+void ThreadPool::ParallelFor(int numTasks, const function<void(int task, int worker)> &fn)
+{
+    if (numTasks <= 0)
+    {
+        return;
+    }
+    if (_NumWorkers == 1 || numTasks == 1)
+    {
+        for (int task = 0; task < numTasks; task++)
+        {
+            fn(task, 0);
+        }
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(_Mutex);
+        _Job = Job::For;
+        _Fn = &fn;
+        _NumTasks = numTasks;
+        _NextTask.store(0);
+        _Running = _NumWorkers - 1;
+        _Generation++;
+    }
+    _Wake.notify_all();
+
+    RunForTasks(0);
+
+    unique_lock<mutex> lock(_Mutex);
+    _Done.wait(lock, [this]
+               { return _Running == 0; });
+    _Fn = nullptr;
+}
+
+void ThreadPool::RunTasks(const function<void(int worker)> &root)
+{
+    // The root counts as pending until it returns, so nobody gives up early.
+    _Pending.store(1);
+    if (_NumWorkers > 1)
+    {
+        lock_guard<mutex> lock(_Mutex);
+        _Job = Job::Tasks;
+        _Running = _NumWorkers - 1;
+        _Generation++;
+    }
+    _Wake.notify_all();
+
+    root(0);
+    _Pending.fetch_sub(1);
+    RunStolenTasks(0);
+
+    unique_lock<mutex> lock(_Mutex);
+    _Done.wait(lock, [this]
+               { return _Running == 0; });
+}
+
+void ThreadPool::Spawn(int worker, function<void(int worker)> task)
+{
+    _Pending.fetch_add(1);
+    lock_guard<mutex> lock(_Queues[worker].lock);
+    _Queues[worker].tasks.push_back(std::move(task));
+}
+
+void ThreadPool::Run(int worker)
+{
+    uint64_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(_Mutex);
+            _Wake.wait(lock, [&]
+                       { return _Quit || _Generation != seenGeneration; });
+            if (_Quit)
+            {
+                return;
+            }
+            seenGeneration = _Generation;
+        }
+
+        if (_Job == Job::For)
+        {
+            RunForTasks(worker);
+        }
+        else
+        {
+            RunStolenTasks(worker);
+        }
+
+        {
+            lock_guard<mutex> lock(_Mutex);
+            _Running--;
+        }
+        _Done.notify_one();
+    }
+}
+
+void ThreadPool::RunForTasks(int worker)
+{
+    // Tasks are handed out one at a time, so uneven tasks balance themselves.
+    while (true)
+    {
+        const int task = _NextTask.fetch_add(1);
+        if (task >= _NumTasks)
+        {
+            return;
+        }
+        (*_Fn)(task, worker);
+    }
+}
+
+void ThreadPool::RunStolenTasks(int worker)
+{
+    function<void(int)> task;
+    while (_Pending.load() > 0)
+    {
+        if (PopTask(worker, task))
+        {
+            task(worker);
+            task = nullptr;
+            _Pending.fetch_sub(1);
+        }
+        else
+        {
+            // Whatever is left is running elsewhere and may still spawn.
+            this_thread::yield();
+        }
+    }
+}
+
+bool ThreadPool::PopTask(int worker, function<void(int)> &task)
+{
+    {
+        WorkQueue &own = _Queues[worker];
+        lock_guard<mutex> lock(own.lock);
+        if (own.tasks.size() > 0)
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (int i = 1; i < _NumWorkers; i++)
+    {
+        WorkQueue &victim = _Queues[(worker + i) % _NumWorkers];
+        lock_guard<mutex> lock(victim.lock);
+        if (victim.tasks.size() > 0)
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
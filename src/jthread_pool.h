@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads for data parallel loops and fork style tasks.
+// The calling thread takes part in the work as worker 0, so a pool of one
+// runs everything inline without any threads at all.
+class ThreadPool
+{
+public:
+    // 0 picks the number of hardware threads.
+    explicit ThreadPool(int numWorkers);
+    ~ThreadPool();
+
+    int NumWorkers() { return _NumWorkers; }
+
+    // Calls fn(task, worker) for every task in [0, numTasks) and returns once
+    // all of them finished. 'worker' is in [0, NumWorkers()) and no two tasks
+    // run with the same worker at the same time, so it can index per-thread
+    // buffers. Not reentrant, don't call this from inside a task.
+    void ParallelFor(int numTasks, const function<void(int task, int worker)> &fn);
+
+    // Runs root(0) on the calling thread and returns once it and every task
+    // spawned from it finished. Each worker keeps its own queue, running the
+    // newest task it spawned first and letting idle workers steal the oldest
+    // one. Not reentrant either.
+    void RunTasks(const function<void(int worker)> &root);
+
+    // Queues a task from inside RunTasks. 'worker' is the caller's own.
+    void Spawn(int worker, function<void(int worker)> task);
+
+private:
+    enum class Job
+    {
+        For,
+        Tasks
+    };
+
+    struct alignas(64) WorkQueue
+    {
+        mutex lock;
+        deque<function<void(int)>> tasks;
+    };
+
+    void Run(int worker);
+    void RunForTasks(int worker);
+    void RunStolenTasks(int worker);
+    bool PopTask(int worker, function<void(int)> &task);
+
+    int _NumWorkers;
+    vector<thread> _Threads;
+
+    mutex _Mutex;
+    condition_variable _Wake;
+    condition_variable _Done;
+    uint64_t _Generation = 0;
+    int _Running = 0;
+    bool _Quit = false;
+
+    Job _Job = Job::For;
+    const function<void(int, int)> *_Fn = nullptr;
+    int _NumTasks = 0;
+    atomic<int> _NextTask{0};
+
+    unique_ptr<WorkQueue[]> _Queues;
+    // Spawned tasks which haven't finished yet.
+    atomic<int> _Pending{0};
+};
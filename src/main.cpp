@@ -1,14 +1,23 @@
 #define SDL_MAIN_HANDLED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "SDL.h"
 
 #include "jmath.h"
 #include "consts.h"
 #include "jquad.h"
+#include "jrect_file.h"
 #include "scene.h"
+#include "scene_replay.h"
+#include "scene_tools.h"
+#include "spatial_index.h"
 
 using namespace std;
 typedef std::chrono::high_resolution_clock rclock;
 
+// A sprite somewhere in the middle half of the world, moving in a random
+// direction.
 class Game
 {
 public:
@@ -18,11 +27,11 @@ public:
     Scene _Scene;
 
 public:
-    Game(int width, int height)
+    Game(int width, int height, SpatialBackend backend)
         : _width(width),
           _height(height),
           _WorldBox(0, 0, width, height),
-          _Scene(_WorldBox)
+          _Scene(_WorldBox, backend)
     {
         // Initialize random seed
         srand(1250);
@@ -30,26 +39,18 @@ public:
         printf("World Width = %d, World Height = %d\n", width, height);
         printf("Max Depth = %d\n", g_Settings.MaxQuadTreeDepth);
         printf("Max Rect Size = %d\n", g_Settings.MaxRectSize);
+        printf("Spatial Index = %s\n", SpatialBackendName(backend));
 
         // Create the scene
         const int numberSprites = g_Settings.NumberSprites;
-        const int maxSpritVelocity = g_Settings.MaxSpriteVelocity;
-        _Scene._Sprites.reserve(numberSprites);
+        _Scene._Sprites.Reserve(numberSprites);
         for (int i = 0; i < numberSprites; ++i)
         {
-            float posX = (float)(rand() % _WorldBox.W2()) - _WorldBox.W4();
-            float posY = (float)(rand() % _WorldBox.H2()) - _WorldBox.H4();
-            float velX = (float)((rand() % 1000) / 1000.0) * maxSpritVelocity - maxSpritVelocity / 2;
-            float velY = (float)((rand() % 1000) / 1000.0) * maxSpritVelocity - maxSpritVelocity / 2;
-            int w = g_Settings.MinRectSize + (rand() % g_Settings.MaxRectSize);
-            // int h = g_Settings.MinRectSize + (rand() % g_Settings.MaxRectSize);
-            int h = w;
-
-            Rect bounds = Rect((int)posX, (int)posY, w, h);
-            _Scene._Sprites.emplace_back(
-                i,
-                Vec2(posX, posY),
-                Vec2(velX, velY),
+            const SceneEvent sprite = RandomSpawnEvent(_WorldBox);
+            Rect bounds = Rect((int)sprite.x, (int)sprite.y, sprite.w, sprite.h);
+            _Scene._Sprites.Add(
+                Vec2(sprite.x, sprite.y),
+                Vec2(sprite.vx, sprite.vy),
                 bounds);
         }
         _Scene.Build();
@@ -69,8 +70,92 @@ public:
     }
 };
 
+// Prints the setting an event changed, once it reached the scene.
+static void printSceneEvent(Scene &scene, const SceneEvent &event)
+{
+    switch (event.type)
+    {
+    case SceneEventType::Spawn:
+        break;
+    case SceneEventType::SetBackend:
+        printf("Spatial Index = %s\n", SpatialBackendName(scene._Backend));
+        break;
+    case SceneEventType::SetPairCache:
+        printf("Pair Cache = %s\n", scene.GetPairCache() != nullptr ? "on" : "off");
+        break;
+    case SceneEventType::SetDoubleBuffered:
+        printf("Double Buffered Rebuild = %s\n", scene.IsDoubleBuffered() ? "on" : "off");
+        break;
+    case SceneEventType::SetContinuousCollision:
+        printf("Continuous Collision = %s\n", scene.IsContinuousCollision() ? "on" : "off");
+        break;
+    }
+}
+
 int main(int argc, char *argv[])
 {
+    SpatialBackend backend = g_Settings.Backend;
+    int collisionThreads = g_Settings.CollisionThreads;
+    const char *rectsPath = nullptr;
+    int rectChunk = RECT_FILE_CHUNK;
+    const char *recordPath = nullptr;
+    const char *replayPath = nullptr;
+    // Update with this delta instead of the time since the last one, 0 = off.
+    int fixedStepMs = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+        {
+            if (!ParseSpatialBackend(argv[++i], backend))
+            {
+                printf("Unknown backend '%s', expected quad, grid, cquad or brute\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            collisionThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--check-simd") == 0)
+        {
+            return CheckSimd();
+        }
+        else if (strcmp(argv[i], "--rects") == 0 && i + 1 < argc)
+        {
+            rectsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rect-chunk") == 0 && i + 1 < argc)
+        {
+            rectChunk = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--fixed-step") == 0 && i + 1 < argc)
+        {
+            fixedStepMs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--convert-rects") == 0 && i + 2 < argc)
+        {
+            const char *input = argv[++i];
+            return ConvertRectFile(input, argv[++i], rectChunk);
+        }
+    }
+    if (rectsPath != nullptr)
+    {
+        return IndexRectFile(rectsPath, Rect(0, 0, g_Settings.WorldWidth, g_Settings.WorldHeight),
+                             SpatialIndexParams(), rectChunk, collisionThreads);
+    }
+    if (replayPath != nullptr)
+    {
+        return ReplayRecording(replayPath, collisionThreads);
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
         printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
@@ -97,7 +182,36 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    Game game(g_Settings.WorldWidth, g_Settings.WorldHeight);
+    Game game(g_Settings.WorldWidth, g_Settings.WorldHeight, backend);
+    if (collisionThreads != g_Settings.CollisionThreads)
+    {
+        game._Scene.SetCollisionThreads(collisionThreads);
+    }
+
+    // While recording, changes to the simulation wait for the next Update so
+    // the replay can apply them at the same point.
+    SceneRecorder recorder;
+    vector<SceneEvent> pendingEvents;
+    if (recordPath != nullptr)
+    {
+        game._Scene.Clean();
+        if (!recorder.Open(recordPath, game._Scene))
+        {
+            printf("Could not record to '%s'\n", recordPath);
+            return 1;
+        }
+    }
+    auto changeScene = [&](const SceneEvent &event)
+    {
+        if (recorder.IsOpen())
+        {
+            pendingEvents.push_back(event);
+            return;
+        }
+        ApplySceneEvent(game._Scene, event);
+        printSceneEvent(game._Scene, event);
+    };
+
     bool quit = false;
     bool paused = false;
     auto start = rclock::now();
@@ -157,6 +271,35 @@ int main(int argc, char *argv[])
                 case SDLK_r:
                     game._Scene._DrawSpriteRects = !game._Scene._DrawSpriteRects;
                     break;
+                case SDLK_b:
+                    changeScene({SceneEventType::SetDoubleBuffered, !game._Scene.IsDoubleBuffered()});
+                    break;
+                case SDLK_p:
+                    changeScene({SceneEventType::SetPairCache, game._Scene.GetPairCache() == nullptr});
+                    break;
+                case SDLK_c:
+                    changeScene({SceneEventType::SetContinuousCollision, !game._Scene.IsContinuousCollision()});
+                    break;
+                case SDLK_n:
+                    // Spawn a batch of sprites.
+                    for (int i = 0; i < 100; i++)
+                    {
+                        changeScene(RandomSpawnEvent(game._WorldBox));
+                    }
+                    break;
+                case SDLK_m:
+                    if (QuadTreeIndex *quadIndex = get_if<QuadTreeIndex>(&game._Scene._Index))
+                    {
+                        PrintMemoryStats(quadIndex->_Tree.GetMemoryStats());
+                    }
+                    break;
+                case SDLK_g:
+                {
+                    // Cycle through every backend in declaration order.
+                    const int next = ((int)game._Scene._Backend + 1) % ((int)SpatialBackend::BruteForce + 1);
+                    changeScene({SceneEventType::SetBackend, next});
+                    break;
+                }
                 }
             default:
                 break;
@@ -175,7 +318,18 @@ int main(int argc, char *argv[])
             start = now;
             if (!paused)
             {
-                game.UpdatePhysics(deltaMs);
+                const chrono::milliseconds stepMs = fixedStepMs > 0 ? chrono::milliseconds(fixedStepMs) : deltaMs;
+                if (recorder.IsOpen())
+                {
+                    recorder.WriteUpdate(stepMs, pendingEvents);
+                    for (const SceneEvent &event : pendingEvents)
+                    {
+                        ApplySceneEvent(game._Scene, event);
+                        printSceneEvent(game._Scene, event);
+                    }
+                    pendingEvents.clear();
+                }
+                game.UpdatePhysics(stepMs);
             }
         }
 
@@ -205,6 +359,16 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (recorder.IsOpen())
+    {
+        const uint64_t hash = HashScene(game._Scene);
+        if (!recorder.Close(game._Scene))
+        {
+            printf("Could not finish recording '%s'\n", recordPath);
+        }
+        printf("Recorded to '%s', final state hash %016llx\n", recordPath, (unsigned long long)hash);
+    }
+
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -1,6 +1,7 @@
 
 #include "quad_tree.h"
 #include <stdlib.h>
+#include <string.h>
 
 
 static void node_insert(Quadtree* qt, int index, int depth, int mx, int my, int sx, int sy, int element);
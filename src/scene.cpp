@@ -1,163 +1,528 @@
 #include "scene.h"
 
+#include <math.h>
+
 #include "jmath.h"
-#include "jquad.h"
 #include "consts.h"
 
-Scene::Scene(Rect BB)
-    : _WorldBox(BB),
-      _QuadTree(
-          BB,
-          g_Settings.MaxQuadTreeDepth,
-          g_Settings.QuadTreeSplitThreshold) {}
+typedef chrono::high_resolution_clock rclock;
+
+// Milliseconds since 'start', which then moves up to now.
+static double lapMs(rclock::time_point &start)
+{
+    const rclock::time_point now = rclock::now();
+    const double ms = chrono::duration<double, milli>(now - start).count();
+    start = now;
+    return ms;
+}
+
+// How far a sprite moving at 'velocity' gets in FatBoxMs, at most the size
+// of the world. Velocities which aren't numbers get no margin.
+static int fatMargin(float velocity)
+{
+    const float margin = ceilf(velocity * g_Settings.FatBoxMs / 1000.0f);
+    const int limit = max(g_Settings.WorldWidth, g_Settings.WorldHeight);
+    if (!(margin > 0.0f))
+    {
+        return 0;
+    }
+    return margin < (float)limit ? (int)margin : limit;
+}
+
+// Box covering the sprite on its way from (x0, y0) to where it is now.
+static Rect sweptBox(const SpriteSystem &sprites, int id, float x0, float y0)
+{
+    const Rect end = sprites.GetBoundingBox(id);
+    // Starts which aren't numbers and boxes far outside any world (a sprite
+    // that went NaN sits at INT_MIN) would overflow below. They keep their
+    // plain box, which the tree handles like any other bounds that wrapped.
+    const int limit = 1 << 28;
+    if (!(fabsf(x0) < limit && fabsf(y0) < limit) ||
+        end.x < -limit || end.x > limit || end.y < -limit || end.y > limit ||
+        end.w < 0 || end.w > limit || end.h < 0 || end.h > limit)
+    {
+        return end;
+    }
+    const int w2 = end.w >> 1;
+    const int h2 = end.h >> 1;
+    const int left = min((int)x0, end.x) - w2;
+    const int right = max((int)x0, end.x) + w2;
+    const int bottom = min((int)y0, end.y) - h2;
+    const int top = max((int)y0, end.y) + h2;
+    // Rect is center based, round the half sizes up so it covers both ends.
+    const int x = left + ((right - left) >> 1);
+    const int y = bottom + ((top - bottom) >> 1);
+    return Rect(x, y, (right - x) << 1, (top - y) << 1);
+}
+
+// One axis of the slab test. Narrows [enter, exit], the part of the step
+// (0 to 1) the boxes overlap in, to when they overlap on this axis.
+static bool overlapTimes(float aMin, float aMax, float bMin, float bMax, float velocity,
+                         float &enter, float &exit)
+{
+    if (velocity == 0.0f)
+    {
+        return bMin < aMax && bMax > aMin;
+    }
+    float t0 = (aMin - bMax) / velocity;
+    float t1 = (aMax - bMin) / velocity;
+    if (t0 > t1)
+    {
+        swap(t0, t1);
+    }
+    enter = max(enter, t0);
+    exit = min(exit, t1);
+    return enter < exit;
+}
+
+static bool timeOfImpact(const SpriteSystem &sprites, int a, int b,
+                         const float *startX, const float *startY,
+                         float &time)
+{
+    // B moves relative to A. Half sizes match the index boxes.
+    const float aw = (float)((int)sprites._W[a] >> 1);
+    const float ah = (float)((int)sprites._H[a] >> 1);
+    const float bw = (float)((int)sprites._W[b] >> 1);
+    const float bh = (float)((int)sprites._H[b] >> 1);
+    const float vx = (sprites._X[b] - startX[b]) - (sprites._X[a] - startX[a]);
+    const float vy = (sprites._Y[b] - startY[b]) - (sprites._Y[a] - startY[a]);
+
+    float enter = 0.0f;
+    float exit = 1.0f;
+    if (!overlapTimes(startX[a] - aw, startX[a] + aw, startX[b] - bw, startX[b] + bw, vx, enter, exit) ||
+        !overlapTimes(startY[a] - ah, startY[a] + ah, startY[b] - bh, startY[b] + bh, vy, enter, exit))
+    {
+        return false;
+    }
+    time = enter;
+    return true;
+}
+
+static void configureTree(QuadTree &tree, JIntListAllocator *allocator, FreeListPolicy freePolicy)
+{
+    tree.SetListAllocator(allocator);
+    tree.SetFreeListPolicy(freePolicy);
+    if (g_Settings.FatBoxMs > 0)
+    {
+        tree.SetFatMargin(fatMargin((float)g_Settings.MaxSpriteVelocity));
+    }
+}
+
+Scene::Scene(Rect BB, SpatialBackend backend, const SpatialIndexParams &params)
+    : _Pool(make_unique<ThreadPool>(g_Settings.CollisionThreads)),
+      _ListAllocator(g_Settings.QuadTreeHugePages ? make_unique<HugePageIntListAllocator>() : nullptr),
+      _Backend(backend),
+      _IndexParams(params),
+      _WorldBox(BB)
+{
+    CreateIndex(backend);
+    // TODO: Remove this magic number.
+    _CollisionPairs.reserve(4096);
+
+    if (g_Settings.DoubleBufferedRebuild)
+    {
+        SetDoubleBuffered(true);
+    }
+    if (g_Settings.ContinuousCollision)
+    {
+        SetContinuousCollision(true);
+    }
+}
 Scene::~Scene() {}
 
+template <class Index>
+void Scene::BuildWith(Index &index)
+{
+    static_assert(IsSpatialIndex<Index>::value, "Scene requires a spatial index");
+    if constexpr (is_same_v<Index, QuadTreeIndex>)
+    {
+        vector<int> ids(_Sprites.Size());
+        vector<Rect> boxes(_Sprites.Size());
+        for (int i = 0; i < _Sprites.Size(); i++)
+        {
+            ids[i] = i;
+            boxes[i] = _Sprites.GetBoundingBox(i);
+        }
+        index._Tree.BulkBuild(ids, boxes, _Pool.get());
+        for (int i = 0; i < _Sprites.Size(); i++)
+        {
+            _Sprites._QuadId[i] = i;
+        }
+        return;
+    }
+
+    for (int i = 0; i < _Sprites.Size(); i++)
+    {
+        Rect box = _Sprites.GetBoundingBox(i);
+        _Sprites._QuadId[i] = index.Insert(i, box);
+    }
+}
+
 void Scene::Build()
 {
-    for (Sprite &sprite : _Sprites)
+    visit([&](auto &index) { BuildWith(index); }, _Index);
+}
+
+void Scene::SetBackend(SpatialBackend backend)
+{
+    if (backend == _Backend)
     {
-        sprite._QuadId = _QuadTree.Insert(sprite._Id, sprite._BoundingBox);
+        return;
     }
+
+    // Every backend starts out empty so the old handles are simply dropped.
+    SetDoubleBuffered(false);
+    _Snapshots.reset();
+    _PairCache.reset();
+    _Backend = backend;
+    CreateIndex(backend);
+    Build();
 }
 
-struct QuadCollisionUserData
+void Scene::SetCollisionThreads(int numThreads)
 {
-    unordered_map<int, bool> seen;
-    vector<bool> spritesProcessed;
-    vector<pair<int, int>> collisionPairs;
-    Scene *scene;
-};
+    QuadTreeIndex *quadIndex = get_if<QuadTreeIndex>(&_Index);
+    if (quadIndex != nullptr)
+    {
+        quadIndex->_Pool = nullptr;
+    }
+    _Pool = make_unique<ThreadPool>(numThreads);
+    if (quadIndex != nullptr)
+    {
+        quadIndex->_Pool = _Pool.get();
+    }
+}
 
-void quadCollissionLeafCallback(
-    void *userData,
-    QuadTree *tree,
-    int nodeIndex,
-    Rect nodeRect,
-    int depth)
+void Scene::CreateIndex(SpatialBackend backend)
 {
-    QuadCollisionUserData *data = (QuadCollisionUserData *)userData;
-    Scene *scene = data->scene;
-    unordered_map<int, bool> &seen = data->seen;
-    vector<bool> &traversed = data->spritesProcessed;
-    vector<pair<int, int>> &collissionPairs = data->collisionPairs;
+    CreateSpatialIndex(_Index, backend, _WorldBox, _IndexParams);
+    if (QuadTreeIndex *quadIndex = get_if<QuadTreeIndex>(&_Index))
+    {
+        quadIndex->_Pool = _Pool.get();
+        quadIndex->_Tree.SetArena(&_FrameArena);
+        configureTree(quadIndex->_Tree, _ListAllocator.get(), _IndexParams.freePolicy);
+    }
+}
 
-    vector<int> intersectingElements;
-    int elementNodeIndex = tree->_Nodes.GetChildren(nodeIndex);
-    // Process every element in this node
-    while (elementNodeIndex != -1)
+QuadTreeSnapshots *Scene::EnableSnapshots()
+{
+    QuadTreeIndex *quadIndex = get_if<QuadTreeIndex>(&_Index);
+    if (quadIndex == nullptr)
+    {
+        return nullptr;
+    }
+    if (!_Snapshots)
     {
-        const int elementIndex = tree->_ElementNodes.GetElementId(elementNodeIndex);
-        elementNodeIndex = tree->_ElementNodes.GetNext(elementNodeIndex);
+        _Snapshots = make_unique<QuadTreeSnapshots>(quadIndex->_Tree);
+    }
+    return _Snapshots.get();
+}
 
-        // If we have already processed this element then we can skip early.
-        // This can happen from processing in a separate leaf node
-        if (traversed[elementIndex])
+bool Scene::SetDoubleBuffered(bool enabled)
+{
+    QuadTreeIndex *quadIndex = get_if<QuadTreeIndex>(&_Index);
+    if (enabled)
+    {
+        if (quadIndex == nullptr || _ContinuousCollision)
         {
-            continue;
+            return false;
         }
+        if (!_Rebuilder)
+        {
+            _BackTree = make_unique<QuadTree>(
+                _WorldBox,
+                _IndexParams.maxDepth,
+                _IndexParams.splitThreshold);
+            configureTree(*_BackTree, _ListAllocator.get(), _IndexParams.freePolicy);
+            _Rebuilder = make_unique<QuadTreeRebuilder>();
+        }
+        return true;
+    }
 
-        const Rect queryRect = std::move(tree->_Elements.GetRect(elementIndex));
-        traversed[elementIndex] = true;
-
-        seen.clear();
-        intersectingElements.clear();
-        seen[elementIndex] = true;
-        tree->Query(queryRect, seen, &intersectingElements);
+    if (_Rebuilder)
+    {
+        // Land the rebuild in flight so the sprite handles match the tree
+        // the single buffered path will keep moving.
+        if (quadIndex != nullptr)
+        {
+            SwapInRebuiltTree(quadIndex->_Tree);
+        }
+        _Rebuilder.reset();
+        _BackTree.reset();
+    }
+    return true;
+}
 
-        const int A_spriteId = tree->_Elements.GetId(elementIndex);
-        for (int otherElementId : intersectingElements)
+bool Scene::SetPairCache(bool enabled)
+{
+    if (!enabled)
+    {
+        _PairCache.reset();
+        if (QuadTreeIndex *index = get_if<QuadTreeIndex>(&_Index))
         {
-            const int B_spriteId = tree->_Elements.GetId(otherElementId);
-            if (traversed[otherElementId])
-            {
-                continue;
-            }
-            collissionPairs.emplace_back(A_spriteId, B_spriteId);
+            index->_Tree.TrackLeafChanges(false);
         }
+        return true;
+    }
+    if (get_if<QuadTreeIndex>(&_Index) == nullptr)
+    {
+        return false;
+    }
+    if (!_PairCache)
+    {
+        _PairCache = make_unique<QuadTreePairCache>();
     }
-};
+    return true;
+}
 
-void Scene::QuadCollision()
+void Scene::SetContinuousCollision(bool enabled)
 {
-    QuadCollisionUserData data;
-    data.scene = this;
-    // TODO: Remove this magic number.
-    data.collisionPairs.reserve(4096);
-    data.spritesProcessed.resize(g_Settings.NumberSprites, false);
-    _QuadTree.Traverse((void *)(&data), nullptr, quadCollissionLeafCallback);
+    if (enabled)
+    {
+        SetDoubleBuffered(false);
+    }
+    _ContinuousCollision = enabled;
+}
 
-    Sprite *A = nullptr;
-    Sprite *B = nullptr;
-    for (auto [AId, BId] : data.collisionPairs)
+int Scene::Spawn(Vec2 position, Vec2 velocity, Rect BB)
+{
+    const int id = _Sprites.Add(position, velocity, BB);
+    Rect box = _Sprites.GetBoundingBox(id);
+    visit([&](auto &index)
+          {
+              if constexpr (is_same_v<decay_t<decltype(index)>, QuadTreeIndex>)
+              {
+                  // The rebuild in flight doesn't know about the new sprite.
+                  if (_Rebuilder)
+                  {
+                      SwapInRebuiltTree(index._Tree);
+                  }
+              }
+              _Sprites._QuadId[id] = index.Insert(id, box);
+          },
+          _Index);
+    return id;
+}
+
+void Scene::SwapInRebuiltTree(QuadTree &front)
+{
+    if (!_Rebuilder->Wait())
     {
-        A = &_Sprites[AId];
-        B = &_Sprites[BId];
-        A->Collides(B);
-        A->_IsColliding = true;
-        B->_IsColliding = true;
+        return;
+    }
+    front.Swap(*_BackTree);
+    for (int i = 0; i < _Sprites.Size(); i++)
+    {
+        _Sprites._QuadId[i] = _RebuildHandles[i];
     }
 }
 
-void Scene::BruteCollision()
+void Scene::UpdateDoubleBuffered(QuadTreeIndex &index, chrono::milliseconds deltaMs)
 {
-    // Run collision logic
-    Sprite *A = nullptr;
-    Sprite *B = nullptr;
-    for (int i = 0; i < _Sprites.size(); i++)
+    // Frame boundary, the tree built from last frame's positions becomes current.
+    auto lap = rclock::now();
+    SwapInRebuiltTree(index._Tree);
+    _Timings.indexMs = lapMs(lap);
+
+    _Sprites.ClearColliding();
+
+    FindCollisionPairs(index);
+    _Timings.findPairsMs = lapMs(lap);
+    ApplyCollisions();
+    _Timings.collideMs = lapMs(lap);
+
+    // update physics, the tree itself is rebuilt off thread
+    _Sprites.Update(_WorldBox, deltaMs);
+    _Timings.integrateMs = lapMs(lap);
+    _RebuildIds.resize(_Sprites.Size());
+    _RebuildBoxes.resize(_Sprites.Size());
+    for (int i = 0; i < _Sprites.Size(); i++)
     {
-        A = &_Sprites[i];
-        for (int j = i + 1; j < _Sprites.size(); j++)
+        _RebuildIds[i] = i;
+        _RebuildBoxes[i] = _Sprites.GetBoundingBox(i);
+    }
+    _Rebuilder->Start(_BackTree.get(), &_RebuildIds, &_RebuildBoxes, &_RebuildHandles);
+    _Timings.indexMs += lapMs(lap);
+}
+
+template <class Index>
+void Scene::FindCollisionPairs(Index &index)
+{
+    _CollisionPairs.clear();
+    if constexpr (is_same_v<Index, QuadTreeIndex>)
+    {
+        if (_PairCache)
         {
-            B = &_Sprites[j];
-            if (A->Intersects(B) && B->Intersects(A))
+            _PairCache->Update(index._Tree);
+            const vector<pair<int, int>> &pairs = _PairCache->Pairs();
+            _CollisionPairs.assign(pairs.begin(), pairs.end());
+            return;
+        }
+    }
+    index.FindPairs(_CollisionPairs);
+}
+
+void Scene::ApplyCollisions()
+{
+    _Sprites.CollidePairs(_CollisionPairs);
+    for (auto [AId, BId] : _CollisionPairs)
+    {
+        _Sprites.SetColliding(AId);
+        _Sprites.SetColliding(BId);
+    }
+}
+
+template <class Index>
+void Scene::UpdateWith(Index &index, chrono::milliseconds deltaMs)
+{
+    static_assert(IsSpatialIndex<Index>::value, "Scene requires a spatial index");
+    if (_ContinuousCollision)
+    {
+        UpdateContinuous(index, deltaMs);
+        return;
+    }
+    if constexpr (is_same_v<Index, QuadTreeIndex>)
+    {
+        if (_Rebuilder)
+        {
+            UpdateDoubleBuffered(index, deltaMs);
+            return;
+        }
+    }
+
+    auto lap = rclock::now();
+    _Sprites.ClearColliding();
+
+    FindCollisionPairs(index);
+    _Timings.findPairsMs = lapMs(lap);
+    ApplyCollisions();
+    _Timings.collideMs = lapMs(lap);
+
+    // update physics
+    _Sprites.Update(_WorldBox, deltaMs);
+    _Timings.integrateMs = lapMs(lap);
+    if constexpr (is_same_v<Index, QuadTreeIndex>)
+    {
+        if (g_Settings.FatBoxMs > 0)
+        {
+            // Sized to the sprite's own speed when it has to move anyway.
+            for (int i = 0; i < _Sprites.Size(); i++)
             {
-                A->_IsColliding = true;
-                B->_IsColliding = true;
-                _Sprites[i].Collides(&_Sprites[j]);
+                Rect box = _Sprites.GetBoundingBox(i);
+                const int margin = fatMargin(max(fabsf(_Sprites._Vx[i]), fabsf(_Sprites._Vy[i])));
+                _Sprites._QuadId[i] = index.Move(_Sprites._QuadId[i], box, margin);
             }
+            _Timings.indexMs = lapMs(lap);
+            return;
         }
     }
+    for (int i = 0; i < _Sprites.Size(); i++)
+    {
+        Rect box = _Sprites.GetBoundingBox(i);
+        _Sprites._QuadId[i] = index.Move(_Sprites._QuadId[i], box);
+    }
+    _Timings.indexMs = lapMs(lap);
 }
 
-void Scene::Update(chrono::milliseconds deltaMs)
+template <class Index>
+void Scene::UpdateContinuous(Index &index, chrono::milliseconds deltaMs)
 {
-    for (Sprite &sprite : _Sprites)
+    _Sprites.ClearColliding();
+
+    // Move first, then look for what met on the way.
+    auto lap = rclock::now();
+    const int numSprites = _Sprites.Size();
+    ArenaVector<float> startX(_Sprites._X.begin(), _Sprites._X.end(), _FrameArena);
+    ArenaVector<float> startY(_Sprites._Y.begin(), _Sprites._Y.end(), _FrameArena);
+    ArenaVector<float> startVx(_Sprites._Vx.begin(), _Sprites._Vx.end(), _FrameArena);
+    ArenaVector<float> startVy(_Sprites._Vy.begin(), _Sprites._Vy.end(), _FrameArena);
+    _Sprites.Update(_WorldBox, deltaMs);
+    _Timings.integrateMs = lapMs(lap);
+    for (int i = 0; i < numSprites; i++)
     {
-        sprite._IsColliding = false;
+        // Only a bounce off the world box flips a velocity here. The sprite
+        // turned part way through the step, so the line from its start isn't
+        // where it went. It counts as having sat at its end for the step.
+        if (signbit(_Sprites._Vx[i]) != signbit(startVx[i]) ||
+            signbit(_Sprites._Vy[i]) != signbit(startVy[i]))
+        {
+            startX[i] = _Sprites._X[i];
+            startY[i] = _Sprites._Y[i];
+        }
+        Rect box = sweptBox(_Sprites, i, startX[i], startY[i]);
+        _Sprites._QuadId[i] = index.Move(_Sprites._QuadId[i], box);
     }
+    _Timings.indexMs = lapMs(lap);
+    FindCollisionPairs(index);
+    _Timings.findPairsMs = lapMs(lap);
 
-    if (g_Settings.UseQuadTree)
+    ArenaVector<Impact> impacts(_FrameArena);
+    impacts.reserve(_CollisionPairs.size());
+    for (auto [a, b] : _CollisionPairs)
     {
-        QuadCollision();
+        float time;
+        if (timeOfImpact(_Sprites, a, b, startX.data(), startY.data(), time))
+        {
+            impacts.push_back({time, a, b});
+        }
     }
-    else
+    sort(impacts.begin(), impacts.end());
+
+    // Earliest first. A sprite stops where it first hits something and
+    // bounces from there, whatever it would have hit later on its old path
+    // waits for the next step. Hits at the same time all count, like the
+    // overlapping pairs of a plain update.
+    // When each sprite was first hit, > 1 if it wasn't.
+    ArenaVector<float> hitTime(numSprites, 2.0f, _FrameArena);
+    for (const Impact &impact : impacts)
     {
-        BruteCollision();
+        if (hitTime[impact.a] < impact.time || hitTime[impact.b] < impact.time)
+        {
+            continue;
+        }
+        for (int id : {impact.a, impact.b})
+        {
+            if (hitTime[id] > 1.0f)
+            {
+                hitTime[id] = impact.time;
+                _Sprites._X[id] = startX[id] + (_Sprites._X[id] - startX[id]) * impact.time;
+                _Sprites._Y[id] = startY[id] + (_Sprites._Y[id] - startY[id]) * impact.time;
+            }
+        }
+        _Sprites.Collide(impact.a, impact.b);
+        _Sprites.SetColliding(impact.a);
+        _Sprites.SetColliding(impact.b);
     }
+    _Timings.collideMs = lapMs(lap);
+}
 
-    // update physics
-    for (Sprite &sprite : _Sprites)
+void Scene::Update(chrono::milliseconds deltaMs)
+{
+    _Timings = SceneUpdateTimings();
+    visit([&](auto &index) { UpdateWith(index, deltaMs); }, _Index);
+
+    if (_Snapshots)
     {
-        sprite.Update(_WorldBox, deltaMs);
-        _QuadTree.Remove(sprite._QuadId);
-        sprite._QuadId = _QuadTree.Insert(sprite._Id, sprite._BoundingBox);
+        _Snapshots->Publish();
     }
+    _FrameArena.Reset();
 }
 
+#ifndef NOIN_HEADLESS
 void Scene::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs)
 {
-    _QuadTree.Draw(renderer, transform, deltaMs, _DrawQuadTreeRects);
+    visit([&](auto &index)
+          { index.Draw(renderer, transform, deltaMs, _DrawQuadTreeRects); },
+          _Index);
 
     if (_DrawSpriteRects)
     {
-        for (Sprite &sprite : _Sprites)
-        {
-            sprite.Draw(renderer, transform, deltaMs);
-        }
+        _Sprites.Draw(renderer, transform, deltaMs);
     }
 }
+#endif
 
 void Scene::Clean()
 {
-    _QuadTree.Clean();
+    visit([](auto &index) { index.Clean(); }, _Index);
 }
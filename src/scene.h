@@ -1,32 +1,138 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
 #include "consts.h"
 #include "jmath.h"
-#include "jquad.h"
+#include "spatial_index.h"
+#include "jquad_snapshot.h"
+#include "jquad_pair_cache.h"
+#include "jquad_rebuild.h"
+#include "jthread_pool.h"
+#include "jarena.h"
+#include "jint_list_alloc.h"
 #include "sprite.h"
 
+// Where the last Scene::Update spent its time.
+struct SceneUpdateTimings
+{
+    // Finding the overlapping pairs, resolving them, moving the sprites and
+    // bringing the index up to date (or handing it to the rebuild).
+    double findPairsMs = 0;
+    double collideMs = 0;
+    double integrateMs = 0;
+    double indexMs = 0;
+};
+
 class Scene
 {
 public:
-    QuadTree _QuadTree;
-    vector<Sprite> _Sprites;
+    // Declared before _Index which may hold on to them. The arena holds
+    // temporaries of one Update and is reset at the end of it. The list
+    // allocator, when set, backs the quad tree's element and node lists.
+    unique_ptr<ThreadPool> _Pool;
+    FrameArena _FrameArena;
+    unique_ptr<JIntListAllocator> _ListAllocator;
+    SpatialIndex _Index;
+    SpatialBackend _Backend;
+    SpatialIndexParams _IndexParams;
+    // Declared after _Index so it is torn down before the tree it reads.
+    unique_ptr<QuadTreeSnapshots> _Snapshots;
+    SpriteSystem _Sprites;
 
     Rect _WorldBox;
     bool _DrawQuadTreeRects = false;
     bool _DrawSpriteRects = true;
 
+private:
+    vector<pair<int, int>> _CollisionPairs;
+    unique_ptr<QuadTreePairCache> _PairCache;
+
+    // Continuous collision, a candidate pair which really meets.
+    struct Impact
+    {
+        float time;
+        int a, b;
+        bool operator<(const Impact &other) const
+        {
+            return time != other.time ? time < other.time : make_pair(a, b) < make_pair(other.a, other.b);
+        }
+    };
+    bool _ContinuousCollision = false;
+    SceneUpdateTimings _Timings;
+
+    // Back buffer for the double buffered rebuild. The rebuilder is declared
+    // last so its worker is joined before the buffers it writes go away.
+    unique_ptr<QuadTree> _BackTree;
+    vector<int> _RebuildIds;
+    vector<Rect> _RebuildBoxes;
+    vector<int> _RebuildHandles;
+    unique_ptr<QuadTreeRebuilder> _Rebuilder;
+
 public:
-    Scene(Rect BB);
+    Scene(Rect BB,
+          SpatialBackend backend = g_Settings.Backend,
+          const SpatialIndexParams &params = SpatialIndexParams());
     ~Scene();
 
     void Build();
-    void QuadCollision();
-    void BruteCollision();
+    // Number of threads (including the caller) Build and collision detection
+    // may use.
+    // Results don't depend on it, only the time they take.
+    void SetCollisionThreads(int numThreads);
+    // Moves every sprite over to a different spatial index.
+    void SetBackend(SpatialBackend backend);
+
+    // Publishes a snapshot of the quad tree at the end of every Update so
+    // other threads can query it without locking. Returns null if the
+    // current backend is not the quad tree. Switching backends drops it.
+    QuadTreeSnapshots *EnableSnapshots();
+
+    // Keeps a second quad tree which a worker thread rebuilds from the new
+    // sprite positions while the current tree serves collision and drawing.
+    // The two are swapped at the start of the next Update. Returns false if
+    // the current backend is not the quad tree or continuous collision is
+    // on. Switching backends drops it.
+    bool SetDoubleBuffered(bool enabled);
+    bool IsDoubleBuffered() const { return _Rebuilder != nullptr; }
+
+    // Carries the collision pairs over from frame to frame, only sprites
+    // which changed leaves are looked up in the tree again. The cache also
+    // has the pairs which began and ended each frame. Returns false if the
+    // current backend is not the quad tree. Switching backends drops it.
+    bool SetPairCache(bool enabled);
+    QuadTreePairCache *GetPairCache() const { return _PairCache.get(); }
+
+    // Puts the box each sprite sweeps over the step in the index instead of
+    // where it ends up. Candidate pairs get a time of impact and are resolved
+    // earliest first, a sprite stopping where it first hits something.
+    // Turns off the double buffered rebuild, which only sees end positions.
+    void SetContinuousCollision(bool enabled);
+    bool IsContinuousCollision() const { return _ContinuousCollision; }
+
+    // Adds a sprite to the running scene, returns its id.
+    int Spawn(Vec2 position, Vec2 velocity, Rect BB);
 
     void Update(chrono::milliseconds deltaMs);
+    const SceneUpdateTimings &GetLastUpdateTimings() const { return _Timings; }
     void Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs);
     void Clean();
+
+private:
+    template <class Index>
+    void BuildWith(Index &index);
+    template <class Index>
+    void UpdateWith(Index &index, chrono::milliseconds deltaMs);
+
+    template <class Index>
+    void UpdateContinuous(Index &index, chrono::milliseconds deltaMs);
+    void UpdateDoubleBuffered(QuadTreeIndex &index, chrono::milliseconds deltaMs);
+    void SwapInRebuiltTree(QuadTree &front);
+
+    void CreateIndex(SpatialBackend backend);
+    template <class Index>
+    void FindCollisionPairs(Index &index);
+    void ApplyCollisions();
 };
@@ -0,0 +1,392 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+#include "scene_replay.h"
+
+// Record tags.
+static const uint64_t REPLAY_UPDATE = 0;
+static const uint64_t REPLAY_END = 1;
+
+// Scene state flags in the header.
+static const int REPLAY_PAIR_CACHE = 1;
+static const int REPLAY_DOUBLE_BUFFERED = 2;
+static const int REPLAY_CONTINUOUS = 4;
+
+static uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// The sprite fields as stored, floats by their bits.
+static void spriteFields(const SceneEvent &sprite, uint32_t (&fields)[6])
+{
+    fields[0] = floatBits(sprite.x);
+    fields[1] = floatBits(sprite.y);
+    fields[2] = floatBits(sprite.vx);
+    fields[3] = floatBits(sprite.vy);
+    fields[4] = (uint32_t)sprite.w;
+    fields[5] = (uint32_t)sprite.h;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void ApplySceneEvent(Scene &scene, const SceneEvent &event)
+{
+    switch (event.type)
+    {
+    case SceneEventType::Spawn:
+        scene.Spawn(Vec2(event.x, event.y), Vec2(event.vx, event.vy), Rect(0, 0, event.w, event.h));
+        break;
+    case SceneEventType::SetBackend:
+        scene.SetBackend((SpatialBackend)event.value);
+        break;
+    case SceneEventType::SetPairCache:
+        scene.SetPairCache(event.value != 0);
+        break;
+    case SceneEventType::SetDoubleBuffered:
+        scene.SetDoubleBuffered(event.value != 0);
+        break;
+    case SceneEventType::SetContinuousCollision:
+        scene.SetContinuousCollision(event.value != 0);
+        break;
+    }
+}
+
+SceneEvent RandomSpawnEvent(const Rect &world)
+{
+    const int maxSpriteVelocity = g_Settings.MaxSpriteVelocity;
+    SceneEvent sprite;
+    sprite.type = SceneEventType::Spawn;
+    sprite.x = (float)(rand() % world.W2()) - world.W4();
+    sprite.y = (float)(rand() % world.H2()) - world.H4();
+    sprite.vx = (float)((rand() % 1000) / 1000.0) * maxSpriteVelocity - maxSpriteVelocity / 2;
+    sprite.vy = (float)((rand() % 1000) / 1000.0) * maxSpriteVelocity - maxSpriteVelocity / 2;
+    sprite.w = g_Settings.MinRectSize + (rand() % g_Settings.MaxRectSize);
+    sprite.h = sprite.w;
+    return sprite;
+}
+
+uint64_t HashScene(const Scene &scene)
+{
+    const SpriteSystem &sprites = scene._Sprites;
+    const int size = sprites.Size();
+    uint64_t hash = fnv1a(14695981039346656037ull, &size, sizeof(size));
+    hash = fnv1a(hash, sprites._X.data(), size * sizeof(float));
+    hash = fnv1a(hash, sprites._Y.data(), size * sizeof(float));
+    hash = fnv1a(hash, sprites._Vx.data(), size * sizeof(float));
+    hash = fnv1a(hash, sprites._Vy.data(), size * sizeof(float));
+    hash = fnv1a(hash, sprites._W.data(), size * sizeof(float));
+    hash = fnv1a(hash, sprites._H.data(), size * sizeof(float));
+    return fnv1a(hash, sprites._Colliding.data(), sprites._Colliding.size() * sizeof(uint64_t));
+}
+
+SceneRecorder::~SceneRecorder()
+{
+    if (_File != nullptr)
+    {
+        fclose(_File);
+    }
+}
+
+void SceneRecorder::WriteVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((int)(value & 0x7f) | 0x80, _File);
+        value >>= 7;
+    }
+    fputc((int)value, _File);
+}
+
+// Zigzag, so small negative differences stay short too.
+void SceneRecorder::WriteSigned(int64_t value)
+{
+    WriteVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void SceneRecorder::WriteSprite(const SceneEvent &sprite)
+{
+    uint32_t fields[6];
+    uint32_t last[6];
+    spriteFields(sprite, fields);
+    spriteFields(_LastSprite, last);
+    for (int f = 0; f < 6; f++)
+    {
+        WriteSigned((int32_t)(fields[f] - last[f]));
+    }
+    _LastSprite = sprite;
+}
+
+bool SceneRecorder::Open(const char *path, const Scene &scene)
+{
+    if (_File != nullptr)
+    {
+        fclose(_File);
+    }
+    _File = fopen(path, "wb");
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    _LastSprite = SceneEvent();
+    _LastDelta = 0;
+
+    int flags = 0;
+    flags |= scene.GetPairCache() != nullptr ? REPLAY_PAIR_CACHE : 0;
+    flags |= scene.IsDoubleBuffered() ? REPLAY_DOUBLE_BUFFERED : 0;
+    flags |= scene.IsContinuousCollision() ? REPLAY_CONTINUOUS : 0;
+
+    fwrite(SCENE_REPLAY_MAGIC, 1, sizeof(SCENE_REPLAY_MAGIC), _File);
+    WriteVarint((uint64_t)scene._WorldBox.w);
+    WriteVarint((uint64_t)scene._WorldBox.h);
+    WriteVarint((uint64_t)scene._Backend);
+    WriteVarint((uint64_t)flags);
+
+    const SpriteSystem &sprites = scene._Sprites;
+    WriteVarint((uint64_t)sprites.Size());
+    for (int i = 0; i < sprites.Size(); i++)
+    {
+        SceneEvent sprite;
+        sprite.x = sprites._X[i];
+        sprite.y = sprites._Y[i];
+        sprite.vx = sprites._Vx[i];
+        sprite.vy = sprites._Vy[i];
+        sprite.w = (int)sprites._W[i];
+        sprite.h = (int)sprites._H[i];
+        WriteSprite(sprite);
+    }
+    return ferror(_File) == 0;
+}
+
+void SceneRecorder::WriteUpdate(chrono::milliseconds deltaMs, const vector<SceneEvent> &events)
+{
+    if (_File == nullptr)
+    {
+        return;
+    }
+    WriteVarint(REPLAY_UPDATE);
+    WriteSigned((int64_t)deltaMs.count() - _LastDelta);
+    _LastDelta = (int64_t)deltaMs.count();
+    WriteVarint(events.size());
+    for (const SceneEvent &event : events)
+    {
+        WriteVarint((uint64_t)event.type);
+        if (event.type == SceneEventType::Spawn)
+        {
+            WriteSprite(event);
+        }
+        else
+        {
+            WriteVarint((uint64_t)event.value);
+        }
+    }
+}
+
+bool SceneRecorder::Close(const Scene &scene)
+{
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    WriteVarint(REPLAY_END);
+    WriteVarint(HashScene(scene));
+    const bool ok = ferror(_File) == 0;
+    const bool closed = fclose(_File) == 0;
+    _File = nullptr;
+    return ok && closed;
+}
+
+SceneReplay::~SceneReplay()
+{
+    Close();
+}
+
+bool SceneReplay::ReadVarint(uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        const int c = fgetc(_File);
+        if (c == EOF)
+        {
+            return false;
+        }
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SceneReplay::ReadSigned(int64_t &value)
+{
+    uint64_t zigzag;
+    if (!ReadVarint(zigzag))
+    {
+        return false;
+    }
+    value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return true;
+}
+
+bool SceneReplay::ReadSprite(SceneEvent &sprite)
+{
+    uint32_t fields[6];
+    spriteFields(_LastSprite, fields);
+    for (int f = 0; f < 6; f++)
+    {
+        int64_t delta;
+        if (!ReadSigned(delta))
+        {
+            return false;
+        }
+        fields[f] += (uint32_t)delta;
+    }
+    sprite.x = bitsFloat(fields[0]);
+    sprite.y = bitsFloat(fields[1]);
+    sprite.vx = bitsFloat(fields[2]);
+    sprite.vy = bitsFloat(fields[3]);
+    sprite.w = (int)fields[4];
+    sprite.h = (int)fields[5];
+    _LastSprite = sprite;
+    return true;
+}
+
+bool SceneReplay::Open(const char *path)
+{
+    Close();
+    _File = fopen(path, "rb");
+    if (_File == nullptr)
+    {
+        return false;
+    }
+    char magic[sizeof(SCENE_REPLAY_MAGIC)];
+    uint64_t width, height, backend, flags, numSprites;
+    if (fread(magic, 1, sizeof(magic), _File) != sizeof(magic) ||
+        memcmp(magic, SCENE_REPLAY_MAGIC, sizeof(magic)) != 0 ||
+        !ReadVarint(width) ||
+        !ReadVarint(height) ||
+        !ReadVarint(backend) ||
+        !ReadVarint(flags) ||
+        !ReadVarint(numSprites) ||
+        backend > (uint64_t)SpatialBackend::BruteForce)
+    {
+        Close();
+        return false;
+    }
+    _WorldWidth = (int)width;
+    _WorldHeight = (int)height;
+    _Backend = (SpatialBackend)backend;
+    _Flags = (int)flags;
+    _NumSprites = (int)numSprites;
+    return true;
+}
+
+void SceneReplay::Close()
+{
+    if (_File != nullptr)
+    {
+        fclose(_File);
+        _File = nullptr;
+    }
+    _LastSprite = SceneEvent();
+    _LastDelta = 0;
+    _HasFinalHash = false;
+    _FinalHash = 0;
+}
+
+unique_ptr<Scene> SceneReplay::CreateScene(int collisionThreads, const SpatialIndexParams &params)
+{
+    auto scene = make_unique<Scene>(Rect(0, 0, _WorldWidth, _WorldHeight), _Backend, params);
+    if (collisionThreads != g_Settings.CollisionThreads)
+    {
+        scene->SetCollisionThreads(collisionThreads);
+    }
+    scene->_Sprites.Reserve(_NumSprites);
+    for (int i = 0; i < _NumSprites; i++)
+    {
+        SceneEvent sprite;
+        if (!ReadSprite(sprite))
+        {
+            break;
+        }
+        scene->_Sprites.Add(Vec2(sprite.x, sprite.y), Vec2(sprite.vx, sprite.vy), Rect(0, 0, sprite.w, sprite.h));
+    }
+    scene->Build();
+    scene->SetContinuousCollision((_Flags & REPLAY_CONTINUOUS) != 0);
+    scene->SetDoubleBuffered((_Flags & REPLAY_DOUBLE_BUFFERED) != 0);
+    scene->SetPairCache((_Flags & REPLAY_PAIR_CACHE) != 0);
+    return scene;
+}
+
+bool SceneReplay::ReadUpdate(chrono::milliseconds &deltaMs, vector<SceneEvent> &events)
+{
+    events.clear();
+    uint64_t tag;
+    if (_File == nullptr || !ReadVarint(tag))
+    {
+        return false;
+    }
+    if (tag == REPLAY_END)
+    {
+        _HasFinalHash = ReadVarint(_FinalHash);
+        return false;
+    }
+
+    int64_t delta;
+    uint64_t numEvents;
+    if (tag != REPLAY_UPDATE || !ReadSigned(delta) || !ReadVarint(numEvents))
+    {
+        return false;
+    }
+    _LastDelta += delta;
+    for (uint64_t i = 0; i < numEvents; i++)
+    {
+        uint64_t type;
+        SceneEvent event;
+        if (!ReadVarint(type))
+        {
+            return false;
+        }
+        event.type = (SceneEventType)type;
+        if (event.type == SceneEventType::Spawn)
+        {
+            if (!ReadSprite(event))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            uint64_t value;
+            if (!ReadVarint(value))
+            {
+                return false;
+            }
+            event.value = (int)value;
+        }
+        events.push_back(event);
+    }
+    deltaMs = chrono::milliseconds(_LastDelta);
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <stdio.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "consts.h"
+#include "jmath.h"
+#include "spatial_index.h"
+
+using namespace std;
+
+class Scene;
+
+// Recording of a Scene run: its starting state and, for every Update, the
+// delta and the changes made to the scene just before it. Replaying it
+// repeats the same Update calls, so with the same build the sprites end up
+// bit for bit the same. The file is a stream of varints with every value
+// stored as the difference to the previous one of its kind, most frames
+// take three bytes.
+
+static const char SCENE_REPLAY_MAGIC[8] = {'J', 'R', 'E', 'P', 'L', 'A', 'Y', '1'};
+
+enum class SceneEventType
+{
+    Spawn,
+    SetBackend,
+    SetPairCache,
+    SetDoubleBuffered,
+    SetContinuousCollision
+};
+
+struct SceneEvent
+{
+    SceneEventType type;
+    // The backend, or 0/1 for the other setters.
+    int value = 0;
+    // Spawn only.
+    float x = 0, y = 0, vx = 0, vy = 0;
+    int w = 0, h = 0;
+};
+
+void ApplySceneEvent(Scene &scene, const SceneEvent &event);
+
+// A Spawn somewhere in the middle half of 'world' with a random velocity and
+// size from g_Settings, drawn from rand(). Both the SDL build and the
+// headless one place their sprites with it.
+SceneEvent RandomSpawnEvent(const Rect &world);
+
+// Hash of every sprite's position, velocity, size and collision flag.
+uint64_t HashScene(const Scene &scene);
+
+class SceneRecorder
+{
+public:
+    SceneRecorder() = default;
+    ~SceneRecorder();
+    SceneRecorder(const SceneRecorder &) = delete;
+    SceneRecorder &operator=(const SceneRecorder &) = delete;
+
+    // Writes out the current state of 'scene'.
+    bool Open(const char *path, const Scene &scene);
+    bool IsOpen() const { return _File != nullptr; }
+
+    // Logs an Update and the changes applied right before it. For the
+    // replay to match, nothing else may change the scene between Updates.
+    void WriteUpdate(chrono::milliseconds deltaMs, const vector<SceneEvent> &events);
+
+    // Ends the recording with the hash of 'scene'. False if anything failed
+    // to write.
+    bool Close(const Scene &scene);
+
+private:
+    void WriteVarint(uint64_t value);
+    void WriteSigned(int64_t value);
+    void WriteSprite(const SceneEvent &sprite);
+
+    FILE *_File = nullptr;
+    // Sprites and deltas are stored relative to the previous one.
+    SceneEvent _LastSprite;
+    int64_t _LastDelta = 0;
+};
+
+class SceneReplay
+{
+public:
+    SceneReplay() = default;
+    ~SceneReplay();
+    SceneReplay(const SceneReplay &) = delete;
+    SceneReplay &operator=(const SceneReplay &) = delete;
+
+    bool Open(const char *path);
+    void Close();
+
+    // A scene in the recorded starting state. Once, before ReadUpdate. The
+    // index parameters aren't part of the recording.
+    unique_ptr<Scene> CreateScene(int collisionThreads = g_Settings.CollisionThreads,
+                                  const SpatialIndexParams &params = SpatialIndexParams());
+
+    // Reads the next Update and the changes to apply right before it. False
+    // once the recording is over.
+    bool ReadUpdate(chrono::milliseconds &deltaMs, vector<SceneEvent> &events);
+
+    // The hash the recorded run ended with, if it got to write one.
+    bool HasFinalHash() const { return _HasFinalHash; }
+    uint64_t GetFinalHash() const { return _FinalHash; }
+
+private:
+    bool ReadVarint(uint64_t &value);
+    bool ReadSigned(int64_t &value);
+    bool ReadSprite(SceneEvent &sprite);
+
+    FILE *_File = nullptr;
+    int _WorldWidth = 0;
+    int _WorldHeight = 0;
+    SpatialBackend _Backend = SpatialBackend::QuadTree;
+    int _Flags = 0;
+    int _NumSprites = 0;
+    SceneEvent _LastSprite;
+    int64_t _LastDelta = 0;
+    bool _HasFinalHash = false;
+    uint64_t _FinalHash = 0;
+};
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "scene.h"
+#include "scene_replay.h"
+#include "scene_tools.h"
+#include "jthread_pool.h"
+
+typedef chrono::high_resolution_clock rclock;
+
+static void printListStats(const char *name, const QuadListStats &list)
+{
+    printf("  %-13s %8d / %8d slots, %6d free, %8.1f / %8.1f KB\n",
+           name, list.size, list.capacity, list.freeSlots,
+           list.bytesUsed / 1024.0, list.bytesReserved / 1024.0);
+}
+
+void PrintMemoryStats(const QuadTreeMemoryStats &stats)
+{
+    printf("Quad Tree Memory: %.1f / %.1f KB used\n", stats.bytesUsed / 1024.0, stats.bytesReserved / 1024.0);
+    printListStats("elements", stats.elements);
+    printListStats("element nodes", stats.elementNodes);
+    printListStats("nodes", stats.nodes);
+    printf("  %d leaves, %.2f element nodes per element, occupancy:", stats.leaves, stats.duplication);
+    for (int i = 0; i < QuadTreeMemoryStats::HISTOGRAM_BUCKETS; i++)
+    {
+        printf(" %d", stats.leafHistogram[i]);
+    }
+    printf("\n");
+}
+
+int IndexRectFile(const char *path, Rect world, const SpatialIndexParams &params, int chunkSize, int threads)
+{
+    QuadTree tree(world, params.maxDepth, params.splitThreshold);
+    tree.SetFreeListPolicy(params.freePolicy);
+    ThreadPool pool(threads);
+    RectLoadStats stats;
+    auto start = rclock::now();
+    if (!LoadRectFile(tree, path, chunkSize, true, &pool, &stats))
+    {
+        printf("Could not open '%s'\n", path);
+        return 1;
+    }
+    const double totalMs = chrono::duration<double, milli>(rclock::now() - start).count();
+    printf("Indexed %lld rects (%lld skipped) from '%s' in %.1f ms, %.2f M rects/s\n",
+           (long long)stats.rects, (long long)stats.errors, path, totalMs,
+           totalMs > 0 ? stats.rects / totalMs / 1000.0 : 0.0);
+    printf("  waiting on the file %.1f ms, appending %.1f ms, building %.1f ms\n",
+           stats.readMs, stats.appendMs, stats.buildMs);
+    PrintMemoryStats(tree.GetMemoryStats());
+    return 0;
+}
+
+int ConvertRectFile(const char *input, const char *output, int chunkSize)
+{
+    RectFileReader reader;
+    RectFileWriter writer;
+    if (!reader.Open(input, chunkSize, true) || !writer.Open(output))
+    {
+        printf("Could not open '%s' or '%s'\n", input, output);
+        return 1;
+    }
+    RectChunk chunk;
+    while (reader.Read(chunk))
+    {
+        writer.Write(chunk.ids.data(), chunk.rects.data(), (int)chunk.rects.size());
+    }
+    if (!writer.Close())
+    {
+        printf("Could not write '%s'\n", output);
+        return 1;
+    }
+    printf("Wrote %lld rects (%lld skipped) to '%s'\n",
+           (long long)reader.NumRead(), (long long)reader.NumErrors(), output);
+    return 0;
+}
+
+int ReplayRecording(const char *path, int threads, const SpatialIndexParams &params)
+{
+    SceneReplay replay;
+    if (!replay.Open(path))
+    {
+        printf("Could not read recording '%s'\n", path);
+        return 1;
+    }
+    unique_ptr<Scene> scene = replay.CreateScene(threads, params);
+    // The live loop cleans the tree after every frame it draws.
+    scene->Clean();
+
+    int frames = 0;
+    double updateMs = 0;
+    double cleanMs = 0;
+    SceneUpdateTimings phases;
+    chrono::milliseconds deltaMs;
+    vector<SceneEvent> events;
+    while (replay.ReadUpdate(deltaMs, events))
+    {
+        for (const SceneEvent &event : events)
+        {
+            ApplySceneEvent(*scene, event);
+        }
+        auto start = rclock::now();
+        scene->Update(deltaMs);
+        auto updated = rclock::now();
+        scene->Clean();
+        updateMs += chrono::duration<double, milli>(updated - start).count();
+        cleanMs += chrono::duration<double, milli>(rclock::now() - updated).count();
+
+        const SceneUpdateTimings &timings = scene->GetLastUpdateTimings();
+        phases.findPairsMs += timings.findPairsMs;
+        phases.collideMs += timings.collideMs;
+        phases.integrateMs += timings.integrateMs;
+        phases.indexMs += timings.indexMs;
+        frames++;
+    }
+
+    const double perFrame = frames > 0 ? 1.0 / frames : 0.0;
+    printf("Replayed %d updates of %d sprites in %.1f ms, %.3f ms per update\n",
+           frames, scene->_Sprites.Size(), updateMs + cleanMs, (updateMs + cleanMs) * perFrame);
+    printf("  find pairs %.3f ms, collide %.3f ms, integrate %.3f ms, index %.3f ms, clean %.3f ms\n",
+           phases.findPairsMs * perFrame, phases.collideMs * perFrame,
+           phases.integrateMs * perFrame, phases.indexMs * perFrame, cleanMs * perFrame);
+
+    const uint64_t hash = HashScene(*scene);
+    if (!replay.HasFinalHash())
+    {
+        printf("State hash %016llx, the recording has none to compare with\n", (unsigned long long)hash);
+        return 0;
+    }
+    const bool match = hash == replay.GetFinalHash();
+    printf("State hash %016llx %s the recorded %016llx\n",
+           (unsigned long long)hash, match ? "matches" : "DOES NOT match",
+           (unsigned long long)replay.GetFinalHash());
+    return match ? 0 : 1;
+}
+
+int CheckSimd()
+{
+    const bool update = SpriteSystem::CheckSimdUpdate();
+    const bool collide = SpriteSystem::CheckSimdCollide();
+    printf("SIMD sprite update %s the scalar one\n", update ? "matches" : "DOES NOT match");
+    printf("SIMD collision response %s the scalar one\n", collide ? "matches" : "DOES NOT match");
+    return update && collide ? 0 : 1;
+}
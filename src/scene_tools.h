@@ -0,0 +1,35 @@
+#pragma once
+
+#include "jmath.h"
+#include "jquad.h"
+#include "jrect_file.h"
+#include "spatial_index.h"
+
+// Runs that take the place of the simulation loop, shared by the windowed
+// and the headless build. Each prints what it found and returns the exit
+// code for main.
+
+void PrintMemoryStats(const QuadTreeMemoryStats &stats);
+
+// Streams a rect dataset into a quad tree covering 'world' and reports how
+// long it took.
+int IndexRectFile(const char *path,
+                  Rect world,
+                  const SpatialIndexParams &params,
+                  int chunkSize = RECT_FILE_CHUNK,
+                  int threads = 0);
+
+// Rewrites a rect dataset (CSV or binary) in the binary format.
+int ConvertRectFile(const char *input, const char *output, int chunkSize = RECT_FILE_CHUNK);
+
+// Runs the Updates of a recording back to back and reports where the time
+// went, then whether the sprites ended up where the recorded run left them.
+// The index parameters aren't recorded, a run made with other ones than the
+// defaults only matches when given the same.
+int ReplayRecording(const char *path,
+                    int threads,
+                    const SpatialIndexParams &params = SpatialIndexParams());
+
+// Compares the SIMD sprite update and collision response with the scalar
+// ones, see SpriteSystem::CheckSimdUpdate.
+int CheckSimd();
@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "spatial_index.h"
+#include "jrender.h"
+
+// ---------------------------------------------------------------------------------
+// QuadTreeIndex
+// ---------------------------------------------------------------------------------
+void QuadTreeIndex::Query(Rect query, vector<int> &output)
+{
+    _Seen.clear();
+    _Results.clear();
+    _Tree.Query(query, _Seen, &_Results);
+    for (int elementIndex : _Results)
+    {
+        output.push_back(_Tree._Elements.GetId(elementIndex));
+    }
+}
+
+void QuadTreeIndex::FindPairs(vector<pair<int, int>> &output)
+{
+    _Tree.FindPairs(output, _Pool);
+}
+
+// ---------------------------------------------------------------------------------
+// UniformGridIndex
+// ---------------------------------------------------------------------------------
+void UniformGridIndex::Query(Rect query, vector<int> &output)
+{
+    _Seen.clear();
+    _Results.clear();
+    _Grid.Query(query, _Seen, &_Results);
+    for (int elementIndex : _Results)
+    {
+        output.push_back(_Grid._Elements.GetId(elementIndex));
+    }
+}
+
+// ---------------------------------------------------------------------------------
+// BruteForceIndex
+// ---------------------------------------------------------------------------------
+int BruteForceIndex::Insert(int id, Rect &rect)
+{
+    const int elementIndex = _Elements.Add(id, rect.L(), rect.T(), rect.R(), rect.B());
+    if (elementIndex >= (int)_Alive.size())
+    {
+        _Alive.resize(elementIndex + 1, false);
+    }
+    _Alive[elementIndex] = true;
+    return elementIndex;
+}
+
+void BruteForceIndex::Remove(int elementIndex)
+{
+    _Elements.erase(elementIndex);
+    _Alive[elementIndex] = false;
+}
+
+int BruteForceIndex::Move(int elementIndex, Rect &rect)
+{
+    _Elements.SetLeft(elementIndex, rect.L());
+    _Elements.SetTop(elementIndex, rect.T());
+    _Elements.SetRight(elementIndex, rect.R());
+    _Elements.SetBottom(elementIndex, rect.B());
+    return elementIndex;
+}
+
+void BruteForceIndex::Query(Rect query, vector<int> &output)
+{
+    for (int i = 0; i < (int)_Alive.size(); i++)
+    {
+        if (_Alive[i] && query.Intersects(_Elements.GetRect(i)))
+        {
+            output.push_back(_Elements.GetId(i));
+        }
+    }
+}
+
+void BruteForceIndex::FindPairs(vector<pair<int, int>> &output)
+{
+    const int num = (int)_Alive.size();
+    for (int i = 0; i < num; i++)
+    {
+        if (!_Alive[i])
+        {
+            continue;
+        }
+        const int aLeft = _Elements.GetLeft(i);
+        const int aTop = _Elements.GetTop(i);
+        const int aRight = _Elements.GetRight(i);
+        const int aBottom = _Elements.GetBottom(i);
+        for (int j = i + 1; j < num; j++)
+        {
+            if (_Alive[j] &&
+                aLeft < _Elements.GetRight(j) &&
+                aRight > _Elements.GetLeft(j) &&
+                aTop > _Elements.GetBottom(j) &&
+                aBottom < _Elements.GetTop(j))
+            {
+                output.emplace_back(_Elements.GetId(i), _Elements.GetId(j));
+            }
+        }
+    }
+}
+
+#ifndef NOIN_HEADLESS
+void BruteForceIndex::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs, bool renderRects)
+{
+    if (!renderRects)
+    {
+        return;
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+    for (int i = 0; i < (int)_Alive.size(); i++)
+    {
+        if (!_Alive[i])
+        {
+            continue;
+        }
+        const int left = _Elements.GetLeft(i);
+        const int top = _Elements.GetTop(i);
+        Vec2 newPos = transform * Vec2(left, top);
+        SDL_Rect rect = {
+            (int)newPos.x,
+            (int)newPos.y,
+            abs(_Elements.GetRight(i) - left),
+            abs(top - _Elements.GetBottom(i))};
+        SDL_RenderDrawRect(renderer, &rect);
+    }
+}
+#endif
+
+// ---------------------------------------------------------------------------------
+// Backend selection
+// ---------------------------------------------------------------------------------
+void CreateSpatialIndex(SpatialIndex &index, SpatialBackend backend, Rect bounds, const SpatialIndexParams &params)
+{
+    switch (backend)
+    {
+    case SpatialBackend::QuadTree:
+        index.emplace<QuadTreeIndex>(
+            bounds,
+            params.maxDepth,
+            params.splitThreshold);
+        break;
+    case SpatialBackend::UniformGrid:
+        index.emplace<UniformGridIndex>(
+            bounds,
+            params.gridCellSize,
+            params.gridCellSize);
+        break;
+    case SpatialBackend::CQuadTree:
+        index.emplace<CQuadTreeIndex>(
+            bounds,
+            params.maxDepth,
+            params.splitThreshold);
+        break;
+    case SpatialBackend::BruteForce:
+        index.emplace<BruteForceIndex>();
+        break;
+    }
+}
+
+const char *SpatialBackendName(SpatialBackend backend)
+{
+    switch (backend)
+    {
+    case SpatialBackend::QuadTree:
+        return "quad";
+    case SpatialBackend::UniformGrid:
+        return "grid";
+    case SpatialBackend::CQuadTree:
+        return "cquad";
+    case SpatialBackend::BruteForce:
+        return "brute";
+    }
+    return "unknown";
+}
+
+bool ParseSpatialBackend(const char *name, SpatialBackend &backend)
+{
+    const SpatialBackend all[] = {
+        SpatialBackend::QuadTree,
+        SpatialBackend::UniformGrid,
+        SpatialBackend::CQuadTree,
+        SpatialBackend::BruteForce};
+    for (SpatialBackend candidate : all)
+    {
+        if (strcmp(name, SpatialBackendName(candidate)) == 0)
+        {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <chrono>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <unordered_map>
+
+#include "consts.h"
+#include "jmath.h"
+#include "jquad.h"
+#include "jgrid.h"
+#include "cquad_index.h"
+#include "jrender.h"
+
+using namespace std;
+
+// ---------------------------------------------------------------------------------
+// Spatial Index Interface
+// ---------------------------------------------------------------------------------
+// Every backend exposes the same handful of members. Handles returned from
+// Insert/Move are backend specific, ids are whatever the caller passed in.
+//
+//   int  Insert(int id, Rect &rect)
+//   void Remove(int handle)
+//   int  Move(int handle, Rect &rect)           returns the new handle
+//   void Query(Rect query, vector<int> &ids)    appends ids intersecting query
+//   void FindPairs(vector<pair<int, int>> &ids) appends every intersecting pair once
+//   void Clean()
+//   void Draw(SDL_Renderer *, Mat3 &, chrono::milliseconds, bool renderRects)
+//
+// There is no base class. Callers are templated on the backend and dispatch
+// once per frame through std::visit, so nothing on the hot path is virtual.
+template <class T, class = void>
+struct IsSpatialIndex : false_type
+{
+};
+
+template <class T>
+struct IsSpatialIndex<T, void_t<
+                             decltype(declval<int &>() = declval<T &>().Insert(0, declval<Rect &>())),
+                             decltype(declval<T &>().Remove(0)),
+                             decltype(declval<int &>() = declval<T &>().Move(0, declval<Rect &>())),
+                             decltype(declval<T &>().Query(declval<Rect>(), declval<vector<int> &>())),
+                             decltype(declval<T &>().FindPairs(declval<vector<pair<int, int>> &>())),
+                             decltype(declval<T &>().Clean()),
+                             decltype(declval<T &>().Draw(
+                                 declval<SDL_Renderer *>(),
+                                 declval<Mat3 &>(),
+                                 declval<chrono::milliseconds>(),
+                                 false))>> : true_type
+{
+};
+
+class QuadTreeIndex
+{
+public:
+    QuadTree _Tree;
+    // Optional, splits FindPairs over its workers. Not owned.
+    ThreadPool *_Pool = nullptr;
+
+    QuadTreeIndex(Rect bounds, int maxDepth, int splitThreshold)
+        : _Tree(bounds, maxDepth, splitThreshold) {}
+
+    int Insert(int id, Rect &rect) { return _Tree.Insert(id, rect); }
+    void Remove(int elementIndex) { _Tree.Remove(elementIndex); }
+    int Move(int elementIndex, Rect &rect) { return _Tree.Move(elementIndex, rect); }
+    int Move(int elementIndex, Rect &rect, int margin) { return _Tree.Move(elementIndex, rect, margin); }
+    void Query(Rect query, vector<int> &output);
+    void FindPairs(vector<pair<int, int>> &output);
+    void Clean() { _Tree.Clean(); }
+    void Draw(SDL_Renderer *renderer,
+              Mat3 &transform,
+              chrono::milliseconds deltaMs,
+              bool renderRects)
+    {
+        _Tree.Draw(renderer, transform, deltaMs, renderRects);
+    }
+
+private:
+    unordered_map<int, bool> _Seen;
+    vector<int> _Results;
+};
+
+class UniformGridIndex
+{
+public:
+    UniformGrid _Grid;
+
+    UniformGridIndex(Rect bounds, int cellW, int cellH)
+        : _Grid(bounds, cellW, cellH) {}
+
+    int Insert(int id, Rect &rect) { return _Grid.Insert(id, rect); }
+    void Remove(int elementIndex) { _Grid.Remove(elementIndex); }
+    int Move(int elementIndex, Rect &rect) { return _Grid.Move(elementIndex, rect); }
+    void Query(Rect query, vector<int> &output);
+    void FindPairs(vector<pair<int, int>> &output) { _Grid.FindPairs(output); }
+    void Clean() { _Grid.Clean(); }
+    void Draw(SDL_Renderer *renderer,
+              Mat3 &transform,
+              chrono::milliseconds deltaMs,
+              bool renderRects)
+    {
+        _Grid.Draw(renderer, transform, deltaMs, renderRects);
+    }
+
+private:
+    unordered_map<int, bool> _Seen;
+    vector<int> _Results;
+};
+
+// O(n^2) reference. Useful as ground truth and as the baseline to beat.
+class BruteForceIndex
+{
+public:
+    QuadElementIntList _Elements;
+
+    int Insert(int id, Rect &rect);
+    void Remove(int elementIndex);
+    int Move(int elementIndex, Rect &rect);
+    void Query(Rect query, vector<int> &output);
+    void FindPairs(vector<pair<int, int>> &output);
+    void Clean() {}
+    void Draw(SDL_Renderer *renderer,
+              Mat3 &transform,
+              chrono::milliseconds deltaMs,
+              bool renderRects);
+
+private:
+    // Erased slots have their first field reused by the free list.
+    vector<bool> _Alive;
+};
+
+static_assert(IsSpatialIndex<QuadTreeIndex>::value, "QuadTreeIndex is not a spatial index");
+static_assert(IsSpatialIndex<UniformGridIndex>::value, "UniformGridIndex is not a spatial index");
+static_assert(IsSpatialIndex<CQuadTreeIndex>::value, "CQuadTreeIndex is not a spatial index");
+static_assert(IsSpatialIndex<BruteForceIndex>::value, "BruteForceIndex is not a spatial index");
+
+// The first alternative is only there so the variant is default constructible.
+// Use CreateSpatialIndex to pick the backend. None of the backends are safe
+// to copy or move, always construct them in place.
+using SpatialIndex = variant<BruteForceIndex, QuadTreeIndex, UniformGridIndex, CQuadTreeIndex>;
+
+// Shape of the trees and the grid, g_Settings unless told otherwise.
+struct SpatialIndexParams
+{
+    int maxDepth = g_Settings.MaxQuadTreeDepth;
+    int splitThreshold = g_Settings.QuadTreeSplitThreshold;
+    int gridCellSize = g_Settings.GridCellSize;
+    // Quad tree only, see QuadTree::SetFreeListPolicy.
+    FreeListPolicy freePolicy = FreeListPolicy::Lifo;
+};
+
+void CreateSpatialIndex(SpatialIndex &index,
+                        SpatialBackend backend,
+                        Rect bounds,
+                        const SpatialIndexParams &params = SpatialIndexParams());
+
+const char *SpatialBackendName(SpatialBackend backend);
+
+// Accepts the names returned by SpatialBackendName. Returns false on unknown names.
+bool ParseSpatialBackend(const char *name, SpatialBackend &backend);
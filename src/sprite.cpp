@@ -1,93 +1,234 @@
+#include <math.h>
+#include <algorithm>
 #include <chrono>
-#include <SDL_render.h>
 
 #include "sprite.h"
+#include "sprite_simd.h"
 #include "consts.h"
 #include "jmath.h"
+#include "jrender.h"
 
 using namespace std;
 
-Sprite::Sprite(int Id, Vec2 position, Vec2 velocity, Rect BB)
-    : _Position(position),
-      _Velocity(velocity),
-      _BoundingBox(BB),
-      _Id(Id),
-      _QuadId(-1) {};
+int SpriteSystem::Add(Vec2 position, Vec2 velocity, Rect BB)
+{
+    const int id = Size();
+    _X.push_back((float)position.x);
+    _Y.push_back((float)position.y);
+    _Vx.push_back((float)velocity.x);
+    _Vy.push_back((float)velocity.y);
+    _W.push_back((float)BB.w);
+    _H.push_back((float)BB.h);
+    _BoxX.push_back((int)_X.back());
+    _BoxY.push_back((int)_Y.back());
+    _QuadId.push_back(-1);
+    _Colliding.resize((id >> 6) + 1, 0);
+    return id;
+}
+
+void SpriteSystem::Reserve(int count)
+{
+    _X.reserve(count);
+    _Y.reserve(count);
+    _Vx.reserve(count);
+    _Vy.reserve(count);
+    _W.reserve(count);
+    _H.reserve(count);
+    _BoxX.reserve(count);
+    _BoxY.reserve(count);
+    _QuadId.reserve(count);
+    _Colliding.reserve((count + 63) >> 6);
+}
 
-void Sprite::Update(Rect &bounds, chrono::milliseconds delta)
+void SpriteSystem::ClearColliding()
 {
-    _Velocity.Clamp(
-        -g_Settings.MaxSpriteVelocity,
-        g_Settings.MaxSpriteVelocity);
-    _Position += (_Velocity * (float)(delta.count() / 1000.0f));
+    fill(_Colliding.begin(), _Colliding.end(), 0);
+}
 
-    if (_Position.x < bounds.L())
+void SpriteSystem::Update(Rect &bounds, chrono::milliseconds delta)
+{
+    SpriteUpdateParams params;
+    params.maxVelocity = (float)g_Settings.MaxSpriteVelocity;
+    params.dt = (float)(delta.count() / 1000.0f);
+    params.left = (float)bounds.L();
+    params.right = (float)bounds.R();
+    params.top = (float)bounds.T();
+    params.bottom = (float)bounds.B();
+
+    int done = 0;
+    if (_UseSimd && CpuHasAvx2())
     {
-        _Position.x = (float)bounds.L();
-        _Velocity.x = -_Velocity.x;
+        done = UpdateAvx2(*this, params);
     }
-    else if (_Position.x > bounds.R())
+    UpdateScalar(done, Size(), params);
+}
+
+void SpriteSystem::UpdateScalar(int first, int last, const SpriteUpdateParams &params)
+{
+    const float maxVelocity = params.maxVelocity;
+    const float dt = params.dt;
+    const float left = params.left;
+    const float right = params.right;
+    const float top = params.top;
+    const float bottom = params.bottom;
+
+    for (int i = first; i < last; i++)
     {
-        _Position.x = (float)bounds.R();
-        _Velocity.x = -_Velocity.x;
+        float vx = min(max(_Vx[i], -maxVelocity), maxVelocity);
+        float vy = min(max(_Vy[i], -maxVelocity), maxVelocity);
+        float x = _X[i] + vx * dt;
+        float y = _Y[i] + vy * dt;
+
+        if (x < left)
+        {
+            x = left;
+            vx = -vx;
+        }
+        else if (x > right)
+        {
+            x = right;
+            vx = -vx;
+        }
+        if (y < bottom)
+        {
+            y = bottom;
+            vy = -vy;
+        }
+        else if (y > top)
+        {
+            y = top;
+            vy = -vy;
+        }
+
+        _X[i] = x;
+        _Y[i] = y;
+        _Vx[i] = vx;
+        _Vy[i] = vy;
+        _BoxX[i] = (int)x;
+        _BoxY[i] = (int)y;
     }
-    if (_Position.y < bounds.B())
+}
+
+void SpriteSystem::Collide(int a, int b)
+{
+    // Unit direction A to B and its normal.
+    const float dx = _X[b] - _X[a];
+    const float dy = _Y[b] - _Y[a];
+    const float length = sqrtf(dx * dx + dy * dy);
+    const float dirX = dx / length;
+    const float dirY = dy / length;
+    const float normX = -dirY;
+    const float normY = dirX;
+
+    const float aDir = _Vx[a] * dirX + _Vy[a] * dirY;
+    const float bDir = _Vx[b] * dirX + _Vy[b] * dirY;
+    const float aNorm = _Vx[a] * normX + _Vy[a] * normY;
+    const float bNorm = _Vx[b] * normX + _Vy[b] * normY;
+
+    // TODO: Extremely scuff collission resolution logic.
+    // Each keeps its own normal component and takes the other's along dir.
+    _Vx[a] = normX * aNorm + dirX * bDir;
+    _Vy[a] = normY * aNorm + dirY * bDir;
+    _Vx[b] = normX * bNorm + dirX * aDir;
+    _Vy[b] = normY * bNorm + dirY * aDir;
+    _X[a] -= dirX;
+    _Y[a] -= dirY;
+    _X[b] += dirX;
+    _Y[b] += dirY;
+}
+
+void SpriteSystem::CollidePairs(const vector<pair<int, int>> &pairs)
+{
+    if (!_UseSimd || !_UseSimdCollide || !CpuHasAvx2())
     {
-        _Position.y = (float)bounds.B();
-        _Velocity.y = -_Velocity.y;
+        for (auto [a, b] : pairs)
+        {
+            Collide(a, b);
+        }
+        return;
     }
-    else if (_Position.y > bounds.T())
+
+    // Greedy coloring. A pair lands one batch after the last batch either
+    // of its sprites was in, so each sprite still sees its pairs in order.
+    const int numPairs = (int)pairs.size();
+    if ((int)_LastBatch.size() < Size())
     {
-        _Position.y = (float)bounds.T();
-        _Velocity.y = -_Velocity.y;
+        _LastBatch.resize(Size(), -1);
+    }
+    _PairBatch.resize(numPairs);
+    int numBatches = 0;
+    for (int i = 0; i < numPairs; i++)
+    {
+        auto [a, b] = pairs[i];
+        const int batch = max(_LastBatch[a], _LastBatch[b]) + 1;
+        _LastBatch[a] = batch;
+        _LastBatch[b] = batch;
+        _PairBatch[i] = batch;
+        numBatches = max(numBatches, batch + 1);
+    }
+    for (auto [a, b] : pairs)
+    {
+        _LastBatch[a] = -1;
+        _LastBatch[b] = -1;
     }
 
-    _BoundingBox.x = (int)_Position.x;
-    _BoundingBox.y = (int)_Position.y;
-}
-
-void Sprite::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs)
-{
-    Vec2 newPos = transform * _Position;
-    SDL_Rect rect = {
-        (int)newPos.x - _BoundingBox.W2(),
-        (int)newPos.y - _BoundingBox.H2(),
-        _BoundingBox.w,
-        _BoundingBox.h};
-
-    if (_IsColliding)
+    // Counting sort the pairs by batch.
+    _BatchStart.assign(numBatches + 1, 0);
+    for (int i = 0; i < numPairs; i++)
     {
-        SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+        _BatchStart[_PairBatch[i] + 1]++;
     }
-    else
+    for (int batch = 0; batch < numBatches; batch++)
     {
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        _BatchStart[batch + 1] += _BatchStart[batch];
+    }
+    _BatchA.resize(numPairs);
+    _BatchB.resize(numPairs);
+    for (int i = 0; i < numPairs; i++)
+    {
+        const int slot = _BatchStart[_PairBatch[i]]++;
+        _BatchA[slot] = pairs[i].first;
+        _BatchB[slot] = pairs[i].second;
     }
-    SDL_RenderDrawPoint(renderer, (int)newPos.x, (int)newPos.y);
-    SDL_RenderDrawRect(renderer, &rect);
-}
 
-bool Sprite::Intersects(Sprite *other)
-{
-    return _BoundingBox.Intersects(other->_BoundingBox);
+    // _BatchStart[batch] now holds where the next batch starts.
+    int first = 0;
+    for (int batch = 0; batch < numBatches; batch++)
+    {
+        const int last = _BatchStart[batch];
+        int done = first + CollideAvx2(*this, &_BatchA[first], &_BatchB[first], last - first);
+        for (; done < last; done++)
+        {
+            Collide(_BatchA[done], _BatchB[done]);
+        }
+        first = last;
+    }
 }
 
-void Sprite::Collides(Sprite *B)
+#ifndef NOIN_HEADLESS
+void SpriteSystem::Draw(SDL_Renderer *renderer, Mat3 &transform, chrono::milliseconds deltaMs)
 {
-    Sprite *A = this;
-    Vec2 dir = (B->_Position - A->_Position).Normalize(); // A to B
-    Vec2 rdir = dir * -1.0;
-    Vec2 dirNorm = dir.GetNormal();
-    Vec2 rDirNorm = dirNorm * -1.0;
-
-    Vec2 compDirA = dir * A->_Velocity.dot(dir);
-    Vec2 compDirB = rdir * B->_Velocity.dot(rdir);
-    Vec2 compNormA = dirNorm * A->_Velocity.dot(dirNorm);
-    Vec2 compNormB = rDirNorm * B->_Velocity.dot(rDirNorm);
+    const int count = Size();
+    for (int i = 0; i < count; i++)
+    {
+        const Rect box = GetBoundingBox(i);
+        Vec2 newPos = transform * Vec2(_X[i], _Y[i]);
+        SDL_Rect rect = {
+            (int)newPos.x - box.W2(),
+            (int)newPos.y - box.H2(),
+            box.w,
+            box.h};
 
-    // TODO: Extremely scuff collission resolution logic.
-    A->_Velocity = compNormA + compDirB;
-    A->_Position = A->_Position - dir;
-    B->_Velocity = compNormB + compDirA;
-    B->_Position = B->_Position - rdir;
+        if (IsColliding(i))
+        {
+            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+        }
+        else
+        {
+            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        }
+        SDL_RenderDrawPoint(renderer, (int)newPos.x, (int)newPos.y);
+        SDL_RenderDrawRect(renderer, &rect);
+    }
 }
+#endif
@@ -1,28 +1,131 @@
 #pragma once
 #include <chrono>
-#include <SDL_render.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
 
 #include "consts.h"
 #include "jmath.h"
+#include "jrender.h"
 
-class Sprite
+using namespace std;
+
+// Allocates on 'Alignment' byte boundaries so whole SIMD registers can be
+// loaded from the start of an array.
+template <class T, size_t Alignment>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <class U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n)
+    {
+        return (T *)::operator new(n * sizeof(T), align_val_t(Alignment));
+    }
+    void deallocate(T *p, size_t)
+    {
+        ::operator delete(p, align_val_t(Alignment));
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <class T>
+using AlignedVector = vector<T, AlignedAllocator<T, 32>>;
+
+// Everything one Update step needs, worked out once per call.
+struct SpriteUpdateParams
+{
+    float maxVelocity;
+    float dt;
+    float left;
+    float right;
+    float top;
+    float bottom;
+};
+
+// Every sprite in the scene, one array per field so the physics step only
+// streams through the floats it touches. A sprite's id is its index.
+class SpriteSystem
 {
 public:
-    Vec2 _Position;
-    Vec2 _Velocity;
-    Rect _BoundingBox;
-    int _Id;
-    int _QuadId;
-    bool _IsColliding = false;
+    // Center position, velocity and full size.
+    AlignedVector<float> _X;
+    AlignedVector<float> _Y;
+    AlignedVector<float> _Vx;
+    AlignedVector<float> _Vy;
+    AlignedVector<float> _W;
+    AlignedVector<float> _H;
+    // Truncated center of the bounding box, refreshed by Update.
+    AlignedVector<int> _BoxX;
+    AlignedVector<int> _BoxY;
+    // Spatial index handle of each sprite.
+    vector<int> _QuadId;
+    // One bit per sprite, set while it overlaps another.
+    vector<uint64_t> _Colliding;
+    // Use the AVX2 kernels when the CPU has them. CollidePairs also needs
+    // _UseSimdCollide.
+    bool _UseSimd = true;
+    bool _UseSimdCollide = g_Settings.SimdCollide;
 
 public:
-    Sprite(int Id, Vec2 position, Vec2 velocity, Rect BB);
-    ~Sprite() = default;
+    // Returns the new sprite's id.
+    int Add(Vec2 position, Vec2 velocity, Rect BB);
+    void Reserve(int count);
+    int Size() const { return (int)_X.size(); }
+
+    // The box handed to the spatial index, centered on the truncated position.
+    Rect GetBoundingBox(int id) const
+    {
+        return Rect(_BoxX[id], _BoxY[id], (int)_W[id], (int)_H[id]);
+    }
 
-    void Update(Rect &bounds, std::chrono::milliseconds delta);
+    bool IsColliding(int id) const { return (_Colliding[id >> 6] >> (id & 63)) & 1; }
+    void SetColliding(int id) { _Colliding[id >> 6] |= uint64_t(1) << (id & 63); }
+    void ClearColliding();
+
+    // Integrates every sprite, bounces them off the walls of 'bounds' and
+    // refreshes the bounding boxes.
+    void Update(Rect &bounds, chrono::milliseconds delta);
+    // Reference version of Update for sprites [first, last).
+    void UpdateScalar(int first, int last, const SpriteUpdateParams &params);
+
+    // Runs the scalar and SIMD update over awkward input (walls, clamping,
+    // sprites outside the bounds) and compares the results bit for bit.
+    // True if they match, or if this CPU has no SIMD kernel to compare.
+    static bool CheckSimdUpdate();
+    // Same for CollidePairs against Collide over a dense cluster.
+    static bool CheckSimdCollide();
+    // Swaps the velocity components along the line between the two centers
+    // and pushes them one unit apart.
+    void Collide(int a, int b);
+    // Same as calling Collide on every pair in order. With _UseSimdCollide,
+    // pairs are grouped into batches where no sprite appears twice, each
+    // batch coming after every earlier pair it shares a sprite with. Batches
+    // are then resolved 8 pairs at a time, which gives the same result.
+    void CollidePairs(const vector<pair<int, int>> &pairs);
     void Draw(SDL_Renderer *renderer,
               Mat3 &transform,
-              std::chrono::milliseconds deltaMs);
-    bool Intersects(Sprite *other);
-    void Collides(Sprite *B);
-};
\ No newline at end of file
+              chrono::milliseconds deltaMs);
+
+private:
+    // CollidePairs scratch.
+    vector<int> _LastBatch;
+    vector<int> _PairBatch;
+    vector<int> _BatchStart;
+    AlignedVector<int> _BatchA;
+    AlignedVector<int> _BatchB;
+};
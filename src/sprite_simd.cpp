@@ -0,0 +1,303 @@
+#include <math.h>
+#include <string.h>
+
+#include "sprite_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPRITE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SPRITE_SIMD_X86 0
+#endif
+
+// GCC and Clang need the target per function so the rest of the build can
+// stay baseline x86. MSVC emits AVX2 intrinsics whatever /arch says.
+#if SPRITE_SIMD_X86 && defined(__GNUC__)
+#define SPRITE_AVX2 __attribute__((target("avx2")))
+#else
+#define SPRITE_AVX2
+#endif
+
+#if SPRITE_SIMD_X86
+
+static bool detectAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool CpuHasAvx2()
+{
+    static const bool hasAvx2 = detectAvx2();
+    return hasAvx2;
+}
+
+SPRITE_AVX2 int UpdateAvx2(SpriteSystem &sprites, const SpriteUpdateParams &params)
+{
+    const __m256 maxVelocity = _mm256_set1_ps(params.maxVelocity);
+    const __m256 minVelocity = _mm256_set1_ps(-params.maxVelocity);
+    const __m256 dt = _mm256_set1_ps(params.dt);
+    const __m256 left = _mm256_set1_ps(params.left);
+    const __m256 right = _mm256_set1_ps(params.right);
+    const __m256 top = _mm256_set1_ps(params.top);
+    const __m256 bottom = _mm256_set1_ps(params.bottom);
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    float *xs = sprites._X.data();
+    float *ys = sprites._Y.data();
+    float *vxs = sprites._Vx.data();
+    float *vys = sprites._Vy.data();
+    int *boxXs = sprites._BoxX.data();
+    int *boxYs = sprites._BoxY.data();
+
+    const int count = sprites.Size() & ~7;
+    for (int i = 0; i < count; i += 8)
+    {
+        // Matches the scalar min(max(v, -m), m) for everything but NaN.
+        __m256 vx = _mm256_min_ps(_mm256_max_ps(_mm256_load_ps(vxs + i), minVelocity), maxVelocity);
+        __m256 vy = _mm256_min_ps(_mm256_max_ps(_mm256_load_ps(vys + i), minVelocity), maxVelocity);
+        // Separate multiply and add, a fused one would round differently.
+        __m256 x = _mm256_add_ps(_mm256_load_ps(xs + i), _mm256_mul_ps(vx, dt));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(ys + i), _mm256_mul_ps(vy, dt));
+
+        // Clamp to the walls and flip the velocity sign of anyone who hit one.
+        const __m256 pastLeft = _mm256_cmp_ps(x, left, _CMP_LT_OQ);
+        const __m256 pastRight = _mm256_andnot_ps(pastLeft, _mm256_cmp_ps(x, right, _CMP_GT_OQ));
+        x = _mm256_blendv_ps(x, left, pastLeft);
+        x = _mm256_blendv_ps(x, right, pastRight);
+        vx = _mm256_xor_ps(vx, _mm256_and_ps(_mm256_or_ps(pastLeft, pastRight), signBit));
+
+        const __m256 pastBottom = _mm256_cmp_ps(y, bottom, _CMP_LT_OQ);
+        const __m256 pastTop = _mm256_andnot_ps(pastBottom, _mm256_cmp_ps(y, top, _CMP_GT_OQ));
+        y = _mm256_blendv_ps(y, bottom, pastBottom);
+        y = _mm256_blendv_ps(y, top, pastTop);
+        vy = _mm256_xor_ps(vy, _mm256_and_ps(_mm256_or_ps(pastBottom, pastTop), signBit));
+
+        _mm256_store_ps(xs + i, x);
+        _mm256_store_ps(ys + i, y);
+        _mm256_store_ps(vxs + i, vx);
+        _mm256_store_ps(vys + i, vy);
+        // Truncating conversion, same as the scalar (int) cast.
+        _mm256_store_si256((__m256i *)(boxXs + i), _mm256_cvttps_epi32(x));
+        _mm256_store_si256((__m256i *)(boxYs + i), _mm256_cvttps_epi32(y));
+    }
+    return count;
+}
+
+SPRITE_AVX2 int CollideAvx2(SpriteSystem &sprites, const int *a, const int *b, int count)
+{
+    float *xs = sprites._X.data();
+    float *ys = sprites._Y.data();
+    float *vxs = sprites._Vx.data();
+    float *vys = sprites._Vy.data();
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    alignas(32) float out[8][8];
+    const int blocks = count & ~7;
+    for (int i = 0; i < blocks; i += 8)
+    {
+        const __m256i ia = _mm256_loadu_si256((const __m256i *)(a + i));
+        const __m256i ib = _mm256_loadu_si256((const __m256i *)(b + i));
+        const __m256 xa = _mm256_i32gather_ps(xs, ia, 4);
+        const __m256 ya = _mm256_i32gather_ps(ys, ia, 4);
+        const __m256 vxa = _mm256_i32gather_ps(vxs, ia, 4);
+        const __m256 vya = _mm256_i32gather_ps(vys, ia, 4);
+        const __m256 xb = _mm256_i32gather_ps(xs, ib, 4);
+        const __m256 yb = _mm256_i32gather_ps(ys, ib, 4);
+        const __m256 vxb = _mm256_i32gather_ps(vxs, ib, 4);
+        const __m256 vyb = _mm256_i32gather_ps(vys, ib, 4);
+
+        // Op for op the same as SpriteSystem::Collide, no fused multiply-adds.
+        const __m256 dx = _mm256_sub_ps(xb, xa);
+        const __m256 dy = _mm256_sub_ps(yb, ya);
+        const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        const __m256 dirX = _mm256_div_ps(dx, length);
+        const __m256 dirY = _mm256_div_ps(dy, length);
+        const __m256 normX = _mm256_xor_ps(dirY, signBit);
+        const __m256 normY = dirX;
+
+        const __m256 aDir = _mm256_add_ps(_mm256_mul_ps(vxa, dirX), _mm256_mul_ps(vya, dirY));
+        const __m256 bDir = _mm256_add_ps(_mm256_mul_ps(vxb, dirX), _mm256_mul_ps(vyb, dirY));
+        const __m256 aNorm = _mm256_add_ps(_mm256_mul_ps(vxa, normX), _mm256_mul_ps(vya, normY));
+        const __m256 bNorm = _mm256_add_ps(_mm256_mul_ps(vxb, normX), _mm256_mul_ps(vyb, normY));
+
+        _mm256_store_ps(out[0], _mm256_add_ps(_mm256_mul_ps(normX, aNorm), _mm256_mul_ps(dirX, bDir)));
+        _mm256_store_ps(out[1], _mm256_add_ps(_mm256_mul_ps(normY, aNorm), _mm256_mul_ps(dirY, bDir)));
+        _mm256_store_ps(out[2], _mm256_add_ps(_mm256_mul_ps(normX, bNorm), _mm256_mul_ps(dirX, aDir)));
+        _mm256_store_ps(out[3], _mm256_add_ps(_mm256_mul_ps(normY, bNorm), _mm256_mul_ps(dirY, aDir)));
+        _mm256_store_ps(out[4], _mm256_sub_ps(xa, dirX));
+        _mm256_store_ps(out[5], _mm256_sub_ps(ya, dirY));
+        _mm256_store_ps(out[6], _mm256_add_ps(xb, dirX));
+        _mm256_store_ps(out[7], _mm256_add_ps(yb, dirY));
+
+        // AVX2 has no scatter. Lanes never share a sprite so order is free.
+        for (int lane = 0; lane < 8; lane++)
+        {
+            const int A = a[i + lane];
+            const int B = b[i + lane];
+            vxs[A] = out[0][lane];
+            vys[A] = out[1][lane];
+            vxs[B] = out[2][lane];
+            vys[B] = out[3][lane];
+            xs[A] = out[4][lane];
+            ys[A] = out[5][lane];
+            xs[B] = out[6][lane];
+            ys[B] = out[7][lane];
+        }
+    }
+    return blocks;
+}
+
+#else
+
+bool CpuHasAvx2()
+{
+    return false;
+}
+
+int UpdateAvx2(SpriteSystem &sprites, const SpriteUpdateParams &params)
+{
+    return 0;
+}
+
+int CollideAvx2(SpriteSystem &sprites, const int *a, const int *b, int count)
+{
+    return 0;
+}
+
+#endif
+
+// Small deterministic generator so the check doesn't disturb rand().
+static float checkValue(unsigned &state, float range)
+{
+    state = state * 1664525u + 1013904223u;
+    return ((float)(state >> 8) / (float)(1 << 24) * 2.0f - 1.0f) * range;
+}
+
+bool SpriteSystem::CheckSimdUpdate()
+{
+    if (!CpuHasAvx2())
+    {
+        return true;
+    }
+
+    Rect bounds(0, 0, 1000, 800);
+    const float edges[] = {
+        (float)bounds.L(), (float)bounds.R(), (float)bounds.T(), (float)bounds.B(),
+        0.0f, -0.0f, 0.5f, -0.5f, 1e-7f};
+
+    SpriteSystem reference;
+    unsigned state = 12345;
+    for (int i = 0; i < 1003; i++)
+    {
+        // Positions inside and well outside the walls, velocities past the
+        // clamp, and every so often something sitting exactly on an edge.
+        Vec2 position(checkValue(state, 700.0f), checkValue(state, 600.0f));
+        Vec2 velocity(checkValue(state, 400.0f), checkValue(state, 400.0f));
+        if (i % 7 == 0)
+        {
+            position.x = edges[(i / 7) % 9];
+        }
+        if (i % 11 == 0)
+        {
+            position.y = edges[(i / 11) % 9];
+        }
+        if (i % 13 == 0)
+        {
+            velocity.x = (i & 1) ? g_Settings.MaxSpriteVelocity : -g_Settings.MaxSpriteVelocity;
+        }
+        reference.Add(position, velocity, Rect(0, 0, 4, 4));
+    }
+    SpriteSystem simd = reference;
+    reference._UseSimd = false;
+
+    const int deltas[] = {0, 1, 16, 33, 250, 4000};
+    for (int step = 0; step < 60; step++)
+    {
+        const chrono::milliseconds delta(deltas[step % 6]);
+        reference.Update(bounds, delta);
+        simd.Update(bounds, delta);
+
+        const size_t floats = reference.Size() * sizeof(float);
+        const size_t ints = reference.Size() * sizeof(int);
+        if (memcmp(reference._X.data(), simd._X.data(), floats) != 0 ||
+            memcmp(reference._Y.data(), simd._Y.data(), floats) != 0 ||
+            memcmp(reference._Vx.data(), simd._Vx.data(), floats) != 0 ||
+            memcmp(reference._Vy.data(), simd._Vy.data(), floats) != 0 ||
+            memcmp(reference._BoxX.data(), simd._BoxX.data(), ints) != 0 ||
+            memcmp(reference._BoxY.data(), simd._BoxY.data(), ints) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpriteSystem::CheckSimdCollide()
+{
+    if (!CpuHasAvx2())
+    {
+        return true;
+    }
+
+    // A tight cluster so most sprites take part in several pairs.
+    SpriteSystem reference;
+    unsigned state = 54321;
+    for (int i = 0; i < 400; i++)
+    {
+        Vec2 position(checkValue(state, 40.0f), checkValue(state, 40.0f));
+        Vec2 velocity(checkValue(state, 60.0f), checkValue(state, 60.0f));
+        reference.Add(position, velocity, Rect(0, 0, 8, 8));
+    }
+    vector<pair<int, int>> pairs;
+    for (int a = 0; a < reference.Size(); a++)
+    {
+        for (int b = a + 1; b < reference.Size(); b++)
+        {
+            if (fabsf(reference._X[a] - reference._X[b]) < 4.0f &&
+                fabsf(reference._Y[a] - reference._Y[b]) < 4.0f)
+            {
+                pairs.emplace_back(a, b);
+            }
+        }
+    }
+
+    SpriteSystem simd = reference;
+    simd._UseSimdCollide = true;
+    reference._UseSimd = false;
+    for (int step = 0; step < 4; step++)
+    {
+        reference.CollidePairs(pairs);
+        simd.CollidePairs(pairs);
+        const size_t floats = reference.Size() * sizeof(float);
+        if (memcmp(reference._X.data(), simd._X.data(), floats) != 0 ||
+            memcmp(reference._Y.data(), simd._Y.data(), floats) != 0 ||
+            memcmp(reference._Vx.data(), simd._Vx.data(), floats) != 0 ||
+            memcmp(reference._Vy.data(), simd._Vy.data(), floats) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "sprite.h"
+
+// SIMD kernels for SpriteSystem. The AVX2 versions are compiled for any
+// x86 target and only called after CpuHasAvx2() said yes.
+
+bool CpuHasAvx2();
+
+// Updates the sprites in blocks of 8 and returns how many it did, the
+// caller finishes the rest with UpdateScalar. Same results bit for bit.
+int UpdateAvx2(SpriteSystem &sprites, const SpriteUpdateParams &params);
+
+// Resolves pairs (a[i], b[i]) in blocks of 8 and returns how many it did.
+// No sprite may appear twice among the 'count' pairs.
+int CollideAvx2(SpriteSystem &sprites, const int *a, const int *b, int count);